@@ -0,0 +1,52 @@
+#ifndef BPTREE_H_
+#define BPTREE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "types.h"
+#include "rbtree.h"
+
+
+/*
+ * B+tree map with the rbtree API. Every node is BPTREE_NODE_SIZE bytes,
+ * cache line aligned, so a lookup touches a handful of lines per level
+ * instead of one per binary level. Entries live only in the leaves,
+ * which are chained in key order for foreach. Each separator in an inner
+ * node is the smallest key of the subtree to its right.
+ */
+#define BPTREE_NODE_SIZE	(4 * CACHE_LINE_SIZE)
+#define BPTREE_KEYS	((BPTREE_NODE_SIZE - 2 * sizeof(void *)) / (2 * sizeof(void *)))
+
+struct bpnode {
+	uint32_t count;
+	uint32_t leaf;
+	void *keys[BPTREE_KEYS];
+	union {
+		struct bpnode *children[BPTREE_KEYS + 1];
+		struct {
+			void *values[BPTREE_KEYS];
+			struct bpnode *next;
+		};
+	};
+};
+
+struct bptree {
+	struct bpnode *root;
+	struct bpnode *first;
+	size_t count;
+	CompareFunc cmp_func;
+	DestroyFunc key_dst_func;
+	DestroyFunc val_dst_func;
+};
+
+int bptree_init(struct bptree *tree, CompareFunc cmp, DestroyFunc key_dst, DestroyFunc val_dst);
+int bptree_insert(struct bptree *, void *key, void *val);
+int bptree_replace(struct bptree *, void *key, void *val);
+void *bptree_search(struct bptree *, const void *key);
+void bptree_foreach(struct bptree *, TraverseFunc, void *data);
+int bptree_remove(struct bptree *, const void *key);
+void bptree_clear(struct bptree *);
+void bptree_destroy(struct bptree *);
+
+#endif  // BPTREE_H_
@@ -0,0 +1,24 @@
+#ifndef EPOCH_H_
+#define EPOCH_H_
+
+/*
+ * Epoch-based reclamation. Readers bracket every access to shared nodes
+ * with epoch_enter/epoch_exit. A writer that unlinks a node hands it to
+ * epoch_retire, and its func runs once every thread that might still
+ * see the node has left its critical section. Threads register on first
+ * use; the entry is embedded in the retired object like struct ilink.
+ */
+struct epoch_entry {
+	struct epoch_entry *next;
+	void (*func)(struct epoch_entry *);
+	unsigned long epoch;
+};
+
+void epoch_enter(void);
+void epoch_exit(void);
+int epoch_in_critical(void);
+void epoch_retire(struct epoch_entry *, void (*func)(struct epoch_entry *));
+void epoch_barrier(void);
+int epoch_synchronize(void);
+
+#endif  // EPOCH_H_
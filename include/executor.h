@@ -0,0 +1,57 @@
+#ifndef EXECUTOR_H_
+#define EXECUTOR_H_
+
+#include <stdbool.h>
+
+#include "queue.h"
+#include "wsdeque.h"
+
+
+typedef void TaskFunc(void *arg);
+
+/*
+ * Caller-owned unit of work; may live on the spawning task's stack, so
+ * nothing touches it once it is marked done.
+ */
+struct task {
+	TaskFunc *func;
+	void *arg;
+	unsigned int state;
+};
+
+struct worker;
+
+/*
+ * Fork/join thread pool. Every worker owns a WSDeque: tasks spawned from
+ * inside a task go to the bottom of the spawner's deque, and idle
+ * workers steal from the top of a randomly chosen victim. Tasks coming
+ * from outside the pool go through the inject queue.
+ *
+ * A worker that finds nothing anywhere counts itself in sleepers and
+ * waits on the futex word work. Every spawn that sees a sleeper bumps
+ * work and wakes one, so new tasks are picked up at once and an idle
+ * pool does not poll.
+ *
+ * Threads outside the pool join by sleeping on wakeups, which is bumped
+ * whenever a task someone sleeps on finishes; the task itself may be
+ * gone by the time the wake is issued.
+ */
+struct executor {
+	struct worker *workers;
+	int count;
+	bool stop;
+	unsigned int wakeups;
+	struct Queue inject;
+	unsigned int work __attribute__((aligned(CACHE_LINE_SIZE)));
+	unsigned int sleepers;
+};
+
+void task_init(struct task *, TaskFunc *, void *arg);
+
+struct executor *executor_new(int threads);
+int executor_spawn(struct executor *, struct task *);
+void executor_join(struct executor *, struct task *);
+int executor_run(struct executor *, struct task *);
+void executor_destroy(struct executor *);
+
+#endif  // EXECUTOR_H_
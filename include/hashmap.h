@@ -0,0 +1,49 @@
+#ifndef HASHMAP_H_
+#define HASHMAP_H_
+
+#include <stddef.h>
+
+#include "types.h"
+#include "rbtree.h"
+
+
+/*
+ * Unordered map with the rbtree API: Robin Hood open addressing over one
+ * power of two array of slots. Each slot caches its key's hash, so a
+ * probe only calls cmp_func (for equality, 0 meaning equal) when the
+ * full hashes match, and the slot's distance from its home bucket is
+ * derived from the hash rather than stored. Removal shifts the
+ * following run back instead of leaving tombstones.
+ *
+ * foreach visits entries in slot order, not key order.
+ */
+struct hmslot {
+	/* 0 marks an empty slot; real hashes are forced non-zero */
+	size_t hash;
+	void *key;
+	void *value;
+};
+
+struct hashmap {
+	struct hmslot *slots;
+	size_t capacity;
+	size_t count;
+	HashFunc hash_func;
+	CompareFunc cmp_func;
+	DestroyFunc key_dst_func;
+	DestroyFunc val_dst_func;
+};
+
+int hashmap_init(struct hashmap *map, HashFunc hash, CompareFunc cmp, DestroyFunc key_dst,
+		DestroyFunc val_dst);
+int hashmap_insert(struct hashmap *, void *key, void *val);
+int hashmap_replace(struct hashmap *, void *key, void *val);
+void *hashmap_search(struct hashmap *, const void *key);
+void hashmap_foreach(struct hashmap *, TraverseFunc, void *data);
+int hashmap_remove(struct hashmap *, const void *key);
+void hashmap_clear(struct hashmap *);
+void hashmap_destroy(struct hashmap *);
+
+size_t hash_string(const void *key);
+
+#endif  // HASHMAP_H_
@@ -0,0 +1,39 @@
+#ifndef INTRUSIVE_H_
+#define INTRUSIVE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/*
+ * Intrusive Stack and Queue: the element embeds a struct ilink and the
+ * containers only relink it, so they never allocate or free. Use
+ * container_of to get back from the link to the element.
+ */
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+struct ilink {
+	struct ilink *next;
+};
+
+struct IStack {
+	struct ilink *head;
+};
+
+struct IQueue {
+	struct ilink *head;
+	struct ilink *tail;
+};
+
+void istack_init(struct IStack *);
+void istack_push(struct IStack *, struct ilink *);
+bool istack_is_empty(struct IStack *);
+struct ilink *istack_pop(struct IStack *);
+
+void iqueue_init(struct IQueue *);
+void ienqueue(struct IQueue *, struct ilink *);
+bool is_iqueue_empty(struct IQueue *);
+struct ilink *idequeue(struct IQueue *);
+
+#endif  // INTRUSIVE_H_
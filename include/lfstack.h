@@ -0,0 +1,76 @@
+#ifndef LFSTACK_H_
+#define LFSTACK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "types.h"
+#include "stack.h"
+
+
+/*
+ * Head of a lock-free node list. The tag is bumped on every successful
+ * update so a head that was popped and pushed back (ABA) fails the CAS.
+ */
+union lfstack_head {
+	struct {
+		struct node *ptr;
+		uintptr_t tag;
+	};
+	unsigned __int128 raw;
+} __attribute__((aligned(16)));
+
+#define LFSTACK_ELIM_SLOTS	16
+
+/* exchanger cell where a push that lost the head CAS offers its node */
+struct lfstack_slot {
+	struct node *offer;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+#define LFSTACK_STAT_STRIPES	16
+
+struct lfstack_stats {
+	unsigned long cas_failures;
+	unsigned long elim_attempts;
+	unsigned long elim_hits;
+};
+
+/*
+ * Counters are bumped on exactly the contended paths, so each thread
+ * counts into its own line (threads beyond LFSTACK_STAT_STRIPES share)
+ * and lfstack_get_stats adds the stripes up.
+ */
+struct lfstack_stat_stripe {
+	struct lfstack_stats stats;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/*
+ * Treiber stack shared between threads. Nodes are never returned to the
+ * allocator while the stack lives; popped nodes go to free_nodes and are
+ * reused by later pushes, so a racing pop may always read node->next.
+ * Pushes never allocate: lfstack_reserve fills the pool up front, and a
+ * push that finds it empty fails with ENOBUFS. Reserve the peak depth.
+ *
+ * A push or pop whose head CAS fails tries the elimination array before
+ * retrying: a pending push and a pop that meet in a slot hand the data
+ * over directly and neither touches head. elim_range is the number of
+ * slots in use, grown on collisions and shrunk on timeouts.
+ */
+struct LFStack {
+	union lfstack_head head __attribute__((aligned(CACHE_LINE_SIZE)));
+	union lfstack_head free_nodes __attribute__((aligned(CACHE_LINE_SIZE)));
+	struct lfstack_slot elim[LFSTACK_ELIM_SLOTS];
+	unsigned int elim_range __attribute__((aligned(CACHE_LINE_SIZE)));
+	DestroyFunc destroy_func;
+	struct lfstack_stat_stripe stats[LFSTACK_STAT_STRIPES];
+};
+
+struct LFStack *lfstack_new(DestroyFunc);
+int lfstack_reserve(struct LFStack *, size_t count);
+int lfstack_push(struct LFStack *, void *);
+int lfstack_is_empty(struct LFStack *);
+void *lfstack_pop(struct LFStack *);
+void lfstack_get_stats(struct LFStack *, struct lfstack_stats *);
+void lfstack_destroy(struct LFStack *);
+
+#endif  // LFSTACK_H_
@@ -0,0 +1,19 @@
+#ifndef LOCK_H_
+#define LOCK_H_
+
+#include <time.h>
+
+
+/*
+ * Futex-based mutex on a plain unsigned int initialised to 0
+ * (0 unlocked, 1 locked, 2 locked with waiters), plus the raw futex
+ * wait/wake calls it is built from.
+ */
+void lock(unsigned int *);
+int trylock(unsigned int *);
+void unlock(unsigned int *);
+
+int futex_wait(unsigned int *addr, unsigned int val, const struct timespec *timeout);
+int futex_wake(unsigned int *addr, int count);
+
+#endif  // LOCK_H_
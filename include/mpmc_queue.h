@@ -0,0 +1,36 @@
+#ifndef MPMC_QUEUE_H_
+#define MPMC_QUEUE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "types.h"
+
+
+struct mpmc_cell {
+	size_t seq;
+	void *data;
+};
+
+/*
+ * Bounded multi-producer/multi-consumer array queue (Vyukov). Each cell
+ * carries a sequence number telling whether it is ready to be written
+ * for lap seq or read for lap seq - 1, so producers and consumers only
+ * contend on their own position counter and never take a lock.
+ */
+struct MPMCQueue {
+	size_t enqueue_pos __attribute__((aligned(CACHE_LINE_SIZE)));
+	size_t dequeue_pos __attribute__((aligned(CACHE_LINE_SIZE)));
+	struct mpmc_cell *cells __attribute__((aligned(CACHE_LINE_SIZE)));
+	size_t mask;
+	DestroyFunc destroy_func;
+};
+
+bool mpmc_queue_init(DestroyFunc destroy_func, size_t capacity, struct MPMCQueue *queue);
+int mpmc_try_enqueue(struct MPMCQueue *, void *);
+int mpmc_enqueue(struct MPMCQueue *, void *);
+int mpmc_try_dequeue(struct MPMCQueue *, void **);
+int mpmc_dequeue(struct MPMCQueue *, void **);
+void mpmc_queue_destroy(struct MPMCQueue *);
+
+#endif  // MPMC_QUEUE_H_
@@ -0,0 +1,28 @@
+#ifndef MSQUEUE_H_
+#define MSQUEUE_H_
+
+#include <stdbool.h>
+
+#include "types.h"
+#include "stack.h"
+
+
+/*
+ * Unbounded lock-free FIFO (Michael-Scott) over struct node. head always
+ * points at a dummy node whose successor holds the next element. Nodes
+ * taken off the front are reclaimed through epoch_retire, so a dequeue
+ * racing with another never reads freed memory.
+ */
+struct MSQueue {
+	struct node *head __attribute__((aligned(CACHE_LINE_SIZE)));
+	struct node *tail __attribute__((aligned(CACHE_LINE_SIZE)));
+	DestroyFunc destroy_func;
+};
+
+bool msqueue_init(DestroyFunc destroy_func, struct MSQueue *queue);
+int ms_enqueue(struct MSQueue *, void *);
+bool is_msqueue_empty(struct MSQueue *);
+void *ms_dequeue(struct MSQueue *);
+void msqueue_destroy(struct MSQueue *);
+
+#endif  // MSQUEUE_H_
@@ -0,0 +1,59 @@
+#ifndef PRBTREE_H_
+#define PRBTREE_H_
+
+#include <stddef.h>
+
+#include "types.h"
+#include "rbtree.h"
+
+
+/*
+ * Persistent red-black tree. A struct prbtree is one version of the map;
+ * prbtree_snapshot copies it in O(1) by taking a reference on the root.
+ * Updates copy only the nodes on the path they change, which other
+ * versions may share, and rebuild in place the nodes this version owns
+ * alone, so a tree without snapshots pays almost nothing for them.
+ *
+ * Node reference counts are atomic: a snapshot may be read and destroyed
+ * in another thread while the original keeps changing. Each version is
+ * used by one thread at a time.
+ *
+ * Existing keys behave as in rbtree: prbtree_insert keeps the tree's key
+ * (destroying the new one) and replaces the value, prbtree_replace swaps
+ * both. Keys and values are shared between versions and each is
+ * destroyed with the last node holding it.
+ */
+struct prbnode {
+	struct prbnode *left;
+	struct prbnode *right;
+	void *key;
+	void *value;
+	/* nodes, in any version, holding key or value; NULL without a destructor */
+	unsigned long *key_owners;
+	unsigned long *val_owners;
+	unsigned long refs;
+	enum color color;
+};
+
+struct prbtree {
+	struct prbnode *root;
+	size_t count;
+	CompareFunc cmp_func;
+	DestroyFunc key_dst_func;
+	DestroyFunc val_dst_func;
+	/* per-version scratch nodes, not shared by snapshots */
+	struct prbnode *spare;
+	size_t spare_count;
+};
+
+int prbtree_init(struct prbtree *tree, CompareFunc cmp, DestroyFunc key_dst, DestroyFunc val_dst);
+int prbtree_snapshot(struct prbtree *snap, const struct prbtree *tree);
+int prbtree_insert(struct prbtree *, void *key, void *val);
+int prbtree_replace(struct prbtree *, void *key, void *val);
+void *prbtree_search(struct prbtree *, const void *key);
+void prbtree_foreach(struct prbtree *, TraverseFunc, void *data);
+int prbtree_remove(struct prbtree *, const void *key);
+void prbtree_clear(struct prbtree *);
+void prbtree_destroy(struct prbtree *);
+
+#endif  // PRBTREE_H_
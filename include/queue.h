@@ -2,6 +2,8 @@
 #define QUEUE_H_
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
 
 #include "types.h"
 #include "stack.h"
@@ -11,12 +13,28 @@ struct Queue {
 	struct node *head;
 	struct node *tail;
 	DestroyFunc destroy_func;
+
+	/*
+	 * Blocking mode (queue_init_blocking): every operation takes lock,
+	 * and consumers in dequeue_timed sleep on the seq futex, which
+	 * producers bump before waking them.
+	 */
+	bool blocking;
+	bool closed;
+	unsigned int lock;
+	unsigned int seq;
+	unsigned int waiters;
 };
 
 bool queue_init(DestroyFunc destroy_func, struct Queue *queue);
+bool queue_init_blocking(DestroyFunc destroy_func, struct Queue *queue);
 int enqueue(struct Queue *, void *);
+int enqueue_n(struct Queue *, void **, size_t);
 bool is_queue_empty(struct Queue *queue);
 void *dequeue(struct Queue *);
+size_t dequeue_n(struct Queue *, void **, size_t);
+void *dequeue_timed(struct Queue *, const struct timespec *timeout);
+void queue_close(struct Queue *);
 void queue_destroy(struct Queue *);
 
 #endif  // QUEUE_H_
@@ -1,6 +1,9 @@
 #ifndef RBTREE_H_
 #define RBTREE_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "types.h"
 
 
@@ -9,31 +12,107 @@ enum color {
         Red
 };
 
+/*
+ * Nodes are at least pointer aligned, so the low bit of the parent
+ * pointer is free to hold the node's color.
+ *
+ * Building with -DRBTREE_ORDER_STATS (the library and everything that
+ * includes this header alike; make ORDER_STATS=1 does both and links
+ * against lib/librbmap_stats.a) adds a subtree size to each node and the
+ * O(log n) rbtree_rank, rbtree_select and rbtree_count_range.
+ */
 struct rbnode {
-	struct rbnode *parent;
+	uintptr_t parent_color;
 	struct rbnode *left;
 	struct rbnode *right;
 	void *key;
 	void *value;
-	enum color color;
+#ifdef RBTREE_ORDER_STATS
+	size_t size;
+#endif
 };
 
+#define rb_parent(n)	((struct rbnode *)((n)->parent_color & ~(uintptr_t)1))
+#define rb_color(n)	((enum color)((n)->parent_color & 1))
+
+struct rbslab;
+
 struct rbtree {
 	struct rbnode *root;
+	/* largest entry, so appends and rbtree_last are O(1) */
+	struct rbnode *rightmost;
+	size_t count;
 	CompareFunc cmp_func;
 	DestroyFunc key_dst_func;
 	DestroyFunc val_dst_func;
+
+	/*
+	 * Node arena (rbtree_init_arena): nodes are carved from slabs of
+	 * slab_nodes nodes and removed ones are recycled through free_nodes.
+	 * slab_nodes == 0 means one malloc per node.
+	 */
+	struct rbslab *slabs;
+	struct rbnode *free_nodes;
+	size_t slab_nodes;
+	size_t slab_used;
 };
 
 typedef int TraverseFunc(void *key, void *val, void *data);
 
+/*
+ * Position in a tree's key order; node is NULL past either end. Inserts
+ * (rbtree_insert, _replace, _get_or_insert, _upsert, _insert_hint) keep
+ * every cursor valid, since rebalancing relinks nodes but never moves an
+ * entry, and a cursor steps over new entries in key order. Removal
+ * invalidates the tree's cursors (it may move entries between nodes), as
+ * do rbtree_clear and rbtree_insert_many, which may rebuild the tree.
+ */
+struct rbcursor {
+	struct rbtree *tree;
+	struct rbnode *node;
+};
+
+#define rbcursor_key(c)		((c)->node->key)
+#define rbcursor_value(c)	((c)->node->value)
+
 int rbtree_init(struct rbtree *tree, CompareFunc cmp, DestroyFunc key_dst, DestroyFunc val_dst);
+int rbtree_init_arena(struct rbtree *tree, CompareFunc cmp, DestroyFunc key_dst,
+		DestroyFunc val_dst, size_t slab_nodes);
 int rbtree_insert(struct rbtree *, void *key, void *val);
 int rbtree_replace(struct rbtree *, void *key, void *val);
+void **rbtree_get_or_insert(struct rbtree *, void *key, void *val, int *inserted);
+void **rbtree_upsert(struct rbtree *, void *key, void *val);
 void *rbtree_search(struct rbtree *, const void *key);
+int rbtree_search_batch(struct rbtree *, const void **keys, void **out, size_t n);
 void rbtree_foreach(struct rbtree *, TraverseFunc, void *data);
 int rbtree_remove(struct rbtree *, const void *key);
 void rbtree_clear(struct rbtree *);
 void rbtree_destroy(struct rbtree *);
 
+/*
+ * Both lay the tree out in one slab of nodes. A tree made by rbtree_init
+ * therefore becomes an arena tree, as if from rbtree_init_arena with 4096
+ * node slabs, the first time either of them builds: later inserts carve
+ * nodes from slabs, and removed nodes are kept for reuse until
+ * rbtree_clear. rbtree_insert_many only builds for a batch of at least a
+ * quarter of the tree's size; a smaller one keeps the tree's mode. On -1
+ * neither has changed the tree or taken ownership of any entry.
+ */
+int rbtree_build_sorted(struct rbtree *, void **keys, void **vals, size_t n);
+int rbtree_insert_many(struct rbtree *, void **keys, void **vals, size_t n);
+
+int rbtree_first(struct rbtree *, struct rbcursor *);
+int rbtree_last(struct rbtree *, struct rbcursor *);
+int rbtree_lower_bound(struct rbtree *, const void *key, struct rbcursor *);
+int rbtree_upper_bound(struct rbtree *, const void *key, struct rbcursor *);
+int rbcursor_next(struct rbcursor *);
+int rbcursor_prev(struct rbcursor *);
+int rbtree_insert_hint(struct rbtree *, struct rbcursor *hint, void *key, void *val);
+
+#ifdef RBTREE_ORDER_STATS
+size_t rbtree_rank(struct rbtree *, const void *key);
+int rbtree_select(struct rbtree *, size_t rank, void **key, void **val);
+size_t rbtree_count_range(struct rbtree *, const void *lo, const void *hi);
+#endif
+
 #endif  // RBTREE_H_
@@ -0,0 +1,50 @@
+#ifndef RBTREE32_H_
+#define RBTREE32_H_
+
+#include <stdint.h>
+
+#include "types.h"
+#include "rbtree.h"
+
+
+/*
+ * Red-black tree whose nodes live in one growable array and link to
+ * each other by 32-bit index. Index 0 is the black nil sentinel. A node
+ * is 32 bytes instead of 40, and since no link is a pointer the array
+ * can be moved, copied or written out as is (keys and values are still
+ * whatever the caller stored).
+ *
+ * rbtree32_destroy frees the array but leaves an empty, usable tree; the
+ * next insert allocates a new array.
+ */
+struct rb32node {
+	uint32_t parent;
+	uint32_t left;
+	uint32_t right;
+	uint32_t color;
+	void *key;
+	void *value;
+};
+
+struct rbtree32 {
+	struct rb32node *nodes;
+	uint32_t capacity;
+	uint32_t used;
+	uint32_t count;
+	uint32_t root;
+	uint32_t free_head;
+	CompareFunc cmp_func;
+	DestroyFunc key_dst_func;
+	DestroyFunc val_dst_func;
+};
+
+int rbtree32_init(struct rbtree32 *tree, CompareFunc cmp, DestroyFunc key_dst, DestroyFunc val_dst);
+int rbtree32_insert(struct rbtree32 *, void *key, void *val);
+int rbtree32_replace(struct rbtree32 *, void *key, void *val);
+void *rbtree32_search(struct rbtree32 *, const void *key);
+void rbtree32_foreach(struct rbtree32 *, TraverseFunc, void *data);
+int rbtree32_remove(struct rbtree32 *, const void *key);
+void rbtree32_clear(struct rbtree32 *);
+void rbtree32_destroy(struct rbtree32 *);
+
+#endif  // RBTREE32_H_
@@ -0,0 +1,321 @@
+#ifndef RBTREE_GEN_H_
+#define RBTREE_GEN_H_
+
+#include <stdlib.h>
+
+#include "rbtree.h"
+
+
+/*
+ * Type-generating red-black tree, in the spirit of BSD <sys/tree.h>.
+ *
+ *	RBTREE_GENERATE(name, key_t, val_t, cmp)
+ *
+ * expands to struct name, struct name##_node and static inline
+ * name##_init/_insert/_search/_remove/_foreach/_clear. Keys and values
+ * are stored inline and cmp(a, b) is called directly on key_t values, so
+ * the compiler can inline it into the descent instead of going through a
+ * CompareFunc pointer. Keys and values are copied in and out; the tree
+ * never frees what they point to. struct rbtree stays the dynamically
+ * typed fallback.
+ */
+#define RBTREE_GENERATE(name, key_t, val_t, cmp) \
+struct name##_node { \
+	struct name##_node *parent; \
+	struct name##_node *left; \
+	struct name##_node *right; \
+	key_t key; \
+	val_t value; \
+	enum color color; \
+}; \
+\
+struct name { \
+	struct name##_node *root; \
+}; \
+\
+typedef int name##_traverse_func(key_t *key, val_t *val, void *data); \
+\
+static inline void name##_init(struct name *tree) \
+{ \
+	tree->root = NULL; \
+} \
+\
+static inline void name##__rotate_left(struct name *tree, struct name##_node *x) \
+{ \
+	struct name##_node *y = x->right; \
+\
+	if ((x->right = y->left)) \
+		y->left->parent = x; \
+	if (!(y->parent = x->parent)) \
+		tree->root = y; \
+	else if (x == x->parent->left) \
+		x->parent->left = y; \
+	else \
+		x->parent->right = y; \
+	y->left = x; \
+	x->parent = y; \
+} \
+\
+static inline void name##__rotate_right(struct name *tree, struct name##_node *x) \
+{ \
+	struct name##_node *y = x->left; \
+\
+	if ((x->left = y->right)) \
+		y->right->parent = x; \
+	if (!(y->parent = x->parent)) \
+		tree->root = y; \
+	else if (x == x->parent->right) \
+		x->parent->right = y; \
+	else \
+		x->parent->left = y; \
+	y->right = x; \
+	x->parent = y; \
+} \
+\
+static inline void name##__insert_fixup(struct name *tree, struct name##_node *z) \
+{ \
+	struct name##_node *p; \
+	struct name##_node *g; \
+	struct name##_node *u; \
+\
+	while ((p = z->parent) && Red == p->color) { \
+		g = p->parent; \
+		if (p == g->left) { \
+			if ((u = g->right) && Red == u->color) { \
+				p->color = u->color = Black; \
+				g->color = Red; \
+				z = g; \
+				continue; \
+			} \
+			if (z == p->right) { \
+				name##__rotate_left(tree, p); \
+				z = p; \
+				p = z->parent; \
+			} \
+			p->color = Black; \
+			g->color = Red; \
+			name##__rotate_right(tree, g); \
+		} else { \
+			if ((u = g->left) && Red == u->color) { \
+				p->color = u->color = Black; \
+				g->color = Red; \
+				z = g; \
+				continue; \
+			} \
+			if (z == p->left) { \
+				name##__rotate_right(tree, p); \
+				z = p; \
+				p = z->parent; \
+			} \
+			p->color = Black; \
+			g->color = Red; \
+			name##__rotate_left(tree, g); \
+		} \
+	} \
+	tree->root->color = Black; \
+} \
+\
+/* an existing key gets its value replaced; -1 if allocation fails */ \
+static inline int name##_insert(struct name *tree, key_t key, val_t value) \
+{ \
+	struct name##_node *parent = NULL; \
+	struct name##_node *curr = tree->root; \
+	struct name##_node *node; \
+	int res = 0; \
+\
+	while (curr) { \
+		if (!(res = cmp(key, curr->key))) { \
+			curr->value = value; \
+			return 0; \
+		} \
+		parent = curr; \
+		curr = res < 0 ? curr->left : curr->right; \
+	} \
+\
+	if (!(node = (struct name##_node *)malloc(sizeof(*node)))) \
+		return -1; \
+	node->parent = parent; \
+	node->left = node->right = NULL; \
+	node->key = key; \
+	node->value = value; \
+	node->color = Red; \
+\
+	if (!parent) \
+		tree->root = node; \
+	else if (res < 0) \
+		parent->left = node; \
+	else \
+		parent->right = node; \
+	name##__insert_fixup(tree, node); \
+\
+	return 0; \
+} \
+\
+static inline struct name##_node *name##__find(struct name *tree, key_t key) \
+{ \
+	struct name##_node *curr = tree->root; \
+	int res; \
+\
+	while (curr && (res = cmp(key, curr->key))) \
+		curr = res < 0 ? curr->left : curr->right; \
+\
+	return curr; \
+} \
+\
+/* pointer to the stored value, NULL if key is absent */ \
+static inline val_t *name##_search(struct name *tree, key_t key) \
+{ \
+	struct name##_node *node = name##__find(tree, key); \
+\
+	return node ? &node->value : NULL; \
+} \
+\
+static inline void name##__remove_fixup(struct name *tree, struct name##_node *x, \
+		struct name##_node *parent) \
+{ \
+	struct name##_node *w; \
+\
+	while ((!x || Black == x->color) && x != tree->root) { \
+		if (x == parent->left) { \
+			w = parent->right; \
+			if (Red == w->color) { \
+				w->color = Black; \
+				parent->color = Red; \
+				name##__rotate_left(tree, parent); \
+				w = parent->right; \
+			} \
+			if ((!w->left || Black == w->left->color) \
+					&& (!w->right || Black == w->right->color)) { \
+				w->color = Red; \
+				x = parent; \
+				parent = x->parent; \
+				continue; \
+			} \
+			if (!w->right || Black == w->right->color) { \
+				w->left->color = Black; \
+				w->color = Red; \
+				name##__rotate_right(tree, w); \
+				w = parent->right; \
+			} \
+			w->color = parent->color; \
+			parent->color = Black; \
+			w->right->color = Black; \
+			name##__rotate_left(tree, parent); \
+		} else { \
+			w = parent->left; \
+			if (Red == w->color) { \
+				w->color = Black; \
+				parent->color = Red; \
+				name##__rotate_right(tree, parent); \
+				w = parent->left; \
+			} \
+			if ((!w->left || Black == w->left->color) \
+					&& (!w->right || Black == w->right->color)) { \
+				w->color = Red; \
+				x = parent; \
+				parent = x->parent; \
+				continue; \
+			} \
+			if (!w->left || Black == w->left->color) { \
+				w->right->color = Black; \
+				w->color = Red; \
+				name##__rotate_left(tree, w); \
+				w = parent->left; \
+			} \
+			w->color = parent->color; \
+			parent->color = Black; \
+			w->left->color = Black; \
+			name##__rotate_right(tree, parent); \
+		} \
+		x = tree->root; \
+	} \
+	if (x) \
+		x->color = Black; \
+} \
+\
+/* 0 if key was removed, -1 if it was not there */ \
+static inline int name##_remove(struct name *tree, key_t key) \
+{ \
+	struct name##_node *node; \
+	struct name##_node *succ; \
+	struct name##_node *child; \
+	struct name##_node *parent; \
+\
+	if (!(node = name##__find(tree, key))) \
+		return -1; \
+\
+	/* two children: take over the successor's entry and unlink it instead */ \
+	if (node->left && node->right) { \
+		for (succ = node->right; succ->left; succ = succ->left) \
+			; \
+		node->key = succ->key; \
+		node->value = succ->value; \
+		node = succ; \
+	} \
+\
+	child = node->left ? node->left : node->right; \
+	parent = node->parent; \
+	if (child) \
+		child->parent = parent; \
+	if (!parent) \
+		tree->root = child; \
+	else if (node == parent->left) \
+		parent->left = child; \
+	else \
+		parent->right = child; \
+\
+	if (Black == node->color) \
+		name##__remove_fixup(tree, child, parent); \
+	free(node); \
+\
+	return 0; \
+} \
+\
+/* in order; a non-zero return from trav_func stops the walk */ \
+static inline void name##_foreach(struct name *tree, name##_traverse_func *trav_func, void *data) \
+{ \
+	struct name##_node *curr = tree->root; \
+	struct name##_node *parent; \
+\
+	while (curr && curr->left) \
+		curr = curr->left; \
+	while (curr) { \
+		if (trav_func(&curr->key, &curr->value, data)) \
+			break; \
+		if (curr->right) { \
+			for (curr = curr->right; curr->left; curr = curr->left) \
+				; \
+		} else { \
+			while ((parent = curr->parent) && curr == parent->right) \
+				curr = parent; \
+			curr = parent; \
+		} \
+	} \
+} \
+\
+static inline void name##_clear(struct name *tree) \
+{ \
+	struct name##_node *curr = tree->root; \
+	struct name##_node *parent; \
+\
+	/* post-order: free a node once both subtrees are gone */ \
+	while (curr) { \
+		if (curr->left) { \
+			curr = curr->left; \
+		} else if (curr->right) { \
+			curr = curr->right; \
+		} else { \
+			if ((parent = curr->parent)) { \
+				if (curr == parent->left) \
+					parent->left = NULL; \
+				else \
+					parent->right = NULL; \
+			} \
+			free(curr); \
+			curr = parent; \
+		} \
+	} \
+	tree->root = NULL; \
+}
+
+#endif  // RBTREE_GEN_H_
@@ -0,0 +1,68 @@
+#ifndef RCU_RBTREE_H_
+#define RCU_RBTREE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "types.h"
+#include "epoch.h"
+#include "rbtree.h"
+
+
+/*
+ * Red-black tree for read-mostly sharing between threads. Readers
+ * (search, foreach) take no lock: published nodes are never written
+ * again. Writers are serialized by a futex lock and build each new
+ * version by copying the root-to-change path, then publish it with one
+ * release store of root. Nodes and entries the new version no longer
+ * reaches are freed through epoch_retire once no reader can still see
+ * them.
+ *
+ * search returns the value without holding anything; if the tree owns
+ * its values (val_dst), keep using it only inside
+ * rcu_rbtree_read_lock/unlock.
+ *
+ * clear and destroy wait for readers to leave, so they fail with -1,
+ * without touching the tree, when called inside a read-side section.
+ */
+struct rcu_rbnode {
+	struct rcu_rbnode *left;
+	struct rcu_rbnode *right;
+	void *key;
+	void *value;
+	/* (writer generation << 1) | color */
+	uint64_t stamp;
+};
+
+struct rcu_batch;
+
+struct rcu_rbtree {
+	struct rcu_rbnode *root;
+	CompareFunc cmp_func;
+	DestroyFunc key_dst_func;
+	DestroyFunc val_dst_func;
+
+	/* writer side, off the readers' line */
+	unsigned int lock __attribute__((aligned(CACHE_LINE_SIZE)));
+	size_t count;
+	uint64_t gen;
+	struct rcu_rbnode *spare;
+	size_t spare_count;
+	/* what the next update retires, allocated before it starts */
+	struct rcu_batch *batch;
+	size_t batch_capacity;
+};
+
+#define rcu_rbtree_read_lock()		epoch_enter()
+#define rcu_rbtree_read_unlock()	epoch_exit()
+
+int rcu_rbtree_init(struct rcu_rbtree *tree, CompareFunc cmp, DestroyFunc key_dst, DestroyFunc val_dst);
+int rcu_rbtree_insert(struct rcu_rbtree *, void *key, void *val);
+int rcu_rbtree_replace(struct rcu_rbtree *, void *key, void *val);
+void *rcu_rbtree_search(struct rcu_rbtree *, const void *key);
+void rcu_rbtree_foreach(struct rcu_rbtree *, TraverseFunc, void *data);
+int rcu_rbtree_remove(struct rcu_rbtree *, const void *key);
+int rcu_rbtree_clear(struct rcu_rbtree *);
+int rcu_rbtree_destroy(struct rcu_rbtree *);
+
+#endif  // RCU_RBTREE_H_
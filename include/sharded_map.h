@@ -0,0 +1,49 @@
+#ifndef SHARDED_MAP_H_
+#define SHARDED_MAP_H_
+
+#include <stddef.h>
+
+#include "types.h"
+#include "rbtree.h"
+
+
+/*
+ * Map split over a power of two number of rbtrees, each behind its own
+ * futex lock. A key's hash picks its shard, so point operations on
+ * different shards never touch the same lock or cache line. foreach
+ * takes every shard lock (in index order) and merges the shards back
+ * into key order.
+ *
+ * search returns the value after the shard lock is dropped; if the map
+ * owns its values, the caller must keep others from removing or
+ * replacing that key meanwhile.
+ */
+struct shard {
+	unsigned int lock;
+	/* both counted under lock: every acquisition, and those that waited */
+	unsigned long acquired;
+	unsigned long contended;
+	struct rbtree tree;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct sharded_map {
+	struct shard *shards;
+	size_t shard_count;
+	unsigned int shard_bits;
+	HashFunc hash_func;
+};
+
+int sharded_map_init(struct sharded_map *map, size_t shards, HashFunc hash, CompareFunc cmp,
+		DestroyFunc key_dst, DestroyFunc val_dst);
+int sharded_map_insert(struct sharded_map *, void *key, void *val);
+int sharded_map_replace(struct sharded_map *, void *key, void *val);
+void *sharded_map_search(struct sharded_map *, const void *key);
+int sharded_map_remove(struct sharded_map *, const void *key);
+void sharded_map_foreach(struct sharded_map *, TraverseFunc, void *data);
+size_t sharded_map_count(struct sharded_map *);
+void sharded_map_stats(struct sharded_map *, size_t shard, unsigned long *acquired,
+		unsigned long *contended);
+void sharded_map_clear(struct sharded_map *);
+void sharded_map_destroy(struct sharded_map *);
+
+#endif  // SHARDED_MAP_H_
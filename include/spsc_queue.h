@@ -0,0 +1,34 @@
+#ifndef SPSC_QUEUE_H_
+#define SPSC_QUEUE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "types.h"
+
+
+/*
+ * Bounded single-producer/single-consumer ring. head is only written by
+ * the consumer and tail only by the producer; each side keeps a cached
+ * copy of the other's index on its own cache line and only reloads it
+ * when the ring looks full (producer) or empty (consumer).
+ */
+struct SPSCQueue {
+	size_t head __attribute__((aligned(CACHE_LINE_SIZE)));
+	size_t tail_cache;
+
+	size_t tail __attribute__((aligned(CACHE_LINE_SIZE)));
+	size_t head_cache;
+
+	void **slots __attribute__((aligned(CACHE_LINE_SIZE)));
+	size_t mask;
+	DestroyFunc destroy_func;
+};
+
+bool spsc_queue_init(DestroyFunc destroy_func, size_t capacity, struct SPSCQueue *queue);
+int spsc_enqueue(struct SPSCQueue *, void *);
+bool is_spsc_queue_empty(struct SPSCQueue *);
+int spsc_dequeue(struct SPSCQueue *, void **);
+void spsc_queue_destroy(struct SPSCQueue *);
+
+#endif  // SPSC_QUEUE_H_
@@ -1,6 +1,8 @@
 #ifndef STACK_H_
 #define STACK_H_
 
+#include <stddef.h>
+
 #include "types.h"
 
 
@@ -9,17 +11,32 @@ struct node {
 	void *data;
 };
 
+/* block of slots used by a chunked stack, allocated on a cache line */
+struct stack_chunk {
+	struct stack_chunk *prev;
+	struct stack_chunk *next;
+	void *slots[];
+};
+
 struct Stack {
 	struct node *head;
 	DestroyFunc destroy_func;
+
+	/* chunked mode: chunk_slots != 0, elements live in chunk->slots */
+	struct stack_chunk *chunk;
+	size_t top;
+	size_t chunk_slots;
 };
 
 
 
 struct Stack *stack_new(DestroyFunc);
+struct Stack *stack_new_chunked(DestroyFunc, size_t chunk_slots);
 int stack_push(struct Stack*, void*);
+int stack_push_n(struct Stack *, void **, size_t);
 int stack_is_empty(struct Stack *);
 void *stack_pop(struct Stack *);
+size_t stack_pop_n(struct Stack *, void **, size_t);
 void stack_destroy(struct Stack *);
 
 #endif  // STACK_H_
@@ -1,7 +1,12 @@
 #ifndef TYPES_H_
 #define TYPES_H_
 
+#include <stddef.h>
+
+#define CACHE_LINE_SIZE	64
+
 typedef void (*DestroyFunc)(void *);
 typedef int (*CompareFunc) (const void *, const void *);
+typedef size_t (*HashFunc)(const void *);
 
 #endif
@@ -0,0 +1,34 @@
+#ifndef WSDEQUE_H_
+#define WSDEQUE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "types.h"
+
+
+struct wsdeque_array {
+	long size;
+	struct wsdeque_array *prev;
+	void *slots[];
+};
+
+/*
+ * Chase-Lev work-stealing deque. The owning thread pushes and pops at
+ * bottom without locks; any other thread may steal from top. The
+ * circular array grows on push; outgrown arrays stay on the prev chain
+ * until destroy because a thief may still be reading them.
+ */
+struct WSDeque {
+	long top __attribute__((aligned(CACHE_LINE_SIZE)));
+	long bottom __attribute__((aligned(CACHE_LINE_SIZE)));
+	struct wsdeque_array *array;
+};
+
+bool wsdeque_init(struct WSDeque *, size_t capacity);
+int wsdeque_push(struct WSDeque *, void *);
+void *wsdeque_pop(struct WSDeque *);
+void *wsdeque_steal(struct WSDeque *);
+void wsdeque_destroy(struct WSDeque *);
+
+#endif  // WSDEQUE_H_
@@ -0,0 +1,513 @@
+#include "bptree.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logmsg.h"
+
+
+#define MIN_KEYS	(BPTREE_KEYS / 2)
+/* inner nodes keep at least MIN_KEYS + 1 children, so 2^64 entries fit */
+#define MAX_DEPTH	24
+
+
+static struct bpnode *node_new(int);
+static void node_free(struct bptree *, struct bpnode *);
+static size_t lower_bound(CompareFunc, const struct bpnode *, const void *);
+static size_t upper_bound(CompareFunc, const struct bpnode *, const void *);
+static int descend(struct bptree *, const void *, struct bpnode **, size_t *);
+static int insert(struct bptree *, void *, void *, int);
+static void split_leaf(struct bpnode *, struct bpnode *, size_t, void *, void *);
+static void *split_inner(struct bpnode *, struct bpnode *, size_t, void *, struct bpnode *);
+static void rebalance(struct bpnode *, size_t);
+static void merge(struct bpnode *, size_t);
+static struct bpnode *leftmost(struct bpnode *);
+
+
+
+int bptree_init(struct bptree *tree, CompareFunc cmp, DestroyFunc key_dst, DestroyFunc val_dst)
+{
+	int ret_val = -1;
+
+	if (tree) {
+		if (cmp) {
+			tree->root = NULL;
+			tree->first = NULL;
+			tree->count = 0;
+			tree->cmp_func = cmp;
+			tree->key_dst_func = key_dst;
+			tree->val_dst_func = val_dst;
+			ret_val = 0;
+		} else {
+			log_err("null compare func\n");
+		}
+	} else {
+		log_err("null tree pointer\n");
+	}
+
+	return ret_val;
+}
+
+static struct bpnode *node_new(int leaf)
+{
+	struct bpnode *node;
+
+	if ((node = aligned_alloc(CACHE_LINE_SIZE, sizeof(*node)))) {
+		node->count = 0;
+		node->leaf = leaf;
+		if (leaf)
+			node->next = NULL;
+	} else {
+		log_err("node_new: aligned_alloc");
+	}
+
+	return node;
+}
+
+static void node_free(struct bptree *tree, struct bpnode *node)
+{
+	if (node->leaf) {
+		for (size_t i = 0; i < node->count; ++i) {
+			if (tree->key_dst_func)
+				tree->key_dst_func(node->keys[i]);
+			if (tree->val_dst_func)
+				tree->val_dst_func(node->values[i]);
+		}
+	} else {
+		for (size_t i = 0; i <= node->count; ++i)
+			node_free(tree, node->children[i]);
+	}
+	free(node);
+}
+
+/* first slot whose key is >= key */
+static size_t lower_bound(CompareFunc cmp_func, const struct bpnode *node, const void *key)
+{
+	size_t lo = 0;
+	size_t hi = node->count;
+	size_t mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (cmp_func(node->keys[mid], key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* first slot whose key is > key, i.e. the child to descend into */
+static size_t upper_bound(CompareFunc cmp_func, const struct bpnode *node, const void *key)
+{
+	size_t lo = 0;
+	size_t hi = node->count;
+	size_t mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (cmp_func(key, node->keys[mid]) < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return lo;
+}
+
+/*
+ * Records the root-to-leaf path for key: path[d] is the node at depth d
+ * and index[d] the child taken from it. Returns the depth of the leaf.
+ */
+static int descend(struct bptree *tree, const void *key, struct bpnode **path, size_t *index)
+{
+	struct bpnode *node = tree->root;
+	int depth = 0;
+
+	while (!node->leaf) {
+		path[depth] = node;
+		index[depth] = upper_bound(tree->cmp_func, node, key);
+		node = node->children[index[depth]];
+		++depth;
+	}
+	path[depth] = node;
+
+	return depth;
+}
+
+int bptree_insert(struct bptree *tree, void *key, void *value)
+{
+	int ret_val = -1;
+
+	if (tree) {
+		ret_val = insert(tree, key, value, 0);
+	} else {
+		log_err("bptree_insert: null tree\n");
+	}
+
+	return ret_val;
+}
+
+int bptree_replace(struct bptree *tree, void *key, void *value)
+{
+	int ret_val = -1;
+
+	if (tree) {
+		ret_val = insert(tree, key, value, 1);
+	} else {
+		log_err("bptree_replace: null tree\n");
+	}
+
+	return ret_val;
+}
+
+static int insert(struct bptree *tree, void *key, void *value, int replace)
+{
+	struct bpnode *path[MAX_DEPTH];
+	size_t index[MAX_DEPTH];
+	struct bpnode *spare[MAX_DEPTH + 1];
+	struct bpnode *leaf;
+	struct bpnode *node;
+	struct bpnode *child;
+	void *old_key;
+	void *sep;
+	int needed = 0;
+	int used = 0;
+	int depth;
+	int d;
+	size_t pos;
+
+	if (!tree->root) {
+		if (!(tree->root = tree->first = node_new(1)))
+			return -1;
+	}
+
+	depth = descend(tree, key, path, index);
+	leaf = path[depth];
+	pos = lower_bound(tree->cmp_func, leaf, key);
+
+	if (pos < leaf->count && !tree->cmp_func(key, leaf->keys[pos])) {
+		if (tree->val_dst_func)
+			tree->val_dst_func(leaf->values[pos]);
+		leaf->values[pos] = value;
+
+		if (replace) {
+			old_key = leaf->keys[pos];
+			leaf->keys[pos] = key;
+			/* a leaf's first key may also be a separator further up */
+			for (d = depth - 1; !pos && d >= 0; --d) {
+				if (index[d] && path[d]->keys[index[d] - 1] == old_key) {
+					path[d]->keys[index[d] - 1] = key;
+					break;
+				}
+			}
+			if (tree->key_dst_func)
+				tree->key_dst_func(old_key);
+		} else {
+			if (tree->key_dst_func)
+				tree->key_dst_func(key);
+		}
+		return 0;
+	}
+
+	if (leaf->count < BPTREE_KEYS) {
+		memmove(&leaf->keys[pos + 1], &leaf->keys[pos], (leaf->count - pos) * sizeof(void *));
+		memmove(&leaf->values[pos + 1], &leaf->values[pos], (leaf->count - pos) * sizeof(void *));
+		leaf->keys[pos] = key;
+		leaf->values[pos] = value;
+		++leaf->count;
+		++tree->count;
+		return 0;
+	}
+
+	/* allocate every node the split cascade needs before changing anything */
+	for (d = depth; d >= 0 && BPTREE_KEYS == path[d]->count; --d)
+		++needed;
+	if (d < 0)
+		++needed;
+	for (int i = 0; i < needed; ++i) {
+		if (!(spare[i] = node_new(!i))) {
+			while (i--)
+				free(spare[i]);
+			return -1;
+		}
+	}
+
+	child = spare[used++];
+	split_leaf(leaf, child, pos, key, value);
+	sep = child->keys[0];
+
+	for (d = depth - 1; d >= 0; --d) {
+		node = path[d];
+		pos = index[d];
+		if (node->count < BPTREE_KEYS) {
+			memmove(&node->keys[pos + 1], &node->keys[pos], (node->count - pos) * sizeof(void *));
+			memmove(&node->children[pos + 2], &node->children[pos + 1],
+					(node->count - pos) * sizeof(void *));
+			node->keys[pos] = sep;
+			node->children[pos + 1] = child;
+			++node->count;
+			break;
+		}
+		sep = split_inner(node, spare[used], pos, sep, child);
+		child = spare[used++];
+	}
+
+	if (d < 0) {
+		node = spare[used];
+		node->count = 1;
+		node->keys[0] = sep;
+		node->children[0] = tree->root;
+		node->children[1] = child;
+		tree->root = node;
+	}
+	++tree->count;
+
+	return 0;
+}
+
+/* spreads a full leaf plus the new entry at pos over leaf and right */
+static void split_leaf(struct bpnode *leaf, struct bpnode *right, size_t pos, void *key, void *value)
+{
+	void *keys[BPTREE_KEYS + 1];
+	void *values[BPTREE_KEYS + 1];
+	size_t half = (BPTREE_KEYS + 1) / 2;
+
+	memcpy(keys, leaf->keys, pos * sizeof(void *));
+	memcpy(values, leaf->values, pos * sizeof(void *));
+	keys[pos] = key;
+	values[pos] = value;
+	memcpy(&keys[pos + 1], &leaf->keys[pos], (BPTREE_KEYS - pos) * sizeof(void *));
+	memcpy(&values[pos + 1], &leaf->values[pos], (BPTREE_KEYS - pos) * sizeof(void *));
+
+	memcpy(leaf->keys, keys, half * sizeof(void *));
+	memcpy(leaf->values, values, half * sizeof(void *));
+	leaf->count = half;
+	memcpy(right->keys, &keys[half], (BPTREE_KEYS + 1 - half) * sizeof(void *));
+	memcpy(right->values, &values[half], (BPTREE_KEYS + 1 - half) * sizeof(void *));
+	right->count = BPTREE_KEYS + 1 - half;
+
+	right->next = leaf->next;
+	leaf->next = right;
+}
+
+/*
+ * Spreads a full inner node plus separator sep (with child to its right)
+ * at pos over node and right. Returns the separator to push up.
+ */
+static void *split_inner(struct bpnode *node, struct bpnode *right, size_t pos,
+		void *sep, struct bpnode *child)
+{
+	void *keys[BPTREE_KEYS + 1];
+	struct bpnode *children[BPTREE_KEYS + 2];
+	size_t half = (BPTREE_KEYS + 1) / 2;
+
+	memcpy(keys, node->keys, pos * sizeof(void *));
+	keys[pos] = sep;
+	memcpy(&keys[pos + 1], &node->keys[pos], (BPTREE_KEYS - pos) * sizeof(void *));
+	memcpy(children, node->children, (pos + 1) * sizeof(void *));
+	children[pos + 1] = child;
+	memcpy(&children[pos + 2], &node->children[pos + 1], (BPTREE_KEYS - pos) * sizeof(void *));
+
+	memcpy(node->keys, keys, half * sizeof(void *));
+	memcpy(node->children, children, (half + 1) * sizeof(void *));
+	node->count = half;
+	memcpy(right->keys, &keys[half + 1], (BPTREE_KEYS - half) * sizeof(void *));
+	memcpy(right->children, &children[half + 1], (BPTREE_KEYS + 1 - half) * sizeof(void *));
+	right->count = BPTREE_KEYS - half;
+
+	return keys[half];
+}
+
+void *bptree_search(struct bptree *tree, const void *key)
+{
+	struct bpnode *node;
+	size_t pos;
+
+	if (!tree) {
+		log_err("bptree_search: tree is null\n");
+		return NULL;
+	}
+	if (!(node = tree->root))
+		return NULL;
+
+	while (!node->leaf)
+		node = node->children[upper_bound(tree->cmp_func, node, key)];
+	pos = lower_bound(tree->cmp_func, node, key);
+
+	if (pos < node->count && !tree->cmp_func(key, node->keys[pos]))
+		return node->values[pos];
+	return NULL;
+}
+
+void bptree_foreach(struct bptree *tree, TraverseFunc trav_func, void *data)
+{
+	if (!tree) {
+		log_err("bptree_foreach: null tree\n");
+		return;
+	}
+
+	for (struct bpnode *leaf = tree->first; leaf; leaf = leaf->next) {
+		for (size_t i = 0; i < leaf->count; ++i) {
+			if (trav_func(leaf->keys[i], leaf->values[i], data))
+				return;
+		}
+	}
+}
+
+int bptree_remove(struct bptree *tree, const void *key)
+{
+	struct bpnode *path[MAX_DEPTH];
+	size_t index[MAX_DEPTH];
+	struct bpnode *leaf;
+	struct bpnode *node;
+	void *old_key;
+	void *old_value;
+	int depth;
+	size_t pos;
+
+	if (!tree) {
+		log_err("bptree_remove: tree is null\n");
+		return -1;
+	}
+	if (!tree->root)
+		return 0;
+
+	depth = descend(tree, key, path, index);
+	leaf = path[depth];
+	pos = lower_bound(tree->cmp_func, leaf, key);
+	if (pos == leaf->count || tree->cmp_func(key, leaf->keys[pos]))
+		return 0;
+
+	old_key = leaf->keys[pos];
+	old_value = leaf->values[pos];
+	--leaf->count;
+	memmove(&leaf->keys[pos], &leaf->keys[pos + 1], (leaf->count - pos) * sizeof(void *));
+	memmove(&leaf->values[pos], &leaf->values[pos + 1], (leaf->count - pos) * sizeof(void *));
+	--tree->count;
+
+	for (int d = depth - 1; d >= 0; --d) {
+		node = path[d];
+		pos = index[d];
+		/* old_key is about to be freed: no separator may keep pointing at it */
+		if (pos && node->keys[pos - 1] == old_key)
+			node->keys[pos - 1] = leftmost(node->children[pos])->keys[0];
+		if (node->children[pos]->count < MIN_KEYS)
+			rebalance(node, pos);
+	}
+
+	node = tree->root;
+	if (!node->count) {
+		if (node->leaf) {
+			tree->root = tree->first = NULL;
+		} else {
+			tree->root = node->children[0];
+		}
+		free(node);
+	}
+
+	if (tree->key_dst_func)
+		tree->key_dst_func(old_key);
+	if (tree->val_dst_func)
+		tree->val_dst_func(old_value);
+
+	return 0;
+}
+
+static struct bpnode *leftmost(struct bpnode *node)
+{
+	while (!node->leaf)
+		node = node->children[0];
+	return node;
+}
+
+/* tops up parent->children[i] from a sibling, or merges it into one */
+static void rebalance(struct bpnode *parent, size_t i)
+{
+	struct bpnode *child = parent->children[i];
+	struct bpnode *left = i ? parent->children[i - 1] : NULL;
+	struct bpnode *right = i < parent->count ? parent->children[i + 1] : NULL;
+	size_t n;
+
+	if (left && left->count > MIN_KEYS) {
+		n = left->count - 1;
+		memmove(&child->keys[1], child->keys, child->count * sizeof(void *));
+		if (child->leaf) {
+			memmove(&child->values[1], child->values, child->count * sizeof(void *));
+			child->keys[0] = left->keys[n];
+			child->values[0] = left->values[n];
+			parent->keys[i - 1] = child->keys[0];
+		} else {
+			memmove(&child->children[1], child->children, (child->count + 1) * sizeof(void *));
+			child->keys[0] = parent->keys[i - 1];
+			child->children[0] = left->children[n + 1];
+			parent->keys[i - 1] = left->keys[n];
+		}
+		--left->count;
+		++child->count;
+	} else if (right && right->count > MIN_KEYS) {
+		n = child->count;
+		if (child->leaf) {
+			child->keys[n] = right->keys[0];
+			child->values[n] = right->values[0];
+			memmove(right->values, &right->values[1], (right->count - 1) * sizeof(void *));
+			memmove(right->keys, &right->keys[1], (right->count - 1) * sizeof(void *));
+			parent->keys[i] = right->keys[0];
+		} else {
+			child->keys[n] = parent->keys[i];
+			child->children[n + 1] = right->children[0];
+			parent->keys[i] = right->keys[0];
+			memmove(right->keys, &right->keys[1], (right->count - 1) * sizeof(void *));
+			memmove(right->children, &right->children[1], right->count * sizeof(void *));
+		}
+		--right->count;
+		++child->count;
+	} else {
+		merge(parent, left ? i - 1 : i);
+	}
+}
+
+/* folds parent->children[i + 1] into parent->children[i] */
+static void merge(struct bpnode *parent, size_t i)
+{
+	struct bpnode *left = parent->children[i];
+	struct bpnode *right = parent->children[i + 1];
+	size_t n = left->count;
+
+	if (left->leaf) {
+		memcpy(&left->keys[n], right->keys, right->count * sizeof(void *));
+		memcpy(&left->values[n], right->values, right->count * sizeof(void *));
+		left->count += right->count;
+		left->next = right->next;
+	} else {
+		left->keys[n] = parent->keys[i];
+		memcpy(&left->keys[n + 1], right->keys, right->count * sizeof(void *));
+		memcpy(&left->children[n + 1], right->children, (right->count + 1) * sizeof(void *));
+		left->count += right->count + 1;
+	}
+	free(right);
+
+	--parent->count;
+	memmove(&parent->keys[i], &parent->keys[i + 1], (parent->count - i) * sizeof(void *));
+	memmove(&parent->children[i + 1], &parent->children[i + 2], (parent->count - i) * sizeof(void *));
+}
+
+void bptree_clear(struct bptree *tree)
+{
+	if (tree) {
+		if (tree->root)
+			node_free(tree, tree->root);
+		tree->root = tree->first = NULL;
+		tree->count = 0;
+	}
+}
+
+void bptree_destroy(struct bptree *tree)
+{
+	if (tree) {
+		bptree_clear(tree);
+	}
+}
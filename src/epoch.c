@@ -0,0 +1,244 @@
+#include "epoch.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "logmsg.h"
+#include "types.h"
+
+
+/* retired entries a thread collects before trying to advance the epoch */
+#define RETIRE_THRESHOLD	64
+
+
+/*
+ * Per-thread state. state is 0 outside a critical section and
+ * (epoch << 1) | 1 inside one. Records are never freed: a thread that
+ * exits gives its record back and the next new thread adopts it along
+ * with any entries still waiting on it.
+ */
+struct epoch_record {
+	unsigned long state __attribute__((aligned(CACHE_LINE_SIZE)));
+	struct epoch_record *next;
+	int in_use;
+	unsigned int nesting;
+	struct epoch_entry *retired_head;
+	struct epoch_entry *retired_tail;
+	unsigned long retired_count;
+};
+
+static struct epoch_record *get_record(void);
+static void record_release(void *);
+static void key_create(void);
+static int try_advance(void);
+static void collect(struct epoch_record *);
+
+
+static unsigned long global_epoch __attribute__((aligned(CACHE_LINE_SIZE))) = 1;
+static struct epoch_record *records;
+static pthread_key_t record_key;
+static pthread_once_t record_once = PTHREAD_ONCE_INIT;
+static __thread struct epoch_record *self;
+
+
+void epoch_enter(void)
+{
+	struct epoch_record *rec;
+	unsigned long epoch;
+
+	if (!(rec = get_record()))
+		return;
+	if (rec->nesting++)
+		return;
+
+	epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+	__atomic_store_n(&rec->state, (epoch << 1) | 1, __ATOMIC_SEQ_CST);
+	/* announce before touching any shared node */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void epoch_exit(void)
+{
+	struct epoch_record *rec;
+
+	if (!(rec = self) || !rec->nesting) {
+		log_err("epoch_exit: not in a critical section\n");
+		return;
+	}
+	if (--rec->nesting)
+		return;
+
+	__atomic_store_n(&rec->state, 0, __ATOMIC_RELEASE);
+}
+
+/* nonzero while the calling thread is inside a critical section */
+int epoch_in_critical(void)
+{
+	return self && self->nesting;
+}
+
+/* func(entry) runs after a grace period, on this thread */
+void epoch_retire(struct epoch_entry *entry, void (*func)(struct epoch_entry *))
+{
+	struct epoch_record *rec;
+
+	if (!entry || !func) {
+		log_err("epoch_retire: null entry or func\n");
+		return;
+	}
+	if (!(rec = get_record())) {
+		/* no way to defer: leak rather than free under a reader */
+		return;
+	}
+
+	entry->next = NULL;
+	entry->func = func;
+	entry->epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+	if (rec->retired_tail)
+		rec->retired_tail->next = entry;
+	else
+		rec->retired_head = entry;
+	rec->retired_tail = entry;
+
+	if (++rec->retired_count >= RETIRE_THRESHOLD) {
+		try_advance();
+		collect(rec);
+	}
+}
+
+/*
+ * Wait until everything this thread retired has been reclaimed. Must not
+ * be called from inside a critical section.
+ */
+void epoch_barrier(void)
+{
+	struct epoch_record *rec;
+
+	if (!(rec = get_record()))
+		return;
+	if (rec->nesting) {
+		log_err("epoch_barrier: called inside a critical section\n");
+		return;
+	}
+
+	while (rec->retired_head) {
+		if (!try_advance())
+			sched_yield();
+		collect(rec);
+	}
+}
+
+/*
+ * Wait out a grace period: returns once every thread that was inside a
+ * critical section at the call has left it. Nothing is retired, so it
+ * needs no memory. Fails with -1 from inside a critical section, where
+ * it would wait for itself.
+ */
+int epoch_synchronize(void)
+{
+	unsigned long target;
+
+	if (epoch_in_critical()) {
+		log_err("epoch_synchronize: called inside a critical section\n");
+		return -1;
+	}
+
+	/* as in collect: two advances past the current epoch */
+	target = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST) + 2;
+	while ((long)(__atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE) - target) < 0) {
+		if (!try_advance())
+			sched_yield();
+	}
+
+	return 0;
+}
+
+static struct epoch_record *get_record(void)
+{
+	struct epoch_record *rec;
+
+	if (self)
+		return self;
+
+	pthread_once(&record_once, key_create);
+
+	for (rec = __atomic_load_n(&records, __ATOMIC_ACQUIRE); rec; rec = rec->next) {
+		if (!__atomic_load_n(&rec->in_use, __ATOMIC_RELAXED)
+				&& !__atomic_exchange_n(&rec->in_use, 1, __ATOMIC_ACQUIRE))
+			break;
+	}
+
+	if (!rec) {
+		if (posix_memalign((void **)&rec, CACHE_LINE_SIZE, sizeof(*rec))) {
+			log_err("epoch: record allocate failed\n");
+			return NULL;
+		}
+		rec->state = 0;
+		rec->in_use = 1;
+		rec->nesting = 0;
+		rec->retired_head = NULL;
+		rec->retired_tail = NULL;
+		rec->retired_count = 0;
+		rec->next = __atomic_load_n(&records, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&records, &rec->next, rec,
+					true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+	}
+
+	pthread_setspecific(record_key, rec);
+	return self = rec;
+}
+
+static void record_release(void *arg)
+{
+	struct epoch_record *rec = arg;
+
+	try_advance();
+	collect(rec);
+	rec->nesting = 0;
+	__atomic_store_n(&rec->state, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&rec->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void key_create(void)
+{
+	if (pthread_key_create(&record_key, record_release))
+		log_err("epoch: pthread_key_create");
+}
+
+/* move the global epoch on if every active thread has caught up with it */
+static int try_advance(void)
+{
+	struct epoch_record *rec;
+	unsigned long epoch;
+	unsigned long state;
+
+	epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+	for (rec = __atomic_load_n(&records, __ATOMIC_ACQUIRE); rec; rec = rec->next) {
+		state = __atomic_load_n(&rec->state, __ATOMIC_SEQ_CST);
+		if ((state & 1) && (state >> 1) != epoch)
+			return 0;
+	}
+
+	return __atomic_compare_exchange_n(&global_epoch, &epoch, epoch + 1,
+			false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+/* entries retired in epoch e are unreachable to everyone once global is e + 2 */
+static void collect(struct epoch_record *rec)
+{
+	struct epoch_entry *entry;
+	unsigned long epoch;
+
+	epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+	while ((entry = rec->retired_head) && entry->epoch + 2 <= epoch) {
+		if (!(rec->retired_head = entry->next))
+			rec->retired_tail = NULL;
+		--rec->retired_count;
+		entry->func(entry);
+	}
+}
@@ -0,0 +1,312 @@
+#include "executor.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lock.h"
+#include "logmsg.h"
+
+
+#define DEQUE_CAPACITY	256
+
+/* task states; TASK_SLEEPER means pending with a thread parked on it */
+enum {
+	TASK_PENDING = 0,
+	TASK_DONE,
+	TASK_SLEEPER
+};
+
+struct worker {
+	struct WSDeque deque;
+	struct executor *exec;
+	pthread_t thread;
+	unsigned int seed;
+	int id;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+
+static void *worker_run(void *);
+static struct task *find_task(struct worker *);
+static struct task *find_any(struct worker *);
+static void idle(struct worker *);
+static void notify(struct executor *, int);
+static void run_task(struct executor *, struct task *);
+static struct worker *current(struct executor *);
+
+
+static __thread struct worker *self;
+
+
+void task_init(struct task *task, TaskFunc *func, void *arg)
+{
+	if (task) {
+		task->func = func;
+		task->arg = arg;
+		task->state = TASK_PENDING;
+	} else {
+		log_err("task_init: null task\n");
+	}
+}
+
+struct executor *executor_new(int threads)
+{
+	struct executor *exec;
+	int i;
+
+	if (threads < 1) {
+		log_err("executor_new: need at least one thread\n");
+		return NULL;
+	}
+	if (!(exec = malloc(sizeof(*exec)))) {
+		log_err("executor_new: malloc");
+		return NULL;
+	}
+	if (posix_memalign((void **)&exec->workers, CACHE_LINE_SIZE,
+				threads * sizeof(*exec->workers))) {
+		log_err("executor_new: malloc workers\n");
+		free(exec);
+		return NULL;
+	}
+
+	exec->count = 0;
+	exec->stop = false;
+	exec->wakeups = 0;
+	exec->work = 0;
+	exec->sleepers = 0;
+	queue_init_blocking(NULL, &exec->inject);
+
+	for (i = 0; i < threads; ++i) {
+		struct worker *worker = &exec->workers[i];
+
+		worker->exec = exec;
+		worker->id = i;
+		worker->seed = 2 * i + 1;
+		if (!wsdeque_init(&worker->deque, DEQUE_CAPACITY))
+			break;
+		exec->count = i + 1;
+	}
+	if (exec->count == threads) {
+		for (i = 0; i < threads; ++i) {
+			if (pthread_create(&exec->workers[i].thread, NULL, worker_run, &exec->workers[i])) {
+				log_err("executor_new: pthread_create");
+				break;
+			}
+		}
+		if (i == threads)
+			return exec;
+
+		__atomic_store_n(&exec->stop, true, __ATOMIC_SEQ_CST);
+		notify(exec, INT_MAX);
+		while (i--)
+			pthread_join(exec->workers[i].thread, NULL);
+	}
+
+	for (i = 0; i < exec->count; ++i)
+		wsdeque_destroy(&exec->workers[i].deque);
+	queue_destroy(&exec->inject);
+	free(exec->workers);
+	free(exec);
+	return NULL;
+}
+
+/*
+ * From inside a task the new task goes to the local deque, otherwise to
+ * the inject queue. If neither has room the task runs right away.
+ */
+int executor_spawn(struct executor *exec, struct task *task)
+{
+	struct worker *worker;
+
+	if (!exec || !task) {
+		log_err("executor_spawn: null executor or task\n");
+		return -1;
+	}
+
+	if ((worker = current(exec))) {
+		if (!wsdeque_push(&worker->deque, task)) {
+			notify(exec, 1);
+			return 0;
+		}
+	} else if (!enqueue(&exec->inject, task)) {
+		notify(exec, 1);
+		return 0;
+	}
+
+	run_task(exec, task);
+	return 0;
+}
+
+/*
+ * Wait for task to finish. A worker keeps running other tasks in the
+ * meantime; any other thread sleeps on the task.
+ */
+void executor_join(struct executor *exec, struct task *task)
+{
+	struct worker *worker;
+	struct task *other;
+	unsigned int state;
+	unsigned int wakeups;
+
+	if (!exec || !task) {
+		log_err("executor_join: null executor or task\n");
+		return;
+	}
+
+	if ((worker = current(exec))) {
+		while (TASK_DONE != __atomic_load_n(&task->state, __ATOMIC_ACQUIRE)) {
+			if ((other = find_task(worker)))
+				run_task(exec, other);
+			else
+				sched_yield();
+		}
+		return;
+	}
+
+	state = TASK_PENDING;
+	__atomic_compare_exchange_n(&task->state, &state, TASK_SLEEPER,
+			false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE);
+	for (;;) {
+		/* read wakeups first: a finish after the check changes it */
+		wakeups = __atomic_load_n(&exec->wakeups, __ATOMIC_SEQ_CST);
+		if (TASK_DONE == __atomic_load_n(&task->state, __ATOMIC_SEQ_CST))
+			break;
+		futex_wait(&exec->wakeups, wakeups, NULL);
+	}
+}
+
+/* spawn task and wait for it, together with everything it spawns */
+int executor_run(struct executor *exec, struct task *task)
+{
+	if (executor_spawn(exec, task))
+		return -1;
+	executor_join(exec, task);
+	return 0;
+}
+
+void executor_destroy(struct executor *exec)
+{
+	if (!exec)
+		return;
+
+	__atomic_store_n(&exec->stop, true, __ATOMIC_SEQ_CST);
+	notify(exec, INT_MAX);
+	for (int i = 0; i < exec->count; ++i) {
+		pthread_join(exec->workers[i].thread, NULL);
+		wsdeque_destroy(&exec->workers[i].deque);
+	}
+	queue_destroy(&exec->inject);
+	free(exec->workers);
+	free(exec);
+}
+
+static void *worker_run(void *arg)
+{
+	struct worker *worker = arg;
+	struct executor *exec = worker->exec;
+	struct task *task;
+
+	self = worker;
+	while (!__atomic_load_n(&exec->stop, __ATOMIC_ACQUIRE)) {
+		if ((task = find_task(worker)))
+			run_task(exec, task);
+		else
+			idle(worker);
+	}
+
+	return NULL;
+}
+
+/*
+ * Sleeps until a spawn or shutdown bumps work. The snapshot of work is
+ * taken and the worker counted as a sleeper before the last look for
+ * tasks, so a spawn either shows up in that look or changes work and
+ * sees the sleeper (see notify).
+ */
+static void idle(struct worker *worker)
+{
+	struct executor *exec = worker->exec;
+	struct task *task;
+	unsigned int work;
+
+	work = __atomic_load_n(&exec->work, __ATOMIC_SEQ_CST);
+	__atomic_fetch_add(&exec->sleepers, 1, __ATOMIC_SEQ_CST);
+	if ((task = find_any(worker))) {
+		__atomic_fetch_sub(&exec->sleepers, 1, __ATOMIC_SEQ_CST);
+		run_task(exec, task);
+		return;
+	}
+	if (!__atomic_load_n(&exec->stop, __ATOMIC_SEQ_CST))
+		futex_wait(&exec->work, work, NULL);
+	__atomic_fetch_sub(&exec->sleepers, 1, __ATOMIC_SEQ_CST);
+}
+
+/* a spawn or shutdown: wake up to count sleeping workers, if there are any */
+static void notify(struct executor *exec, int count)
+{
+	/* orders the new task (or stop) before the sleepers check */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&exec->sleepers, __ATOMIC_SEQ_CST))
+		return;
+	__atomic_fetch_add(&exec->work, 1, __ATOMIC_SEQ_CST);
+	futex_wake(&exec->work, count);
+}
+
+/* own deque first, then one random victim, then the inject queue */
+static struct task *find_task(struct worker *worker)
+{
+	struct executor *exec = worker->exec;
+	struct task *task;
+	int victim;
+
+	if ((task = wsdeque_pop(&worker->deque)))
+		return task;
+
+	if (exec->count > 1) {
+		worker->seed ^= worker->seed << 13;
+		worker->seed ^= worker->seed >> 17;
+		worker->seed ^= worker->seed << 5;
+		victim = worker->seed % (exec->count - 1);
+		if (victim >= worker->id)
+			++victim;
+		if ((task = wsdeque_steal(&exec->workers[victim].deque)))
+			return task;
+	}
+
+	return dequeue(&exec->inject);
+}
+
+/* like find_task, but tries every other worker before giving up */
+static struct task *find_any(struct worker *worker)
+{
+	struct executor *exec = worker->exec;
+	struct task *task;
+
+	if ((task = wsdeque_pop(&worker->deque)))
+		return task;
+	for (int i = 1; i < exec->count; ++i) {
+		if ((task = wsdeque_steal(&exec->workers[(worker->id + i) % exec->count].deque)))
+			return task;
+	}
+
+	return dequeue(&exec->inject);
+}
+
+/* task is not touched after the exchange; its joiner may return at once */
+static void run_task(struct executor *exec, struct task *task)
+{
+	task->func(task->arg);
+	if (TASK_SLEEPER == __atomic_exchange_n(&task->state, TASK_DONE, __ATOMIC_SEQ_CST)) {
+		__atomic_fetch_add(&exec->wakeups, 1, __ATOMIC_SEQ_CST);
+		futex_wake(&exec->wakeups, INT_MAX);
+	}
+}
+
+static struct worker *current(struct executor *exec)
+{
+	return (self && self->exec == exec) ? self : NULL;
+}
@@ -0,0 +1,299 @@
+#include "hashmap.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "logmsg.h"
+
+
+#define MIN_CAPACITY	16
+/* grow past 7/8 full; Robin Hood keeps probes short up to there */
+#define MAX_LOAD_NUM	7
+#define MAX_LOAD_DEN	8
+
+#define FNV_OFFSET	UINT64_C(0xcbf29ce484222325)
+#define FNV_PRIME	UINT64_C(0x100000001b3)
+#define FIB_MULT	UINT64_C(0x9e3779b97f4a7c15)
+
+#define distance(m, h, i)	(((i) - ((h) & ((m)->capacity - 1))) & ((m)->capacity - 1))
+
+
+static size_t hash_of(struct hashmap *, const void *);
+static struct hmslot *find(struct hashmap *, const void *);
+static int insert(struct hashmap *, void *, void *, int);
+static void place(struct hashmap *, size_t, void *, void *);
+static int resize(struct hashmap *, size_t);
+
+
+
+int hashmap_init(struct hashmap *map, HashFunc hash, CompareFunc cmp, DestroyFunc key_dst,
+		DestroyFunc val_dst)
+{
+	int ret_val = -1;
+
+	if (map) {
+		if (hash && cmp) {
+			map->slots = NULL;
+			map->capacity = 0;
+			map->count = 0;
+			map->hash_func = hash;
+			map->cmp_func = cmp;
+			map->key_dst_func = key_dst;
+			map->val_dst_func = val_dst;
+			ret_val = 0;
+		} else {
+			log_err("null hash or compare func\n");
+		}
+	} else {
+		log_err("null map pointer\n");
+	}
+
+	return ret_val;
+}
+
+/* FNV-1a over a NUL-terminated string */
+size_t hash_string(const void *key)
+{
+	const unsigned char *c;
+	uint64_t hash = FNV_OFFSET;
+
+	for (c = key; *c; ++c) {
+		hash ^= *c;
+		hash *= FNV_PRIME;
+	}
+
+	return hash;
+}
+
+/* buckets come from the low bits, so fold the well-mixed high ones in */
+static size_t hash_of(struct hashmap *map, const void *key)
+{
+	uint64_t hash = (uint64_t)map->hash_func(key) * FIB_MULT;
+
+	hash ^= hash >> 32;
+	return hash ? hash : 1;
+}
+
+/*
+ * Robin Hood ordering means the probe can stop at the first slot whose
+ * entry sits closer to its home bucket than key would.
+ */
+static struct hmslot *find(struct hashmap *map, const void *key)
+{
+	struct hmslot *slot;
+	size_t hash;
+	size_t mask;
+	size_t i;
+
+	if (!map->count)
+		return NULL;
+
+	hash = hash_of(map, key);
+	mask = map->capacity - 1;
+	for (size_t dist = 0; ; ++dist) {
+		i = (hash + dist) & mask;
+		slot = &map->slots[i];
+		if (!slot->hash || distance(map, slot->hash, i) < dist)
+			return NULL;
+		if (slot->hash == hash && !map->cmp_func(key, slot->key))
+			return slot;
+	}
+}
+
+int hashmap_insert(struct hashmap *map, void *key, void *value)
+{
+	int ret_val = -1;
+
+	if (map) {
+		ret_val = insert(map, key, value, 0);
+	} else {
+		log_err("hashmap_insert: null map\n");
+	}
+
+	return ret_val;
+}
+
+int hashmap_replace(struct hashmap *map, void *key, void *value)
+{
+	int ret_val = -1;
+
+	if (map) {
+		ret_val = insert(map, key, value, 1);
+	} else {
+		log_err("hashmap_replace: null map\n");
+	}
+
+	return ret_val;
+}
+
+/* existing keys behave as in rbtree: replace swaps the key too */
+static int insert(struct hashmap *map, void *key, void *value, int replace)
+{
+	struct hmslot *slot;
+
+	if ((slot = find(map, key))) {
+		if (map->val_dst_func)
+			map->val_dst_func(slot->value);
+		slot->value = value;
+		if (replace) {
+			if (map->key_dst_func)
+				map->key_dst_func(slot->key);
+			slot->key = key;
+		} else if (map->key_dst_func) {
+			map->key_dst_func(key);
+		}
+		return 0;
+	}
+
+	if ((map->count + 1) * MAX_LOAD_DEN > map->capacity * MAX_LOAD_NUM
+			&& resize(map, map->capacity ? 2 * map->capacity : MIN_CAPACITY))
+		return -1;
+	place(map, hash_of(map, key), key, value);
+	++map->count;
+
+	return 0;
+}
+
+/* key must be absent and a free slot must exist */
+static void place(struct hashmap *map, size_t hash, void *key, void *value)
+{
+	struct hmslot carry = {hash, key, value};
+	struct hmslot tmp;
+	struct hmslot *slot;
+	size_t mask = map->capacity - 1;
+	size_t i = hash & mask;
+
+	for (size_t dist = 0; ; ++dist, i = (i + 1) & mask) {
+		slot = &map->slots[i];
+		if (!slot->hash) {
+			*slot = carry;
+			return;
+		}
+		/* take from the rich: the closer-to-home entry moves on */
+		if (distance(map, slot->hash, i) < dist) {
+			tmp = *slot;
+			*slot = carry;
+			carry = tmp;
+			dist = distance(map, carry.hash, i);
+		}
+	}
+}
+
+static int resize(struct hashmap *map, size_t capacity)
+{
+	struct hmslot *old = map->slots;
+	size_t old_capacity = map->capacity;
+
+	if (!(map->slots = calloc(capacity, sizeof(*map->slots)))) {
+		log_err("resize: calloc");
+		map->slots = old;
+		return -1;
+	}
+	map->capacity = capacity;
+
+	for (size_t i = 0; i < old_capacity; ++i) {
+		if (old[i].hash)
+			place(map, old[i].hash, old[i].key, old[i].value);
+	}
+	free(old);
+
+	return 0;
+}
+
+void *hashmap_search(struct hashmap *map, const void *key)
+{
+	struct hmslot *slot;
+	void *value = NULL;
+
+	if (map) {
+		if ((slot = find(map, key)))
+			value = slot->value;
+	} else {
+		log_err("hashmap_search: map is null\n");
+	}
+
+	return value;
+}
+
+int hashmap_remove(struct hashmap *map, const void *key)
+{
+	struct hmslot *slot;
+	struct hmslot *next;
+	size_t mask;
+	size_t i;
+
+	if (!map) {
+		log_err("hashmap_remove: map is null\n");
+		return -1;
+	}
+	if (!(slot = find(map, key)))
+		return 0;
+
+	if (map->key_dst_func)
+		map->key_dst_func(slot->key);
+	if (map->val_dst_func)
+		map->val_dst_func(slot->value);
+	--map->count;
+
+	/* backward shift: pull the rest of the run one slot closer to home */
+	mask = map->capacity - 1;
+	i = slot - map->slots;
+	for (;;) {
+		next = &map->slots[(i + 1) & mask];
+		if (!next->hash || !distance(map, next->hash, (i + 1) & mask))
+			break;
+		map->slots[i] = *next;
+		i = (i + 1) & mask;
+	}
+	map->slots[i].hash = 0;
+
+	return 0;
+}
+
+void hashmap_foreach(struct hashmap *map, TraverseFunc trav_func, void *data)
+{
+	if (!map) {
+		log_err("hashmap_foreach: null map\n");
+		return;
+	}
+
+	for (size_t i = 0; i < map->capacity; ++i) {
+		if (map->slots[i].hash && trav_func(map->slots[i].key, map->slots[i].value, data))
+			break;
+	}
+}
+
+/* keeps the slot array for reuse */
+void hashmap_clear(struct hashmap *map)
+{
+	struct hmslot *slot;
+
+	if (!map) {
+		log_err("hashmap_clear: null map\n");
+		return;
+	}
+
+	for (size_t i = 0; i < map->capacity; ++i) {
+		slot = &map->slots[i];
+		if (slot->hash) {
+			if (map->key_dst_func)
+				map->key_dst_func(slot->key);
+			if (map->val_dst_func)
+				map->val_dst_func(slot->value);
+			slot->hash = 0;
+		}
+	}
+	map->count = 0;
+}
+
+void hashmap_destroy(struct hashmap *map)
+{
+	if (map) {
+		hashmap_clear(map);
+		free(map->slots);
+		map->slots = NULL;
+		map->capacity = 0;
+	}
+}
@@ -0,0 +1,106 @@
+#include "intrusive.h"
+
+#include <stdio.h>
+
+#include "logmsg.h"
+
+
+
+void istack_init(struct IStack *stack)
+{
+	if (stack)
+		stack->head = NULL;
+	else
+		log_err("istack_init: null stack\n");
+}
+
+void istack_push(struct IStack *stack, struct ilink *link)
+{
+	if (stack && link) {
+		link->next = stack->head;
+		stack->head = link;
+	} else {
+		log_err("istack_push: null stack or link\n");
+	}
+}
+
+bool istack_is_empty(struct IStack *stack)
+{
+	bool is_empty = true;
+
+	if (stack)
+		is_empty = !stack->head;
+	else
+		log_err("istack_is_empty: null stack\n");
+
+	return is_empty;
+}
+
+struct ilink *istack_pop(struct IStack *stack)
+{
+	struct ilink *link = NULL;
+
+	if (stack) {
+		if ((link = stack->head)) {
+			stack->head = link->next;
+			link->next = NULL;
+		}
+	} else {
+		log_err("istack_pop: null stack\n");
+	}
+
+	return link;
+}
+
+void iqueue_init(struct IQueue *queue)
+{
+	if (queue) {
+		queue->head = NULL;
+		queue->tail = NULL;
+	} else {
+		log_err("iqueue_init: null queue\n");
+	}
+}
+
+void ienqueue(struct IQueue *queue, struct ilink *link)
+{
+	if (queue && link) {
+		link->next = NULL;
+		if (queue->tail)
+			queue->tail->next = link;
+		else
+			queue->head = link;
+		queue->tail = link;
+	} else {
+		log_err("ienqueue: null queue or link\n");
+	}
+}
+
+bool is_iqueue_empty(struct IQueue *queue)
+{
+	bool is_empty = true;
+
+	if (queue)
+		is_empty = !queue->head;
+	else
+		log_err("is_iqueue_empty: null queue\n");
+
+	return is_empty;
+}
+
+struct ilink *idequeue(struct IQueue *queue)
+{
+	struct ilink *link = NULL;
+
+	if (queue) {
+		if ((link = queue->head)) {
+			if (!(queue->head = link->next))
+				queue->tail = NULL;
+			link->next = NULL;
+		}
+	} else {
+		log_err("idequeue: null queue\n");
+	}
+
+	return link;
+}
@@ -0,0 +1,324 @@
+#include "lfstack.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+
+#define log_err(M)	{perror("error: lfstack: " M); goto error;}
+#define log_msg(M)	{fprintf(stderr, "error: lfstack: " M "\n"); goto error;}
+
+/* marks a slot whose offer is being read by the pop that took it */
+#define ELIM_TAKEN	((struct node *)1)
+/* how long a push waits in a slot; a test may hold it open longer */
+#ifndef ELIM_SPINS
+#define ELIM_SPINS	128
+#endif
+#define BACKOFF_MAX	1024
+
+
+static int list_try_push(union lfstack_head *, struct node *);
+static int list_try_pop(union lfstack_head *, struct node **);
+static void list_push(union lfstack_head *, struct node *);
+static struct node *list_pop(union lfstack_head *);
+static struct node *node_get(struct LFStack *);
+static int elim_push(struct LFStack *, struct node *);
+static int elim_pop(struct LFStack *, void **);
+static struct lfstack_slot *elim_slot(struct LFStack *);
+static void backoff(unsigned int *);
+static struct lfstack_stats *stats_of(struct LFStack *);
+static void stat_inc(unsigned long *);
+static void cpu_relax(void);
+
+
+struct LFStack *lfstack_new(DestroyFunc destroy_func)
+{
+	struct LFStack *stack = NULL;
+
+	if (posix_memalign((void **)&stack, CACHE_LINE_SIZE, sizeof(*stack)))
+		log_msg("lfstack_new: allocate failed!");
+
+	stack->head.ptr = NULL;
+	stack->head.tag = 0;
+	stack->free_nodes.ptr = NULL;
+	stack->free_nodes.tag = 0;
+	for (int i = 0; i < LFSTACK_ELIM_SLOTS; ++i)
+		stack->elim[i].offer = NULL;
+	stack->elim_range = 1;
+	for (int i = 0; i < LFSTACK_STAT_STRIPES; ++i) {
+		stack->stats[i].stats.cas_failures = 0;
+		stack->stats[i].stats.elim_attempts = 0;
+		stack->stats[i].stats.elim_hits = 0;
+	}
+	stack->destroy_func = destroy_func;
+	return stack;
+error:
+	return NULL;
+}
+
+/* adds count nodes to the pool that every push takes its node from */
+int lfstack_reserve(struct LFStack *stack, size_t count)
+{
+	struct node *node;
+
+	if (!stack)
+		log_msg("lfstack_reserve: null stack");
+
+	while (count--) {
+		if (!(node = malloc(sizeof(*node))))
+			log_err("lfstack_reserve: node allocate failed!");
+		list_push(&stack->free_nodes, node);
+	}
+
+	return 0;
+error:
+	return -1;
+}
+
+int lfstack_push(struct LFStack *stack, void *data)
+{
+	struct node *node;
+	unsigned int spins = 1;
+
+	if (!stack)
+		log_msg("lfstack_push: null stack");
+	if (!(node = node_get(stack))) {
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	node->data = data;
+	while (!list_try_push(&stack->head, node)) {
+		stat_inc(&stats_of(stack)->cas_failures);
+		if (elim_push(stack, node)) {
+			/* a pop took the data straight from the slot */
+			list_push(&stack->free_nodes, node);
+			break;
+		}
+		backoff(&spins);
+	}
+	return 0;
+error:
+	return -1;
+}
+
+int lfstack_is_empty(struct LFStack *stack)
+{
+	if (!stack)
+		log_msg("lfstack_is_empty: null stack!");
+
+	return !__atomic_load_n(&stack->head.ptr, __ATOMIC_ACQUIRE);
+error:
+	return 1;
+}
+
+void *lfstack_pop(struct LFStack *stack)
+{
+	struct node *node;
+	void *data;
+	unsigned int spins = 1;
+
+	if (!stack)
+		log_msg("lfstack_pop: null stack!");
+	while (!list_try_pop(&stack->head, &node)) {
+		stat_inc(&stats_of(stack)->cas_failures);
+		if (elim_pop(stack, &data))
+			return data;
+		backoff(&spins);
+	}
+	if (!node)
+		return NULL;
+
+	data = node->data;
+	list_push(&stack->free_nodes, node);
+	return data;
+error:
+	return NULL;
+}
+
+void lfstack_get_stats(struct LFStack *stack, struct lfstack_stats *stats)
+{
+	if (!stack || !stats)
+		return;
+
+	stats->cas_failures = 0;
+	stats->elim_attempts = 0;
+	stats->elim_hits = 0;
+	for (int i = 0; i < LFSTACK_STAT_STRIPES; ++i) {
+		stats->cas_failures += __atomic_load_n(&stack->stats[i].stats.cas_failures, __ATOMIC_RELAXED);
+		stats->elim_attempts += __atomic_load_n(&stack->stats[i].stats.elim_attempts, __ATOMIC_RELAXED);
+		stats->elim_hits += __atomic_load_n(&stack->stats[i].stats.elim_hits, __ATOMIC_RELAXED);
+	}
+}
+
+/* not thread safe: no other thread may use the stack any more */
+void lfstack_destroy(struct LFStack *stack)
+{
+	struct node *node;
+
+	if (!stack)
+		return;
+
+	while ((node = list_pop(&stack->head))) {
+		if (stack->destroy_func)
+			stack->destroy_func(node->data);
+		free(node);
+	}
+	while ((node = list_pop(&stack->free_nodes)))
+		free(node);
+	free(stack);
+}
+
+/* NULL once the reserve is used up */
+static struct node *node_get(struct LFStack *stack)
+{
+	return list_pop(&stack->free_nodes);
+}
+
+static int list_try_push(union lfstack_head *head, struct node *node)
+{
+	union lfstack_head old;
+	union lfstack_head new;
+
+	old.tag = __atomic_load_n(&head->tag, __ATOMIC_ACQUIRE);
+	old.ptr = __atomic_load_n(&head->ptr, __ATOMIC_ACQUIRE);
+	__atomic_store_n(&node->next, old.ptr, __ATOMIC_RELAXED);
+	new.ptr = node;
+	new.tag = old.tag + 1;
+
+	return __sync_bool_compare_and_swap(&head->raw, old.raw, new.raw);
+}
+
+/* returns 0 if the CAS lost a race, otherwise 1 with *node NULL if empty */
+static int list_try_pop(union lfstack_head *head, struct node **node)
+{
+	union lfstack_head old;
+	union lfstack_head new;
+
+	old.tag = __atomic_load_n(&head->tag, __ATOMIC_ACQUIRE);
+	old.ptr = __atomic_load_n(&head->ptr, __ATOMIC_ACQUIRE);
+	if (!(*node = old.ptr))
+		return 1;
+	/* old.ptr may already be popped and reused; the tag catches it */
+	new.ptr = __atomic_load_n(&old.ptr->next, __ATOMIC_RELAXED);
+	new.tag = old.tag + 1;
+
+	return __sync_bool_compare_and_swap(&head->raw, old.raw, new.raw);
+}
+
+static void list_push(union lfstack_head *head, struct node *node)
+{
+	while (!list_try_push(head, node))
+		;
+}
+
+static struct node *list_pop(union lfstack_head *head)
+{
+	struct node *node;
+
+	while (!list_try_pop(head, &node))
+		;
+	return node;
+}
+
+/* returns 1 if a pop consumed node->data through the exchanger */
+static int elim_push(struct LFStack *stack, struct node *node)
+{
+	struct lfstack_slot *slot = elim_slot(stack);
+	unsigned int range;
+
+	stat_inc(&stats_of(stack)->elim_attempts);
+	if (!__sync_bool_compare_and_swap(&slot->offer, NULL, node)) {
+		/* slot busy: spread out over more slots */
+		range = __atomic_load_n(&stack->elim_range, __ATOMIC_RELAXED);
+		if (range < LFSTACK_ELIM_SLOTS)
+			__atomic_store_n(&stack->elim_range, range + 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	for (int i = 0; i < ELIM_SPINS; ++i) {
+		if (__atomic_load_n(&slot->offer, __ATOMIC_ACQUIRE) != node)
+			break;
+		cpu_relax();
+	}
+
+	if (__sync_bool_compare_and_swap(&slot->offer, node, NULL)) {
+		/* nobody came: concentrate on fewer slots */
+		range = __atomic_load_n(&stack->elim_range, __ATOMIC_RELAXED);
+		if (range > 1)
+			__atomic_store_n(&stack->elim_range, range - 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	/* the pop still reads node->data until it clears the slot */
+	while (__atomic_load_n(&slot->offer, __ATOMIC_ACQUIRE) == ELIM_TAKEN)
+		cpu_relax();
+	stat_inc(&stats_of(stack)->elim_hits);
+	return 1;
+}
+
+static int elim_pop(struct LFStack *stack, void **data)
+{
+	struct lfstack_slot *slot = elim_slot(stack);
+	struct node *node;
+
+	stat_inc(&stats_of(stack)->elim_attempts);
+	node = __atomic_load_n(&slot->offer, __ATOMIC_ACQUIRE);
+	if (!node || node == ELIM_TAKEN)
+		return 0;
+	if (!__sync_bool_compare_and_swap(&slot->offer, node, ELIM_TAKEN))
+		return 0;
+
+	*data = node->data;
+	__atomic_store_n(&slot->offer, NULL, __ATOMIC_RELEASE);
+	stat_inc(&stats_of(stack)->elim_hits);
+	return 1;
+}
+
+static struct lfstack_slot *elim_slot(struct LFStack *stack)
+{
+	static __thread unsigned int seed;
+	unsigned int range;
+
+	if (!seed)
+		seed = (unsigned int)(uintptr_t)&seed | 1;
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+
+	range = __atomic_load_n(&stack->elim_range, __ATOMIC_RELAXED);
+	return &stack->elim[seed % range];
+}
+
+static void backoff(unsigned int *spins)
+{
+	for (unsigned int i = 0; i < *spins; ++i)
+		cpu_relax();
+	if (*spins < BACKOFF_MAX)
+		*spins <<= 1;
+}
+
+/* the calling thread's stripe; threads take stripes round robin */
+static struct lfstack_stats *stats_of(struct LFStack *stack)
+{
+	static unsigned int next_stripe;
+	static __thread unsigned int stripe;
+
+	if (!stripe)
+		stripe = 1 + __atomic_fetch_add(&next_stripe, 1, __ATOMIC_RELAXED) % LFSTACK_STAT_STRIPES;
+	return &stack->stats[stripe - 1].stats;
+}
+
+/* atomic only because threads past LFSTACK_STAT_STRIPES share a stripe */
+static void stat_inc(unsigned long *counter)
+{
+	__atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+static void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
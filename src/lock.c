@@ -0,0 +1,89 @@
+#include "lock.h"
+
+#include <errno.h>
+#include <linux/futex.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "logmsg.h"
+
+
+static void lock_slowpath(unsigned int *, unsigned int);
+
+
+void lock(unsigned int *addr)
+{
+	unsigned int prev = 0;
+
+	if (!__atomic_compare_exchange_n(addr, &prev, 1, false,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		lock_slowpath(addr, prev);
+}
+
+/* takes the lock only if it is free; 0 when taken, -1 when held elsewhere */
+int trylock(unsigned int *addr)
+{
+	unsigned int prev = 0;
+
+	return __atomic_compare_exchange_n(addr, &prev, 1, false,
+			__ATOMIC_ACQUIRE, __ATOMIC_RELAXED) ? 0 : -1;
+}
+
+void unlock(unsigned int *addr)
+{
+	unsigned int prev;
+
+	prev = __atomic_fetch_sub(addr, 1, __ATOMIC_RELEASE);
+	if (prev == 1)
+		return;
+	if (!prev) {
+		log_err("unlock: lock is not held\n");
+		__atomic_store_n(addr, 0, __ATOMIC_RELEASE);
+		return;
+	}
+
+	/* somebody is (or was) waiting */
+	__atomic_store_n(addr, 0, __ATOMIC_RELEASE);
+	futex_wake(addr, 1);
+}
+
+static void lock_slowpath(unsigned int *addr, unsigned int prev)
+{
+	if (prev != 2)
+		prev = __atomic_exchange_n(addr, 2, __ATOMIC_ACQUIRE);
+	while (prev) {
+		futex_wait(addr, 2, NULL);
+		prev = __atomic_exchange_n(addr, 2, __ATOMIC_ACQUIRE);
+	}
+}
+
+/*
+ * Sleep while *addr == val, at most for the relative timeout (NULL waits
+ * forever). Returns 0 when woken, otherwise -1 with errno EAGAIN (value
+ * already changed), EINTR or ETIMEDOUT.
+ */
+int futex_wait(unsigned int *addr, unsigned int val, const struct timespec *timeout)
+{
+	if (-1 == syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, timeout, NULL, 0)) {
+		if (errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT)
+			log_err("futex_wait");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* wake up to count waiters on addr; returns how many were woken */
+int futex_wake(unsigned int *addr, int count)
+{
+	long woken;
+
+	if (-1 == (woken = syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0))) {
+		log_err("futex_wake");
+		return -1;
+	}
+
+	return (int)woken;
+}
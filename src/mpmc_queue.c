@@ -0,0 +1,172 @@
+#include "mpmc_queue.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "logmsg.h"
+
+
+#define SPINS_BEFORE_YIELD	64
+
+
+static void wait_step(unsigned int *);
+
+
+/*
+ * capacity is rounded up to a power of two, at least 2; above the largest
+ * power of two whose cells fit in a size_t it fails with EINVAL
+ */
+bool mpmc_queue_init(DestroyFunc destroy_func, size_t capacity, struct MPMCQueue *queue)
+{
+	bool is_valid = false;
+	size_t size = 2;
+
+	if (capacity > (SIZE_MAX / 2 + 1) / sizeof(*queue->cells)) {
+		errno = EINVAL;
+		log_err("mpmc_queue_init: capacity too large");
+	} else if (queue && capacity) {
+		while (size < capacity)
+			size <<= 1;
+
+		if ((queue->cells = malloc(size * sizeof(*queue->cells)))) {
+			for (size_t i = 0; i < size; ++i)
+				queue->cells[i].seq = i;
+			queue->enqueue_pos = 0;
+			queue->dequeue_pos = 0;
+			queue->mask = size - 1;
+			queue->destroy_func = destroy_func;
+			is_valid = true;
+		} else {
+			log_err("mpmc_queue_init: malloc cells");
+		}
+	} else {
+		log_err("mpmc_queue_init: null queue or zero capacity\n");
+	}
+
+	return is_valid;
+}
+
+/* returns -1 if the queue is full */
+int mpmc_try_enqueue(struct MPMCQueue *queue, void *data)
+{
+	struct mpmc_cell *cell;
+	size_t pos;
+	size_t seq;
+	intptr_t diff;
+
+	pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+	do {
+		cell = &queue->cells[pos & queue->mask];
+		seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		diff = (intptr_t)seq - (intptr_t)pos;
+		if (diff < 0)
+			return -1;
+		if (diff > 0) {
+			/* another producer claimed pos; catch up */
+			pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+			continue;
+		}
+		if (__atomic_compare_exchange_n(&queue->enqueue_pos, &pos, pos + 1,
+					true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			break;
+	} while (1);
+
+	cell->data = data;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* spins, then yields, until there is room */
+int mpmc_enqueue(struct MPMCQueue *queue, void *data)
+{
+	unsigned int spins = 0;
+
+	if (!queue) {
+		log_err("mpmc_enqueue: null queue\n");
+		return -1;
+	}
+
+	while (mpmc_try_enqueue(queue, data))
+		wait_step(&spins);
+
+	return 0;
+}
+
+/* returns -1 if the queue is empty */
+int mpmc_try_dequeue(struct MPMCQueue *queue, void **data)
+{
+	struct mpmc_cell *cell;
+	size_t pos;
+	size_t seq;
+	intptr_t diff;
+
+	pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+	do {
+		cell = &queue->cells[pos & queue->mask];
+		seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		diff = (intptr_t)seq - (intptr_t)(pos + 1);
+		if (diff < 0)
+			return -1;
+		if (diff > 0) {
+			pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+			continue;
+		}
+		if (__atomic_compare_exchange_n(&queue->dequeue_pos, &pos, pos + 1,
+					true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			break;
+	} while (1);
+
+	*data = cell->data;
+	/* hand the cell to the producer one lap ahead */
+	__atomic_store_n(&cell->seq, pos + queue->mask + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* spins, then yields, until an element arrives */
+int mpmc_dequeue(struct MPMCQueue *queue, void **data)
+{
+	unsigned int spins = 0;
+
+	if (!queue || !data) {
+		log_err("mpmc_dequeue: null queue or data\n");
+		return -1;
+	}
+
+	while (mpmc_try_dequeue(queue, data))
+		wait_step(&spins);
+
+	return 0;
+}
+
+void mpmc_queue_destroy(struct MPMCQueue *queue)
+{
+	void *data;
+
+	if (queue) {
+		if (queue->destroy_func) {
+			while (!mpmc_try_dequeue(queue, &data))
+				queue->destroy_func(data);
+		}
+		free(queue->cells);
+		queue->cells = NULL;
+	} else {
+		log_err("can't destroy null mpmc queue\n");
+	}
+}
+
+static void wait_step(unsigned int *spins)
+{
+	if (*spins < SPINS_BEFORE_YIELD) {
+		++*spins;
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+	} else {
+		sched_yield();
+	}
+}
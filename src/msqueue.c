@@ -0,0 +1,178 @@
+#include "msqueue.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "epoch.h"
+#include "logmsg.h"
+
+
+/* struct node first so queue links stay plain struct node pointers */
+struct ms_node {
+	struct node node;
+	struct epoch_entry entry;
+};
+
+
+static struct node *node_new(void *);
+static void node_free(struct epoch_entry *);
+
+
+static struct node *node_new(void *data)
+{
+	struct ms_node *ms_node;
+
+	if (!(ms_node = malloc(sizeof(*ms_node)))) {
+		log_err("msqueue: malloc node");
+		return NULL;
+	}
+	ms_node->node.next = NULL;
+	ms_node->node.data = data;
+
+	return &ms_node->node;
+}
+
+static void node_free(struct epoch_entry *entry)
+{
+	free((char *)entry - offsetof(struct ms_node, entry));
+}
+
+bool msqueue_init(DestroyFunc destroy_func, struct MSQueue *queue)
+{
+	bool is_valid = false;
+	struct node *dummy;
+
+	if (queue) {
+		if ((dummy = node_new(NULL))) {
+			queue->head = dummy;
+			queue->tail = dummy;
+			queue->destroy_func = destroy_func;
+			is_valid = true;
+		}
+	} else {
+		log_err("msqueue_init: null queue\n");
+	}
+
+	return is_valid;
+}
+
+int ms_enqueue(struct MSQueue *queue, void *data)
+{
+	struct node *node;
+	struct node *tail;
+	struct node *next;
+
+	if (!queue) {
+		log_err("ms_enqueue: null queue\n");
+		return -1;
+	}
+	if (!(node = node_new(data)))
+		return -1;
+
+	epoch_enter();
+	do {
+		tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+		next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+		if (tail != __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE))
+			continue;
+
+		if (next) {
+			/* tail is lagging behind; help it along */
+			__atomic_compare_exchange_n(&queue->tail, &tail, next,
+					false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+		} else if (__atomic_compare_exchange_n(&tail->next, &next, node,
+					false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+			break;
+		}
+	} while (1);
+	__atomic_compare_exchange_n(&queue->tail, &tail, node,
+			false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+	epoch_exit();
+
+	return 0;
+}
+
+bool is_msqueue_empty(struct MSQueue *queue)
+{
+	bool is_empty = true;
+	struct node *head;
+
+	if (queue) {
+		epoch_enter();
+		head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+		is_empty = !__atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+		epoch_exit();
+	} else {
+		log_err("is_msqueue_empty: null queue\n");
+	}
+
+	return is_empty;
+}
+
+/* returns NULL if the queue is empty */
+void *ms_dequeue(struct MSQueue *queue)
+{
+	struct node *head;
+	struct node *tail;
+	struct node *next;
+	void *data = NULL;
+
+	if (!queue) {
+		log_err("ms_dequeue: null queue\n");
+		return NULL;
+	}
+
+	epoch_enter();
+	do {
+		head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+		tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+		next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+		if (head != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE))
+			continue;
+
+		if (head == tail) {
+			if (!next) {
+				epoch_exit();
+				return NULL;
+			}
+			__atomic_compare_exchange_n(&queue->tail, &tail, next,
+					false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+		} else {
+			/* read before the CAS: next may be retired right after */
+			data = next->data;
+			if (__atomic_compare_exchange_n(&queue->head, &head, next,
+						false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+				break;
+		}
+	} while (1);
+	epoch_exit();
+
+	epoch_retire(&((struct ms_node *)head)->entry, node_free);
+	return data;
+}
+
+/* not thread safe: no other thread may use the queue any more */
+void msqueue_destroy(struct MSQueue *queue)
+{
+	struct node *node;
+	struct node *next;
+
+	if (queue) {
+		if ((node = queue->head)) {
+			for (next = node->next; next; next = node->next) {
+				if (queue->destroy_func)
+					queue->destroy_func(next->data);
+				free(node);
+				node = next;
+			}
+			free(node);
+		}
+		queue->head = NULL;
+		queue->tail = NULL;
+		epoch_barrier();
+	} else {
+		log_err("can't destroy null msqueue\n");
+	}
+}
@@ -0,0 +1,561 @@
+#include "prbtree.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "logmsg.h"
+
+
+/*
+ * Same functional insert and delete as rcu_rbtree. The version owns one
+ * reference to its root and every node owns one reference to each child.
+ * take() opens a node for rebuilding: the caller ends up owning
+ * references to its children and entry. A node this version alone
+ * references is recycled through the spare pool, so the next mk()
+ * rebuilds it in place; a shared one is left to its other owners.
+ * Always take a parent before its child, or a child that looks
+ * unshared may still be reachable from another version.
+ */
+
+/* upper bound on nodes one update creates per level of the old tree */
+#define NODES_PER_LEVEL	8
+
+#define is_red(n)	((n) && (n)->color == Red)
+#define is_black(n)	((n) && (n)->color == Black)
+
+
+/* what take() leaves of a node, all references owned by the caller */
+struct parts {
+	struct prbnode *left;
+	struct prbnode *right;
+	void *key;
+	void *value;
+	unsigned long *key_owners;
+	unsigned long *val_owners;
+	enum color color;
+};
+
+
+static int reserve(struct prbtree *);
+static struct prbnode *mk(struct prbtree *, enum color, struct prbnode *, const struct parts *,
+		struct prbnode *);
+static void take(struct prbtree *, struct prbnode *, struct parts *);
+static void hold(struct prbnode *);
+static void release(struct prbtree *, struct prbnode *);
+static void drop(struct prbtree *, const struct parts *);
+static void unown(unsigned long *, DestroyFunc, void *);
+static struct prbnode *paint(struct prbtree *, enum color, struct prbnode *);
+static struct prbnode *bal_left(struct prbtree *, struct prbnode *, const struct parts *,
+		struct prbnode *);
+static struct prbnode *bal_right(struct prbtree *, struct prbnode *, const struct parts *,
+		struct prbnode *);
+static struct prbnode *bal_del_left(struct prbtree *, struct prbnode *, const struct parts *,
+		struct prbnode *);
+static struct prbnode *bal_del_right(struct prbtree *, struct prbnode *, const struct parts *,
+		struct prbnode *);
+static struct prbnode *join(struct prbtree *, struct prbnode *, struct prbnode *);
+static struct prbnode *ins(struct prbtree *, struct prbnode *, const struct parts *, int);
+static struct prbnode *del(struct prbtree *, struct prbnode *, const void *);
+static struct prbnode *lookup(struct prbtree *, const void *);
+static int insert(struct prbtree *, void *, void *, int);
+static int inorder(struct prbnode *, TraverseFunc, void *);
+
+
+
+int prbtree_init(struct prbtree *tree, CompareFunc cmp, DestroyFunc key_dst, DestroyFunc val_dst)
+{
+	int ret_val = -1;
+
+	if (tree) {
+		if (cmp) {
+			tree->root = NULL;
+			tree->count = 0;
+			tree->cmp_func = cmp;
+			tree->key_dst_func = key_dst;
+			tree->val_dst_func = val_dst;
+			tree->spare = NULL;
+			tree->spare_count = 0;
+			ret_val = 0;
+		} else {
+			log_err("null compare func\n");
+		}
+	} else {
+		log_err("null tree pointer\n");
+	}
+
+	return ret_val;
+}
+
+/* snap must not hold a version; release it with prbtree_destroy */
+int prbtree_snapshot(struct prbtree *snap, const struct prbtree *tree)
+{
+	if (!snap || !tree) {
+		log_err("prbtree_snapshot: null tree\n");
+		return -1;
+	}
+
+	*snap = *tree;
+	snap->spare = NULL;
+	snap->spare_count = 0;
+	hold(snap->root);
+
+	return 0;
+}
+
+/*
+ * Tops up the spare pool so that nothing can fail halfway through an
+ * update. The height is at most twice the black height, which the
+ * leftmost path gives.
+ */
+static int reserve(struct prbtree *tree)
+{
+	struct prbnode *node;
+	size_t levels = 2;
+	size_t need;
+
+	for (node = tree->root; node; node = node->left)
+		levels += 2 * is_black(node);
+	need = NODES_PER_LEVEL * levels;
+
+	while (tree->spare_count < need) {
+		if (!(node = malloc(sizeof(*node)))) {
+			log_err("reserve: malloc node");
+			return -1;
+		}
+		node->left = tree->spare;
+		tree->spare = node;
+		++tree->spare_count;
+	}
+
+	return 0;
+}
+
+static struct prbnode *mk(struct prbtree *tree, enum color color, struct prbnode *left,
+		const struct parts *entry, struct prbnode *right)
+{
+	struct prbnode *node;
+
+	if (!(node = tree->spare)) {
+		/* reserve() sized the pool for the worst case */
+		log_err("mk: spare pool exhausted\n");
+		abort();
+	}
+	tree->spare = node->left;
+	--tree->spare_count;
+
+	node->left = left;
+	node->right = right;
+	node->key = entry->key;
+	node->value = entry->value;
+	node->key_owners = entry->key_owners;
+	node->val_owners = entry->val_owners;
+	node->refs = 1;
+	node->color = color;
+
+	return node;
+}
+
+static void take(struct prbtree *tree, struct prbnode *node, struct parts *parts)
+{
+	parts->left = node->left;
+	parts->right = node->right;
+	parts->key = node->key;
+	parts->value = node->value;
+	parts->key_owners = node->key_owners;
+	parts->val_owners = node->val_owners;
+	parts->color = node->color;
+
+	if (__atomic_load_n(&node->refs, __ATOMIC_ACQUIRE) == 1) {
+		/* ours alone: inherit its references, reuse its memory */
+		node->left = tree->spare;
+		tree->spare = node;
+		++tree->spare_count;
+	} else {
+		hold(parts->left);
+		hold(parts->right);
+		if (parts->key_owners)
+			__atomic_fetch_add(parts->key_owners, 1, __ATOMIC_RELAXED);
+		if (parts->val_owners)
+			__atomic_fetch_add(parts->val_owners, 1, __ATOMIC_RELAXED);
+		/* the other owners may have let go meanwhile */
+		release(tree, node);
+	}
+}
+
+static void hold(struct prbnode *node)
+{
+	if (node)
+		__atomic_fetch_add(&node->refs, 1, __ATOMIC_RELAXED);
+}
+
+static void release(struct prbtree *tree, struct prbnode *node)
+{
+	struct prbnode *right;
+
+	for (; node && !__atomic_sub_fetch(&node->refs, 1, __ATOMIC_ACQ_REL); node = right) {
+		release(tree, node->left);
+		unown(node->key_owners, tree->key_dst_func, node->key);
+		unown(node->val_owners, tree->val_dst_func, node->value);
+		right = node->right;
+		free(node);
+	}
+}
+
+/* lets go of the entry in parts, which take() handed over */
+static void drop(struct prbtree *tree, const struct parts *parts)
+{
+	unown(parts->key_owners, tree->key_dst_func, parts->key);
+	unown(parts->val_owners, tree->val_dst_func, parts->value);
+}
+
+/* owners is only allocated along with a destructor for data */
+static void unown(unsigned long *owners, DestroyFunc dst_func, void *data)
+{
+	if (owners && !__atomic_sub_fetch(owners, 1, __ATOMIC_ACQ_REL)) {
+		dst_func(data);
+		free(owners);
+	}
+}
+
+static struct prbnode *paint(struct prbtree *tree, enum color color, struct prbnode *node)
+{
+	struct parts p;
+
+	if (!node || node->color == color)
+		return node;
+	take(tree, node, &p);
+
+	return mk(tree, color, p.left, &p, p.right);
+}
+
+/* B l entry r, with a red-red violation in l lifted out */
+static struct prbnode *bal_left(struct prbtree *tree, struct prbnode *l, const struct parts *entry,
+		struct prbnode *r)
+{
+	struct parts lp;
+	struct parts cp;
+
+	if (is_red(l) && is_red(l->left)) {
+		take(tree, l, &lp);
+		take(tree, lp.left, &cp);
+		return mk(tree, Red, mk(tree, Black, cp.left, &cp, cp.right),
+				&lp, mk(tree, Black, lp.right, entry, r));
+	}
+	if (is_red(l) && is_red(l->right)) {
+		take(tree, l, &lp);
+		take(tree, lp.right, &cp);
+		return mk(tree, Red, mk(tree, Black, lp.left, &lp, cp.left),
+				&cp, mk(tree, Black, cp.right, entry, r));
+	}
+
+	return mk(tree, Black, l, entry, r);
+}
+
+static struct prbnode *bal_right(struct prbtree *tree, struct prbnode *l, const struct parts *entry,
+		struct prbnode *r)
+{
+	struct parts rp;
+	struct parts cp;
+
+	if (is_red(r) && is_red(r->right)) {
+		take(tree, r, &rp);
+		take(tree, rp.right, &cp);
+		return mk(tree, Red, mk(tree, Black, l, entry, rp.left),
+				&rp, mk(tree, Black, cp.left, &cp, cp.right));
+	}
+	if (is_red(r) && is_red(r->left)) {
+		take(tree, r, &rp);
+		take(tree, rp.left, &cp);
+		return mk(tree, Red, mk(tree, Black, l, entry, cp.left),
+				&cp, mk(tree, Black, cp.right, &rp, rp.right));
+	}
+
+	return mk(tree, Black, l, entry, r);
+}
+
+/* rebuild after l lost one black level */
+static struct prbnode *bal_del_left(struct prbtree *tree, struct prbnode *l,
+		const struct parts *entry, struct prbnode *r)
+{
+	struct prbnode *inner;
+	struct parts rp;
+	struct parts cp;
+
+	if (is_red(l))
+		return mk(tree, Red, paint(tree, Black, l), entry, r);
+	if (is_black(r))
+		return bal_right(tree, l, entry, paint(tree, Red, r));
+	if (is_red(r) && is_black(r->left)) {
+		take(tree, r, &rp);
+		take(tree, rp.left, &cp);
+		inner = bal_right(tree, cp.right, &rp, paint(tree, Red, rp.right));
+		return mk(tree, Red, mk(tree, Black, l, entry, cp.left), &cp, inner);
+	}
+
+	return mk(tree, Red, l, entry, r);
+}
+
+/* rebuild after r lost one black level */
+static struct prbnode *bal_del_right(struct prbtree *tree, struct prbnode *l,
+		const struct parts *entry, struct prbnode *r)
+{
+	struct prbnode *inner;
+	struct parts lp;
+	struct parts cp;
+
+	if (is_red(r))
+		return mk(tree, Red, l, entry, paint(tree, Black, r));
+	if (is_black(l))
+		return bal_left(tree, paint(tree, Red, l), entry, r);
+	if (is_red(l) && is_black(l->right)) {
+		take(tree, l, &lp);
+		take(tree, lp.right, &cp);
+		inner = bal_left(tree, paint(tree, Red, lp.left), &lp, cp.left);
+		return mk(tree, Red, inner, &cp, mk(tree, Black, cp.right, entry, r));
+	}
+
+	return mk(tree, Red, l, entry, r);
+}
+
+/* l and r side by side, every key of l below every key of r */
+static struct prbnode *join(struct prbtree *tree, struct prbnode *l, struct prbnode *r)
+{
+	struct prbnode *mid;
+	struct parts lp;
+	struct parts rp;
+	struct parts mp;
+
+	if (!l)
+		return r;
+	if (!r)
+		return l;
+
+	if (l->color == r->color) {
+		take(tree, l, &lp);
+		take(tree, r, &rp);
+		mid = join(tree, lp.right, rp.left);
+		if (is_red(mid)) {
+			take(tree, mid, &mp);
+			return mk(tree, Red, mk(tree, lp.color, lp.left, &lp, mp.left),
+					&mp, mk(tree, lp.color, mp.right, &rp, rp.right));
+		}
+		if (lp.color == Red)
+			return mk(tree, Red, lp.left, &lp, mk(tree, Red, mid, &rp, rp.right));
+		return bal_del_left(tree, lp.left, &lp, mk(tree, Black, mid, &rp, rp.right));
+	}
+	if (is_red(r)) {
+		take(tree, r, &rp);
+		return mk(tree, Red, join(tree, l, rp.left), &rp, rp.right);
+	}
+	take(tree, l, &lp);
+
+	return mk(tree, Red, lp.left, &lp, join(tree, lp.right, r));
+}
+
+/*
+ * Consumes the reference to node and returns one to the new subtree.
+ * An existing key behaves as in rbtree: replace swaps the key too,
+ * otherwise the tree keeps its key and the new one is destroyed.
+ */
+static struct prbnode *ins(struct prbtree *tree, struct prbnode *node, const struct parts *entry,
+		int replace)
+{
+	struct prbnode *sub;
+	struct parts p;
+	int cmp;
+
+	if (!node) {
+		++tree->count;
+		return mk(tree, Red, NULL, entry, NULL);
+	}
+
+	cmp = tree->cmp_func(entry->key, node->key);
+	take(tree, node, &p);
+	if (cmp < 0) {
+		sub = ins(tree, p.left, entry, replace);
+		if (p.color == Black)
+			return bal_left(tree, sub, &p, p.right);
+		return mk(tree, Red, sub, &p, p.right);
+	}
+	if (cmp > 0) {
+		sub = ins(tree, p.right, entry, replace);
+		if (p.color == Black)
+			return bal_right(tree, p.left, &p, sub);
+		return mk(tree, Red, p.left, &p, sub);
+	}
+	if (replace) {
+		drop(tree, &p);
+		return mk(tree, p.color, p.left, entry, p.right);
+	}
+	unown(entry->key_owners, tree->key_dst_func, entry->key);
+	unown(p.val_owners, tree->val_dst_func, p.value);
+	p.value = entry->value;
+	p.val_owners = entry->val_owners;
+
+	return mk(tree, p.color, p.left, &p, p.right);
+}
+
+/* key must be present */
+static struct prbnode *del(struct prbtree *tree, struct prbnode *node, const void *key)
+{
+	struct prbnode *sub;
+	struct parts p;
+	int cmp;
+
+	cmp = tree->cmp_func(key, node->key);
+	take(tree, node, &p);
+	if (cmp < 0) {
+		if (is_black(p.left)) {
+			sub = del(tree, p.left, key);
+			return bal_del_left(tree, sub, &p, p.right);
+		}
+		return mk(tree, Red, del(tree, p.left, key), &p, p.right);
+	}
+	if (cmp > 0) {
+		if (is_black(p.right)) {
+			sub = del(tree, p.right, key);
+			return bal_del_right(tree, p.left, &p, sub);
+		}
+		return mk(tree, Red, p.left, &p, del(tree, p.right, key));
+	}
+	drop(tree, &p);
+	--tree->count;
+
+	return join(tree, p.left, p.right);
+}
+
+static struct prbnode *lookup(struct prbtree *tree, const void *key)
+{
+	struct prbnode *node = tree->root;
+	int cmp;
+
+	while (node && (cmp = tree->cmp_func(key, node->key)))
+		node = cmp < 0 ? node->left : node->right;
+
+	return node;
+}
+
+int prbtree_insert(struct prbtree *tree, void *key, void *value)
+{
+	if (!tree) {
+		log_err("prbtree_insert: null tree\n");
+		return -1;
+	}
+
+	return insert(tree, key, value, 0);
+}
+
+int prbtree_replace(struct prbtree *tree, void *key, void *value)
+{
+	if (!tree) {
+		log_err("prbtree_replace: null tree\n");
+		return -1;
+	}
+
+	return insert(tree, key, value, 1);
+}
+
+/* key and value get owner counts of their own: ins may keep one, not the other */
+static int insert(struct prbtree *tree, void *key, void *value, int replace)
+{
+	struct parts entry = {NULL, NULL, key, value, NULL, NULL, Red};
+
+	if (tree->key_dst_func && !(entry.key_owners = malloc(sizeof(*entry.key_owners))))
+		goto error;
+	if (tree->val_dst_func && !(entry.val_owners = malloc(sizeof(*entry.val_owners))))
+		goto error;
+	if (reserve(tree)) {
+		free(entry.key_owners);
+		free(entry.val_owners);
+		return -1;
+	}
+	if (entry.key_owners)
+		*entry.key_owners = 1;
+	if (entry.val_owners)
+		*entry.val_owners = 1;
+	tree->root = paint(tree, Black, ins(tree, tree->root, &entry, replace));
+
+	return 0;
+error:
+	log_err("insert: malloc owners");
+	free(entry.key_owners);
+	return -1;
+}
+
+int prbtree_remove(struct prbtree *tree, const void *key)
+{
+	if (!tree) {
+		log_err("prbtree_remove: tree is null\n");
+		return -1;
+	}
+
+	/* del would rebuild the path even for a missing key */
+	if (!lookup(tree, key))
+		return 0;
+	if (reserve(tree))
+		return -1;
+	tree->root = paint(tree, Black, del(tree, tree->root, key));
+
+	return 0;
+}
+
+void *prbtree_search(struct prbtree *tree, const void *key)
+{
+	struct prbnode *node;
+	void *value = NULL;
+
+	if (tree) {
+		if ((node = lookup(tree, key)))
+			value = node->value;
+	} else {
+		log_err("prbtree_search: tree is null\n");
+	}
+
+	return value;
+}
+
+void prbtree_foreach(struct prbtree *tree, TraverseFunc trav_func, void *data)
+{
+	if (tree)
+		inorder(tree->root, trav_func, data);
+	else
+		log_err("prbtree_foreach: null tree\n");
+}
+
+/* recursion depth is the tree height, at most twice log2(n + 1) */
+static int inorder(struct prbnode *node, TraverseFunc trav_func, void *data)
+{
+	for (; node; node = node->right) {
+		if (inorder(node->left, trav_func, data) || trav_func(node->key, node->value, data))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* drops this version; nodes other versions share survive */
+void prbtree_clear(struct prbtree *tree)
+{
+	if (tree) {
+		release(tree, tree->root);
+		tree->root = NULL;
+		tree->count = 0;
+	} else {
+		log_err("prbtree_clear: null tree\n");
+	}
+}
+
+void prbtree_destroy(struct prbtree *tree)
+{
+	struct prbnode *node;
+
+	if (tree) {
+		prbtree_clear(tree);
+		while ((node = tree->spare)) {
+			tree->spare = node->left;
+			free(node);
+		}
+		tree->spare_count = 0;
+	}
+}
@@ -1,14 +1,20 @@
 #include "queue.h"
 
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "lock.h"
 #include "logmsg.h"
 
 
 
 static void queue_clear(struct Queue *queue);
+static int splice(struct Queue *, struct node *, struct node *, size_t);
+static void *take(struct Queue *);
+static size_t take_n(struct Queue *, void **, size_t);
+static int remaining(const struct timespec *, struct timespec *);
 
 bool queue_init(DestroyFunc destroy_func, struct Queue *queue)
 {
@@ -18,6 +24,11 @@ bool queue_init(DestroyFunc destroy_func, struct Queue *queue)
 		queue->head = NULL;
 		queue->tail = NULL;
 		queue->destroy_func = destroy_func;
+		queue->blocking = false;
+		queue->closed = false;
+		queue->lock = 0;
+		queue->seq = 0;
+		queue->waiters = 0;
 		is_valid = true;
 	} else {
 		log_err("init null queue\n");
@@ -26,6 +37,17 @@ bool queue_init(DestroyFunc destroy_func, struct Queue *queue)
 	return is_valid;
 }
 
+/* a queue that is safe to share between threads and supports dequeue_timed */
+bool queue_init_blocking(DestroyFunc destroy_func, struct Queue *queue)
+{
+	bool is_valid;
+
+	if ((is_valid = queue_init(destroy_func, queue)))
+		queue->blocking = true;
+
+	return is_valid;
+}
+
 int enqueue(struct Queue *queue, void *data)
 {
 	int ret_code = -1;
@@ -35,15 +57,8 @@ int enqueue(struct Queue *queue, void *data)
 		if ((node = malloc(sizeof(*node)))) {
 			node->data = data;
 			node->next = NULL;
-			if (queue->tail) {
-				queue->tail->next = node;
-				queue->tail = node;
-			} else {
-				queue->tail = node;
-				queue->head = node;
-			}
-
-			ret_code = 0;
+			if ((ret_code = splice(queue, node, node, 1)))
+				free(node);
 		} else {
 			log_err("enqueue: malloc node");
 		}
@@ -54,12 +69,61 @@ int enqueue(struct Queue *queue, void *data)
 	return ret_code;
 }
 
+/*
+ * Append items[0] .. items[n-1] in order. The nodes are linked privately
+ * and spliced onto the tail at once; on allocation failure nothing is
+ * enqueued.
+ */
+int enqueue_n(struct Queue *queue, void **items, size_t n)
+{
+	int ret_code = -1;
+	struct node *first = NULL;
+	struct node *last = NULL;
+	struct node *node;
+	size_t i;
+
+	if (queue && (items || !n)) {
+		for (i = 0; i < n; ++i) {
+			if (!(node = malloc(sizeof(*node)))) {
+				log_err("enqueue_n: malloc node");
+				break;
+			}
+			node->data = items[i];
+			node->next = NULL;
+			if (last)
+				last->next = node;
+			else
+				first = node;
+			last = node;
+		}
+
+		if (i == n)
+			ret_code = last ? splice(queue, first, last, n) : 0;
+		if (ret_code) {
+			while ((node = first)) {
+				first = node->next;
+				free(node);
+			}
+		}
+	} else {
+		log_err("enqueue_n: null queue or items\n");
+	}
+
+	return ret_code;
+}
+
 bool is_queue_empty(struct Queue *queue)
 {
 	bool is_empty = true;
 
 	if (queue) {
-		is_empty = !queue->head;
+		if (queue->blocking) {
+			lock(&queue->lock);
+			is_empty = !queue->head;
+			unlock(&queue->lock);
+		} else {
+			is_empty = !queue->head;
+		}
 	} else {
 		log_err("null queue\n");
 	}
@@ -69,17 +133,15 @@ bool is_queue_empty(struct Queue *queue)
 
 void *dequeue(struct Queue *queue)
 {
-	struct node *node;
 	void *data = NULL;
 
 	if (queue) {
-		if ((node = queue->head)) {
-			data = node->data;
-			queue->head = node->next;
-			if (!queue->head)
-				queue->tail = NULL;
-
-			free(node);
+		if (queue->blocking) {
+			lock(&queue->lock);
+			data = take(queue);
+			unlock(&queue->lock);
+		} else {
+			data = take(queue);
 		}
 	} else {
 		log_err("dequeue: null queue\n");
@@ -88,6 +150,104 @@ void *dequeue(struct Queue *queue)
 	return data;
 }
 
+/* dequeue up to n elements into out; returns how many were dequeued */
+size_t dequeue_n(struct Queue *queue, void **out, size_t n)
+{
+	size_t count = 0;
+
+	if (queue && out) {
+		if (queue->blocking) {
+			lock(&queue->lock);
+			count = take_n(queue, out, n);
+			unlock(&queue->lock);
+		} else {
+			count = take_n(queue, out, n);
+		}
+	} else {
+		log_err("dequeue_n: null queue or out\n");
+	}
+
+	return count;
+}
+
+/*
+ * Blocking mode only: wait up to the relative timeout (NULL waits
+ * forever) for an element. Returns NULL with errno ETIMEDOUT when the
+ * time runs out, or EPIPE when the queue is closed and drained.
+ */
+void *dequeue_timed(struct Queue *queue, const struct timespec *timeout)
+{
+	struct timespec deadline;
+	struct timespec left;
+	unsigned int seq;
+	void *data = NULL;
+
+	if (!queue) {
+		log_err("dequeue_timed: null queue\n");
+		return NULL;
+	}
+	if (!queue->blocking) {
+		log_err("dequeue_timed: queue is not blocking\n");
+		return dequeue(queue);
+	}
+
+	if (timeout) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout->tv_sec;
+		deadline.tv_nsec += timeout->tv_nsec;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_nsec -= 1000000000L;
+			++deadline.tv_sec;
+		}
+	}
+
+	lock(&queue->lock);
+	while (!queue->head) {
+		if (queue->closed) {
+			errno = EPIPE;
+			break;
+		}
+		if (timeout && remaining(&deadline, &left)) {
+			errno = ETIMEDOUT;
+			break;
+		}
+
+		/* a producer bumps seq under the lock, so no wakeup is lost */
+		seq = queue->seq;
+		++queue->waiters;
+		unlock(&queue->lock);
+		futex_wait(&queue->seq, seq, timeout ? &left : NULL);
+		lock(&queue->lock);
+		--queue->waiters;
+	}
+	if (queue->head)
+		data = take(queue);
+	unlock(&queue->lock);
+
+	return data;
+}
+
+/*
+ * Blocking mode only: refuse further enqueues and wake every waiter.
+ * Elements already queued can still be dequeued.
+ */
+void queue_close(struct Queue *queue)
+{
+	bool wake;
+
+	if (queue && queue->blocking) {
+		lock(&queue->lock);
+		queue->closed = true;
+		if ((wake = queue->waiters))
+			++queue->seq;
+		unlock(&queue->lock);
+		if (wake)
+			futex_wake(&queue->seq, INT_MAX);
+	} else {
+		log_err("queue_close: null or non-blocking queue\n");
+	}
+}
+
 static void queue_clear(struct Queue *queue)
 {
 	if (!queue)
@@ -110,3 +270,94 @@ void queue_destroy(struct Queue *queue)
 		log_err("can't destroy null queue\n");
 	}
 }
+
+/* link first..last onto the tail, waking sleeping consumers if needed */
+static int splice(struct Queue *queue, struct node *first, struct node *last, size_t count)
+{
+	unsigned int wake = 0;
+
+	if (queue->blocking) {
+		lock(&queue->lock);
+		if (queue->closed) {
+			unlock(&queue->lock);
+			log_err("enqueue: queue is closed\n");
+			return -1;
+		}
+	}
+
+	if (queue->tail)
+		queue->tail->next = first;
+	else
+		queue->head = first;
+	queue->tail = last;
+
+	if (queue->blocking) {
+		if ((wake = queue->waiters)) {
+			if (wake > count)
+				wake = count;
+			++queue->seq;
+		}
+		unlock(&queue->lock);
+		if (wake)
+			futex_wake(&queue->seq, wake);
+	}
+
+	return 0;
+}
+
+static void *take(struct Queue *queue)
+{
+	struct node *node;
+	void *data = NULL;
+
+	if ((node = queue->head)) {
+		data = node->data;
+		queue->head = node->next;
+		if (!queue->head)
+			queue->tail = NULL;
+
+		free(node);
+	}
+
+	return data;
+}
+
+/* detach the first n nodes with a single head update */
+static size_t take_n(struct Queue *queue, void **out, size_t n)
+{
+	struct node *chain;
+	struct node *node;
+	size_t count = 0;
+
+	chain = queue->head;
+	for (node = chain; node && count < n; node = node->next)
+		out[count++] = node->data;
+	queue->head = node;
+	if (!node)
+		queue->tail = NULL;
+
+	while (chain != node) {
+		struct node *next = chain->next;
+
+		free(chain);
+		chain = next;
+	}
+
+	return count;
+}
+
+/* time left until deadline in left; returns -1 once it has passed */
+static int remaining(const struct timespec *deadline, struct timespec *left)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	left->tv_sec = deadline->tv_sec - now.tv_sec;
+	left->tv_nsec = deadline->tv_nsec - now.tv_nsec;
+	if (left->tv_nsec < 0) {
+		left->tv_nsec += 1000000000L;
+		--left->tv_sec;
+	}
+
+	return left->tv_sec < 0 ? -1 : 0;
+}
@@ -7,8 +7,42 @@
 #include "logmsg.h"
 
 
-static struct rbnode *node_new(void *, void *);
-static void node_destroy(struct rbnode*);
+#define rb_set_parent(n, p) \
+	((n)->parent_color = (uintptr_t)(p) | ((n)->parent_color & 1))
+#define rb_set_color(n, c) \
+	((n)->parent_color = ((n)->parent_color & ~(uintptr_t)1) | (c))
+
+#ifdef RBTREE_ORDER_STATS
+#define rb_size(n)	((n) ? (n)->size : 0)
+#endif
+
+/* slab size a bulk-built tree switches to when it had none */
+#define DEFAULT_SLAB_NODES	4096
+/* rbtree_insert_many rebuilds once the batch is this fraction of the tree */
+#define REBUILD_RATIO	4
+/* descents rbtree_search_batch interleaves; enough to cover a DRAM miss */
+#define SEARCH_GROUP	16
+
+
+struct rbslab {
+	struct rbslab *next;
+	size_t count;
+	struct rbnode nodes[];
+};
+
+struct rbentry {
+	void *key;
+	void *value;
+};
+
+
+static struct rbnode *node_new(struct rbtree *, void *, void *);
+static struct rbnode *node_alloc(struct rbtree *);
+static struct rbnode *node_init(struct rbtree *, struct rbnode *, void *, void *);
+static void node_release(struct rbtree *, struct rbnode *);
+static struct rbnode *arena_alloc(struct rbtree *);
+static void arena_free(struct rbtree *);
+static void node_destroy(struct rbtree *, struct rbnode*);
 static struct rbnode *grandparent(const struct rbnode *);
 static struct rbnode *get_uncle(const struct rbnode *);
 static struct rbnode *get_sibling(const struct rbnode*);
@@ -17,8 +51,11 @@ static void rotate_right(struct rbnode*);
 
 
 static int insert(struct rbtree *, void*, void*, int); 
+static struct rbnode *get_or_insert(struct rbtree *, void *, void *, int *);
+static void update(struct rbtree *, struct rbnode *, void *, void *, int);
 static void insert_cases(struct rbtree*, struct rbnode*);
 static struct rbnode *search(struct rbtree *, const void *);
+static void search_group(struct rbtree *, const void **, void **, size_t);
 
 static int remove_node(struct rbtree*, struct rbnode*);
 static struct rbnode *get_pred(struct rbtree*, struct rbnode*);
@@ -27,31 +64,78 @@ static void replace_with_child(struct rbtree*, struct rbnode*, struct rbnode*);
 static void remove_cases(struct rbtree*, struct rbnode*);
 
 static void inorder(struct rbtree *, TraverseFunc, void *);
+static int bound(struct rbtree *, const void *, struct rbcursor *, int);
+static struct rbnode *successor(struct rbnode *);
+static struct rbnode *predecessor(struct rbnode *);
+static struct rbnode *descend(struct rbtree *, const void *, struct rbnode **, int *);
+static void attach(struct rbtree *, struct rbnode *, struct rbnode *, int);
 
+static struct rbslab *slab_new(size_t);
+static void build(struct rbtree *, struct rbslab *, void **, void **, size_t);
+static struct rbnode *build_range(struct rbnode *, void **, void **, size_t, size_t,
+		unsigned, unsigned, struct rbnode *);
+static int sort_entries(struct rbtree *, struct rbentry *, size_t);
+static size_t fold_duplicates(struct rbtree *, struct rbentry *, size_t);
+static int insert_sorted(struct rbtree *, struct rbentry *, size_t);
+static int merge_rebuild(struct rbtree *, struct rbentry *, size_t);
 
+#ifdef RBTREE_ORDER_STATS
+static void adjust_sizes(struct rbnode *, int);
+#endif
 
-static struct rbnode *node_new(void *key, void *value)
+
+
+static struct rbnode *node_new(struct rbtree *tree, void *key, void *value)
 {
-	struct rbnode *node = NULL;
+	struct rbnode *node;
 
-	if ((node = malloc(sizeof(*node)))) {
-		node->parent = NULL;
-		node->left = NULL;
-		node->right = NULL;
-		node->key = key;
-		node->value = value;
-		node->color = Red;
-	} else {
-		log_err("node_new");
-	}
+	if ((node = node_alloc(tree)))
+		node_init(tree, node, key, value);
 
 	return node;
 }
 
+/* raw node from the tree's arena or malloc, not yet counted */
+static struct rbnode *node_alloc(struct rbtree *tree)
+{
+	struct rbnode *node;
+
+	if (!(node = tree->slab_nodes ? arena_alloc(tree) : malloc(sizeof(*node))))
+		log_err("node_alloc");
+
+	return node;
+}
+
+static struct rbnode *node_init(struct rbtree *tree, struct rbnode *node, void *key, void *value)
+{
+	node->parent_color = Red;
+	node->left = NULL;
+	node->right = NULL;
+	node->key = key;
+	node->value = value;
+#ifdef RBTREE_ORDER_STATS
+	node->size = 1;
+#endif
+	++tree->count;
+
+	return node;
+}
+
+/* hands back a node_alloc node that never made it into the tree */
+static void node_release(struct rbtree *tree, struct rbnode *node)
+{
+	if (tree->slab_nodes) {
+		node->left = tree->free_nodes;
+		tree->free_nodes = node;
+	} else {
+		free(node);
+	}
+}
+
 static struct rbnode *grandparent(const struct rbnode *node)
 {
-	if (node && node->parent)
-		return node->parent->parent;
+	if (node && rb_parent(node))
+		return rb_parent(rb_parent(node));
 	else
 		return NULL;
 }
@@ -61,7 +145,7 @@ static struct rbnode *get_uncle(const struct rbnode *node)
 	struct rbnode *parent;
 	struct rbnode *grandpa;
 
-	if (node && (parent = node->parent) && (grandpa = parent->parent))
+	if (node && (parent = rb_parent(node)) && (grandpa = rb_parent(parent)))
 		return (parent == grandpa->left)?grandpa->right:grandpa->left;
 	else
 		return NULL;
@@ -73,7 +157,7 @@ static struct rbnode *get_sibling(const struct rbnode *node)
 	struct rbnode *parent;
 
 	if (node) {
-		if ((parent = node->parent)) {
+		if ((parent = rb_parent(node))) {
 			sibling = (node == parent->left) ? parent->right : parent->left;
 		} else {
 			log_err("sibling: parent is null!\n");
@@ -92,7 +176,7 @@ static void rotate_left(struct rbnode *node)
 
 	if (node) {
 		if ((right = node->right)) {
-			if ((parent = node->parent)) {
+			if ((parent = rb_parent(node))) {
 				if (node == parent->left)
 					parent->left = right;
 				else
@@ -100,12 +184,16 @@ static void rotate_left(struct rbnode *node)
 			}
 
 			node->right = right->left;
-			node->parent = right;
+			rb_set_parent(node, right);
 			right->left = node;
-			right->parent = parent;
+			rb_set_parent(right, parent);
 
 			if (node->right)
-				node->right->parent = node;
+				rb_set_parent(node->right, node);
+#ifdef RBTREE_ORDER_STATS
+			right->size = node->size;
+			node->size = 1 + rb_size(node->left) + rb_size(node->right);
+#endif
 		}
 	}
 }
@@ -117,7 +205,7 @@ static void rotate_right(struct rbnode *node)
 
 	if (node) {
 		if ((left = node->left)) {
-			if ((parent = node->parent)) {
+			if ((parent = rb_parent(node))) {
 				if (node == parent->left)
 					parent->left = left;
 				else
@@ -125,19 +213,61 @@ static void rotate_right(struct rbnode *node)
 			}
 
 			node->left = left->right;
-			node->parent = left;
+			rb_set_parent(node, left);
 			left->right = node;
-			left->parent = parent;
+			rb_set_parent(left, parent);
 
 			if (node->left)
-				node->left->parent = node;
+				rb_set_parent(node->left, node);
+#ifdef RBTREE_ORDER_STATS
+			left->size = node->size;
+			node->size = 1 + rb_size(node->left) + rb_size(node->right);
+#endif
 		}
 	}
 }
 
-static void node_destroy(struct rbnode *node)
+/* next free node, or the next unused one of the newest slab */
+static struct rbnode *arena_alloc(struct rbtree *tree)
 {
-	free(node);
+	struct rbnode *node;
+	struct rbslab *slab;
+
+	if ((node = tree->free_nodes)) {
+		tree->free_nodes = node->left;
+		return node;
+	}
+
+	if (!(slab = tree->slabs) || tree->slab_used == slab->count) {
+		if (!(slab = malloc(sizeof(*slab) + tree->slab_nodes * sizeof(slab->nodes[0])))) {
+			log_err("arena_alloc: malloc slab");
+			return NULL;
+		}
+		slab->count = tree->slab_nodes;
+		slab->next = tree->slabs;
+		tree->slabs = slab;
+		tree->slab_used = 0;
+	}
+
+	return &slab->nodes[tree->slab_used++];
+}
+
+static void arena_free(struct rbtree *tree)
+{
+	struct rbslab *slab;
+
+	while ((slab = tree->slabs)) {
+		tree->slabs = slab->next;
+		free(slab);
+	}
+	tree->free_nodes = NULL;
+	tree->slab_used = 0;
+}
+
+static void node_destroy(struct rbtree *tree, struct rbnode *node)
+{
+	--tree->count;
+	node_release(tree, node);
 }
 
 int rbtree_init(struct rbtree *tree, CompareFunc cmp, DestroyFunc key_dst, DestroyFunc val_dst)
@@ -147,9 +277,15 @@ int rbtree_init(struct rbtree *tree, CompareFunc cmp, DestroyFunc key_dst, Destr
 	if (tree) {
 		if (cmp) {
 			tree->root = NULL;
+			tree->rightmost = NULL;
+			tree->count = 0;
 			tree->cmp_func = cmp;
 			tree->key_dst_func = key_dst;
 			tree->val_dst_func = val_dst;
+			tree->slabs = NULL;
+			tree->free_nodes = NULL;
+			tree->slab_nodes = 0;
+			tree->slab_used = 0;
 			ret_val = 0;
 		} else {
 			log_err("null compare func\n");
@@ -161,6 +297,22 @@ int rbtree_init(struct rbtree *tree, CompareFunc cmp, DestroyFunc key_dst, Destr
 	return ret_val;
 }
 
+/* like rbtree_init, but nodes come from slabs of slab_nodes nodes */
+int rbtree_init_arena(struct rbtree *tree, CompareFunc cmp, DestroyFunc key_dst,
+		DestroyFunc val_dst, size_t slab_nodes)
+{
+	int ret_val = -1;
+
+	if (slab_nodes) {
+		if (!(ret_val = rbtree_init(tree, cmp, key_dst, val_dst)))
+			tree->slab_nodes = slab_nodes;
+	} else {
+		log_err("rbtree_init_arena: zero slab size\n");
+	}
+
+	return ret_val;
+}
+
 int rbtree_insert(struct rbtree *tree, void *key, void *value)
 {
 	int ret_val = -1;
@@ -189,70 +341,90 @@ int rbtree_replace(struct rbtree *tree, void *key, void *value)
 
 static int insert(struct rbtree *tree, void *key, void *value, int replace)
 {
-	int ret_val = -1;
+	struct rbnode *node;
+	int inserted;
+
+	if (!(node = get_or_insert(tree, key, value, &inserted)))
+		return -1;
+	if (!inserted)
+		update(tree, node, key, value, replace);
+
+	return 0;
+}
+
+/* the one descent behind every insert: key's node, created with value if missing */
+static struct rbnode *get_or_insert(struct rbtree *tree, void *key, void *value, int *inserted)
+{
+	struct rbnode *node;
+	struct rbnode *parent;
 	int res;
-	struct rbnode *curr;
-	struct rbnode *new;
-	CompareFunc cmp_func;
 
-	if (tree) {
-		if ((curr = tree->root)) {
-			if ((cmp_func = tree->cmp_func)) {
-				do {
-					res = cmp_func(key, curr->key);
-					if (res < 0) {
-						if (curr->left) {
-							curr = curr->left;
-						} else if ((new = node_new(key, value))) {
-							curr->left = new;
-							new->parent = curr;
-							insert_cases(tree, new);
-							ret_val = 0;
-							break;
-						}
-					} else if (res > 0) {
-						if (curr->right) {
-							curr = curr->right;
-						} else if ((new = node_new(key, value))) {
-							curr->right = new;
-							new->parent = curr;
-							insert_cases(tree, new);
-							ret_val = 0;
-							break;
-						}
-					} else {
-						if (tree->val_dst_func)
-							tree->val_dst_func(curr->value);
-						curr->value = value;
-
-						if (replace) {
-							if (tree->key_dst_func)
-								tree->key_dst_func(curr->key);
-							curr->key = key;
-						} else {
-							if (tree->key_dst_func)
-								tree->key_dst_func(key);
-						}
+	if ((node = descend(tree, key, &parent, &res))) {
+		*inserted = 0;
+	} else if ((node = node_new(tree, key, value))) {
+		attach(tree, parent, node, res);
+		*inserted = 1;
+	}
 
-						ret_val = 0;
-						break;
-					}
-				} while (1);
-			} else {
-				log_err("insert: cmp_func is null\n");
-			}
-		} else {
-			if ((new = node_new(key, value))) {
-				tree->root = new;
-				insert_cases(tree, new);
-				ret_val = 0;
-			}
-		}
+	return node;
+}
+
+/* rbtree_insert (replace == 0) or rbtree_replace on an existing entry */
+static void update(struct rbtree *tree, struct rbnode *node, void *key, void *value, int replace)
+{
+	if (tree->val_dst_func)
+		tree->val_dst_func(node->value);
+	node->value = value;
+
+	if (replace) {
+		if (tree->key_dst_func)
+			tree->key_dst_func(node->key);
+		node->key = key;
 	} else {
-		log_err("insert: null tree\n");
+		if (tree->key_dst_func)
+			tree->key_dst_func(key);
 	}
+}
 
-	return ret_val;
+/*
+ * Value slot of key's entry, inserting key with value first if it is
+ * missing, in a single descent. *inserted (may be NULL) tells which
+ * happened; an entry that was already there is left alone and key and
+ * value stay the caller's. NULL if the node cannot be allocated.
+ */
+void **rbtree_get_or_insert(struct rbtree *tree, void *key, void *value, int *inserted)
+{
+	struct rbnode *node;
+	int added;
+
+	if (!tree) {
+		log_err("rbtree_get_or_insert: null tree\n");
+		return NULL;
+	}
+	if (!(node = get_or_insert(tree, key, value, &added)))
+		return NULL;
+	if (inserted)
+		*inserted = added;
+
+	return &node->value;
+}
+
+/* rbtree_insert in a single descent, returning the entry's value slot */
+void **rbtree_upsert(struct rbtree *tree, void *key, void *value)
+{
+	struct rbnode *node;
+	int inserted;
+
+	if (!tree) {
+		log_err("rbtree_upsert: null tree\n");
+		return NULL;
+	}
+	if (!(node = get_or_insert(tree, key, value, &inserted)))
+		return NULL;
+	if (!inserted)
+		update(tree, node, key, value, 0);
+
+	return &node->value;
 }
 
 static void insert_cases(struct rbtree *tree, struct rbnode *node)
@@ -262,18 +434,22 @@ static void insert_cases(struct rbtree *tree, struct rbnode *node)
 	struct rbnode *uncle;
 
 	if (tree) {
+#ifdef RBTREE_ORDER_STATS
+		/* rotations below expect every subtree size to count the new node */
+		adjust_sizes(rb_parent(node), 1);
+#endif
 		do {
 			if (!node) {
 				log_err("insert_case1: null node\n");
 				return;
 			}
-			if (!(parent = node->parent)) {
-				node->color = Black;
+			if (!(parent = rb_parent(node))) {
+				rb_set_color(node, Black);
 				return;
 			}
 
 			/* insert case 2	*/
-			if (Black == parent->color)
+			if (Black == rb_color(parent))
 				return;
 
 			/* insert case 3	*/
@@ -281,10 +457,10 @@ static void insert_cases(struct rbtree *tree, struct rbnode *node)
 				log_err("insert_case3: null granpa\n");
 				return;
 			}
-			if ((uncle = get_uncle(node)) && Red == uncle->color) {
-				parent->color = Black;
-				uncle->color = Black;
-				granpa->color = Red;
+			if ((uncle = get_uncle(node)) && Red == rb_color(uncle)) {
+				rb_set_color(parent, Black);
+				rb_set_color(uncle, Black);
+				rb_set_color(granpa, Red);
 				node = granpa;
 			} else {
 				break;
@@ -303,7 +479,7 @@ static void insert_cases(struct rbtree *tree, struct rbnode *node)
 
 
 		/* insert case 5	*/
-		if (!(parent = node->parent)) {
+		if (!(parent = rb_parent(node))) {
 			log_err("insert_case5: parent is null\n");
 			return;
 		}
@@ -312,11 +488,11 @@ static void insert_cases(struct rbtree *tree, struct rbnode *node)
 			return;
 		}
 
-		parent->color = Black;
-		granpa->color = Red;
+		rb_set_color(parent, Black);
+		rb_set_color(granpa, Red);
 		(node == parent->left)?rotate_right(granpa):rotate_left(granpa);
 
-		if (!(parent->parent))
+		if (!rb_parent(parent))
 			tree->root = parent;
 
 	} else {
@@ -339,6 +515,57 @@ void *rbtree_search(struct rbtree *tree, const void *key)
 	return value;
 }
 
+/*
+ * out[i] = rbtree_search(tree, keys[i]) for every i, but the descents
+ * run SEARCH_GROUP at a time in lock step: each step advances every
+ * unfinished key by one level and prefetches the child it moves to, so
+ * the group's cache misses overlap instead of queueing one per level.
+ */
+int rbtree_search_batch(struct rbtree *tree, const void **keys, void **out, size_t n)
+{
+	if (!tree || !keys || !out) {
+		log_err("rbtree_search_batch: null argument\n");
+		return -1;
+	}
+
+	for (size_t i = 0; i < n; i += SEARCH_GROUP)
+		search_group(tree, keys + i, out + i, n - i < SEARCH_GROUP ? n - i : SEARCH_GROUP);
+
+	return 0;
+}
+
+static void search_group(struct rbtree *tree, const void **keys, void **out, size_t n)
+{
+	struct rbnode *curr[SEARCH_GROUP];
+	unsigned char active[SEARCH_GROUP];
+	size_t left = n;
+	int res;
+
+	for (size_t i = 0; i < n; ++i) {
+		out[i] = NULL;
+		curr[i] = tree->root;
+		active[i] = curr[i] != NULL;
+		left -= !active[i];
+	}
+
+	while (left) {
+		for (size_t i = 0; i < n; ++i) {
+			if (!active[i])
+				continue;
+			if (!(res = tree->cmp_func(keys[i], curr[i]->key))) {
+				out[i] = curr[i]->value;
+				active[i] = 0;
+				--left;
+			} else if (!(curr[i] = res < 0 ? curr[i]->left : curr[i]->right)) {
+				active[i] = 0;
+				--left;
+			} else {
+				__builtin_prefetch(curr[i]);
+			}
+		}
+	}
+}
+
 static struct rbnode *search(struct rbtree *tree, const void *key)
 {
 	int res;
@@ -457,9 +684,9 @@ static int remove_child(struct rbtree *tree, struct rbnode *node)
 		if (node) {
 			child = node->left?node->left:node->right;
 
-			if (Black == node->color) {
-				if (child && Red == child->color)
-					child->color = Black;
+			if (Black == rb_color(node)) {
+				if (child && Red == rb_color(child))
+					rb_set_color(child, Black);
 				else
 					remove_cases(tree, node);
 			}
@@ -483,7 +710,7 @@ static void replace_with_child(struct rbtree *tree, struct rbnode *node, struct
 
 	if (tree) {
 		if (node) {
-			if ((parent = node->parent)) {
+			if ((parent = rb_parent(node))) {
 				if (node == parent->left)
 					parent->left = child;
 				else
@@ -491,11 +718,22 @@ static void replace_with_child(struct rbtree *tree, struct rbnode *node, struct
 			} else {
 				tree->root = child;
 			}
-
+			if (node == tree->rightmost) {
+				/* no right child: the max is now in child's subtree, or parent */
+				if ((tree->rightmost = child)) {
+					while (tree->rightmost->right)
+						tree->rightmost = tree->rightmost->right;
+				} else {
+					tree->rightmost = parent;
+				}
+			}
+#ifdef RBTREE_ORDER_STATS
+			adjust_sizes(parent, -1);
+#endif
 
 			if (child) {
-				child->parent = parent;
-				child->color = node->color;
+				rb_set_parent(child, parent);
+				rb_set_color(child, rb_color(node));
 			}
 
 			if (tree->key_dst_func)
@@ -504,7 +742,7 @@ static void replace_with_child(struct rbtree *tree, struct rbnode *node, struct
 			if (tree->val_dst_func)
 				tree->val_dst_func(node->value);
 			node->value= NULL;
-			node_destroy(node);
+			node_destroy(tree, node);
 		} else {
 			log_err("replace_child: node is null\n");
 		}
@@ -525,7 +763,7 @@ static void remove_cases(struct rbtree *tree, struct rbnode *node)
 				log_err("remove_case1: node is null\n");
 				return;
 			}
-			if (!(parent = node->parent))
+			if (!(parent = rb_parent(node)))
 				return;
 
 			/* remove case 2	*/
@@ -534,10 +772,10 @@ static void remove_cases(struct rbtree *tree, struct rbnode *node)
 				return;
 			}
 
-			if (Red == sibling->color) {
-				parent->color = Red;
-				sibling->color = Black;
-				granpa = parent->parent;
+			if (Red == rb_color(sibling)) {
+				rb_set_color(parent, Red);
+				rb_set_color(sibling, Black);
+				granpa = rb_parent(parent);
 
 				if (node == parent->left)
 					rotate_left(parent);
@@ -547,13 +785,18 @@ static void remove_cases(struct rbtree *tree, struct rbnode *node)
 				if (!granpa)
 					tree->root = sibling;
 
+				/* node has a new (black) sibling after the rotation */
+				if (!(sibling = get_sibling(node))) {
+					log_err("remove_case2: sibling is null\n");
+					return;
+				}
 				break;
 
 				/* remove case 3	*/
-			} else if (Black == parent->color && Black == sibling->color
-					&& (!sibling->left || Black == sibling->left->color)
-					&& (!sibling->right || Black == sibling->right->color)) {
-				sibling->color = Red;
+			} else if (Black == rb_color(parent) && Black == rb_color(sibling)
+					&& (!sibling->left || Black == rb_color(sibling->left))
+					&& (!sibling->right || Black == rb_color(sibling->right))) {
+				rb_set_color(sibling, Red);
 				node = parent;
 			} else {
 				break;
@@ -562,29 +805,29 @@ static void remove_cases(struct rbtree *tree, struct rbnode *node)
 
 
 		/* remove case 4	*/
-		if (Red == parent->color && Black == sibling->color
-				&& (!sibling->left || Black == sibling->left->color)
-				&& (!sibling->right || Black == sibling->right->color)) {
-			parent->color = Black;
-			sibling->color = Red;
+		if (Red == rb_color(parent) && Black == rb_color(sibling)
+				&& (!sibling->left || Black == rb_color(sibling->left))
+				&& (!sibling->right || Black == rb_color(sibling->right))) {
+			rb_set_color(parent, Black);
+			rb_set_color(sibling, Red);
 			return;
 		}
 
 		/* remove case 5	*/
-		if (Black != sibling->color) {
+		if (Black != rb_color(sibling)) {
 			log_err("remove_case5: sibling is red\n");
 			return;
 		}
 
 		if (node == parent->left
-				&& (!sibling->right || Black == sibling->right->color)) {
-			sibling->color = Red;
-			sibling->left->color = Black;
+				&& (!sibling->right || Black == rb_color(sibling->right))) {
+			rb_set_color(sibling, Red);
+			rb_set_color(sibling->left, Black);
 			rotate_right(sibling);
 		} else if (node == parent->right
-				&& (!sibling->left || Black == sibling->left->color)) {
-			sibling->color = Red;
-			sibling->right->color = Black;
+				&& (!sibling->left || Black == rb_color(sibling->left))) {
+			rb_set_color(sibling, Red);
+			rb_set_color(sibling->right, Black);
 			rotate_left(sibling);
 		}
 
@@ -594,35 +837,35 @@ static void remove_cases(struct rbtree *tree, struct rbnode *node)
 			return;
 		}
 
-		sibling->color = parent->color;
-		parent->color = Black;
+		rb_set_color(sibling, rb_color(parent));
+		rb_set_color(parent, Black);
 		if (node == parent->left) {
 			rotate_left(parent);
 			if (!sibling->right) {
 				log_err("remove_case6: sibling's child null\n");
 				return;
 			}
-			if (Red != sibling->right->color) {
+			if (Red != rb_color(sibling->right)) {
 				log_err("remove_case6: sibling's child not Red\n");
 				return;
 			}
 
-			sibling->right->color = Black;
+			rb_set_color(sibling->right, Black);
 		} else {
 			rotate_right(parent);
 			if (!sibling->left) {
 				log_err("remove_case6: sibling's child null\n");
 				return;
 			}
-			if (Red != sibling->left->color) {
+			if (Red != rb_color(sibling->left)) {
 				log_err("remove_case6: sibling's child not Red\n");
 				return;
 			}
 
-			sibling->left->color = Black;
+			rb_set_color(sibling->left, Black);
 		}
 
-		if (!sibling->parent)
+		if (!rb_parent(sibling))
 			tree->root = sibling;
 	} else {
 		log_err("remove_cases: tree is null\n");
@@ -643,18 +886,18 @@ static void inorder(struct rbtree *tree, TraverseFunc trav_func, void *data)
 		struct rbnode *prev = NULL;
 
 		while (curr) {
-			if (prev == curr->parent) {
+			if (prev == rb_parent(curr)) {
 				if (!(next = curr->left)) {
 					if (trav_func(curr->key, curr->value, data))
 						break;
-					next = curr->right?curr->right:curr->parent;
+					next = curr->right?curr->right:rb_parent(curr);
 				}
 			} else if (prev == curr->left) {
 				if (trav_func(curr->key, curr->value, data))
 					break;
-				next = curr->right?curr->right:curr->parent;
+				next = curr->right?curr->right:rb_parent(curr);
 			} else if (prev == curr->right) {
-				next = curr->parent;
+				next = rb_parent(curr);
 			} else {
 				log_err("inorder: curr is not l, r or p\n");
 				break;
@@ -667,13 +910,626 @@ static void inorder(struct rbtree *tree, TraverseFunc trav_func, void *data)
 	}
 }
 
+/* n nodes in one slab, not yet linked into any tree */
+static struct rbslab *slab_new(size_t n)
+{
+	struct rbslab *slab;
+
+	if (n > (SIZE_MAX - sizeof(*slab)) / sizeof(slab->nodes[0])) {
+		log_err("slab_new: %zu nodes overflow\n", n);
+		return NULL;
+	}
+	if ((slab = malloc(sizeof(*slab) + n * sizeof(slab->nodes[0])))) {
+		slab->count = n;
+	} else {
+		log_err("slab_new: malloc slab");
+	}
+
+	return slab;
+}
+
+/*
+ * Makes an empty tree out of n sorted entries laid out in order in slab.
+ * Every midpoint split leaves subtrees whose sizes differ by at most one,
+ * so all empty child slots sit on the last two levels: coloring just the
+ * deepest level red gives every path the same black height.
+ */
+static void build(struct rbtree *tree, struct rbslab *slab, void **keys, void **vals, size_t n)
+{
+	unsigned red_depth = 0;
+
+	while ((size_t)2 << red_depth <= n)
+		++red_depth;
+
+	if (!tree->slab_nodes)
+		tree->slab_nodes = DEFAULT_SLAB_NODES;
+	/* keep the partly used head slab where arena_alloc looks for it */
+	if (tree->slabs) {
+		slab->next = tree->slabs->next;
+		tree->slabs->next = slab;
+	} else {
+		slab->next = NULL;
+		tree->slabs = slab;
+		tree->slab_used = n;
+	}
+
+	tree->root = build_range(slab->nodes, keys, vals, 0, n, 0, red_depth, NULL);
+	if (tree->root)
+		rb_set_color(tree->root, Black);
+	tree->rightmost = n ? &slab->nodes[n - 1] : NULL;
+	tree->count = n;
+}
+
+static struct rbnode *build_range(struct rbnode *nodes, void **keys, void **vals, size_t lo,
+		size_t hi, unsigned depth, unsigned red_depth, struct rbnode *parent)
+{
+	struct rbnode *node;
+	size_t mid;
+
+	if (lo >= hi)
+		return NULL;
+
+	mid = lo + (hi - lo) / 2;
+	node = &nodes[mid];
+	node->parent_color = (uintptr_t)parent | (depth == red_depth ? Red : Black);
+	node->key = keys[mid];
+	node->value = vals ? vals[mid] : NULL;
+#ifdef RBTREE_ORDER_STATS
+	node->size = hi - lo;
+#endif
+	node->left = build_range(nodes, keys, vals, lo, mid, depth + 1, red_depth, node);
+	node->right = build_range(nodes, keys, vals, mid + 1, hi, depth + 1, red_depth, node);
+
+	return node;
+}
+
+/*
+ * Builds an empty tree from n keys in strictly ascending order in O(n),
+ * with all nodes in one slab. vals may be NULL for all-NULL values. A
+ * tree without an arena is switched to one (see rbtree_init_arena).
+ */
+int rbtree_build_sorted(struct rbtree *tree, void **keys, void **vals, size_t n)
+{
+	struct rbslab *slab;
+
+	if (!tree || (n && !keys)) {
+		log_err("rbtree_build_sorted: null tree or keys\n");
+		return -1;
+	}
+	if (tree->root) {
+		log_err("rbtree_build_sorted: tree is not empty\n");
+		return -1;
+	}
+	for (size_t i = 1; i < n; ++i) {
+		if (tree->cmp_func(keys[i - 1], keys[i]) >= 0) {
+			log_err("rbtree_build_sorted: keys not strictly ascending at %zu\n", i);
+			return -1;
+		}
+	}
+	if (!n)
+		return 0;
+
+	if (!(slab = slab_new(n)))
+		return -1;
+	build(tree, slab, keys, vals, n);
+
+	return 0;
+}
+
+/*
+ * Inserts n entries with rbtree_insert semantics, as if one at a time in
+ * the given order. The batch is sorted first; a batch that is small next
+ * to the tree goes in one sorted insert at a time, a larger one is merged
+ * with the tree's entries and the whole tree rebuilt in O(n + count).
+ * Either way every allocation comes before the first destructor call, so
+ * on -1 the tree is unchanged and the batch still the caller's.
+ */
+int rbtree_insert_many(struct rbtree *tree, void **keys, void **vals, size_t n)
+{
+	struct rbentry *entries;
+	int ret_val = -1;
+
+	if (!tree || (n && !keys)) {
+		log_err("rbtree_insert_many: null tree or keys\n");
+		return -1;
+	}
+	if (!n)
+		return 0;
+
+	if (!(entries = malloc(n * sizeof(*entries)))) {
+		log_err("rbtree_insert_many: malloc entries");
+		return -1;
+	}
+	for (size_t i = 0; i < n; ++i) {
+		entries[i].key = keys[i];
+		entries[i].value = vals ? vals[i] : NULL;
+	}
+	if (!sort_entries(tree, entries, n)) {
+		if (n < tree->count / REBUILD_RATIO)
+			ret_val = insert_sorted(tree, entries, n);
+		else
+			ret_val = merge_rebuild(tree, entries, n);
+	}
+
+	free(entries);
+	return ret_val;
+}
+
+/* stable bottom-up merge sort, so equal keys keep their batch order */
+static int sort_entries(struct rbtree *tree, struct rbentry *entries, size_t n)
+{
+	struct rbentry *buf;
+	struct rbentry *src = entries;
+	struct rbentry *dst;
+	struct rbentry *tmp;
+	size_t mid;
+	size_t hi;
+	size_t i;
+	size_t j;
+	size_t k;
+
+	if (!(buf = malloc(n * sizeof(*buf)))) {
+		log_err("sort_entries: malloc");
+		return -1;
+	}
+	dst = buf;
+
+	for (size_t width = 1; width < n; width *= 2) {
+		for (size_t lo = 0; lo < n; lo += 2 * width) {
+			mid = lo + width < n ? lo + width : n;
+			hi = lo + 2 * width < n ? lo + 2 * width : n;
+			for (i = lo, j = mid, k = lo; k < hi; ++k) {
+				if (i < mid && (j == hi || tree->cmp_func(src[i].key, src[j].key) <= 0))
+					dst[k] = src[i++];
+				else
+					dst[k] = src[j++];
+			}
+		}
+		tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+	if (src != entries) {
+		for (i = 0; i < n; ++i)
+			entries[i] = src[i];
+	}
+
+	free(buf);
+	return 0;
+}
+
+/* collapses runs of equal keys the way repeated rbtree_insert would */
+static size_t fold_duplicates(struct rbtree *tree, struct rbentry *entries, size_t n)
+{
+	size_t out = 0;
+
+	for (size_t i = 1; i < n; ++i) {
+		if (tree->cmp_func(entries[out].key, entries[i].key)) {
+			entries[++out] = entries[i];
+			continue;
+		}
+		if (tree->val_dst_func)
+			tree->val_dst_func(entries[out].value);
+		entries[out].value = entries[i].value;
+		if (tree->key_dst_func)
+			tree->key_dst_func(entries[i].key);
+	}
+
+	return n ? out + 1 : 0;
+}
+
+/*
+ * Inserts the sorted batch entry by entry. A node per entry is taken up
+ * front, before fold_duplicates runs the first destructor; those left
+ * over once duplicates and existing keys are accounted for go back.
+ */
+static int insert_sorted(struct rbtree *tree, struct rbentry *entries, size_t n)
+{
+	struct rbnode *spare = NULL;
+	struct rbnode *parent;
+	struct rbnode *node;
+	int ret_val = -1;
+	int res;
+
+	for (size_t i = 0; i < n; ++i) {
+		if (!(node = node_alloc(tree)))
+			goto out;
+		node->left = spare;
+		spare = node;
+	}
+
+	n = fold_duplicates(tree, entries, n);
+	for (size_t i = 0; i < n; ++i) {
+		if ((node = descend(tree, entries[i].key, &parent, &res))) {
+			update(tree, node, entries[i].key, entries[i].value, 0);
+		} else {
+			node = spare;
+			spare = node->left;
+			attach(tree, parent, node_init(tree, node, entries[i].key, entries[i].value), res);
+		}
+	}
+	ret_val = 0;
+
+out:
+	while ((node = spare)) {
+		spare = node->left;
+		node_release(tree, node);
+	}
+	return ret_val;
+}
+
+/*
+ * Merges the tree's entries with the sorted batch and rebuilds. Room for
+ * every entry is allocated before duplicates are folded, so on failure
+ * the tree and the batch are as they were.
+ */
+static int merge_rebuild(struct rbtree *tree, struct rbentry *entries, size_t n)
+{
+	struct rbcursor cursor;
+	struct rbslab *slab;
+	DestroyFunc key_dst_func = tree->key_dst_func;
+	DestroyFunc val_dst_func = tree->val_dst_func;
+	size_t total = tree->count + n;
+	void **keys;
+	void **vals;
+	size_t i = 0;
+	size_t k = 0;
+	int res;
+
+	keys = malloc(total * sizeof(*keys));
+	vals = malloc(total * sizeof(*vals));
+	slab = slab_new(total);
+	if (!keys || !vals || !slab) {
+		log_err("merge_rebuild: malloc");
+		free(keys);
+		free(vals);
+		free(slab);
+		return -1;
+	}
+
+	n = fold_duplicates(tree, entries, n);
+	rbtree_first(tree, &cursor);
+	while (cursor.node || i < n) {
+		if (!cursor.node)
+			res = 1;
+		else if (i == n)
+			res = -1;
+		else
+			res = tree->cmp_func(rbcursor_key(&cursor), entries[i].key);
+
+		if (res < 0) {
+			keys[k] = rbcursor_key(&cursor);
+			vals[k++] = rbcursor_value(&cursor);
+			rbcursor_next(&cursor);
+		} else if (res > 0) {
+			keys[k] = entries[i].key;
+			vals[k++] = entries[i++].value;
+		} else {
+			/* the tree keeps its key and takes the batch's value */
+			if (val_dst_func)
+				val_dst_func(rbcursor_value(&cursor));
+			if (key_dst_func)
+				key_dst_func(entries[i].key);
+			keys[k] = rbcursor_key(&cursor);
+			vals[k++] = entries[i++].value;
+			rbcursor_next(&cursor);
+		}
+	}
+
+	/* the old nodes go, their entries live on in keys/vals */
+	tree->key_dst_func = tree->val_dst_func = NULL;
+	rbtree_clear(tree);
+	tree->key_dst_func = key_dst_func;
+	tree->val_dst_func = val_dst_func;
+	build(tree, slab, keys, vals, k);
+
+	free(keys);
+	free(vals);
+	return 0;
+}
+
+/*
+ * The cursor functions return 0 when the cursor ends up on an entry and
+ * -1 when it runs off the end (cursor->node is then NULL).
+ */
+int rbtree_first(struct rbtree *tree, struct rbcursor *cursor)
+{
+	struct rbnode *curr;
+
+	if (!tree || !cursor) {
+		log_err("rbtree_first: null tree or cursor\n");
+		return -1;
+	}
+
+	if ((curr = tree->root)) {
+		while (curr->left)
+			curr = curr->left;
+	}
+	cursor->tree = tree;
+	cursor->node = curr;
+
+	return curr ? 0 : -1;
+}
+
+int rbtree_last(struct rbtree *tree, struct rbcursor *cursor)
+{
+	struct rbnode *curr;
+
+	if (!tree || !cursor) {
+		log_err("rbtree_last: null tree or cursor\n");
+		return -1;
+	}
+
+	curr = tree->rightmost;
+	cursor->tree = tree;
+	cursor->node = curr;
+
+	return curr ? 0 : -1;
+}
+
+/* first entry whose key is >= key */
+int rbtree_lower_bound(struct rbtree *tree, const void *key, struct rbcursor *cursor)
+{
+	return bound(tree, key, cursor, 0);
+}
+
+/* first entry whose key is > key */
+int rbtree_upper_bound(struct rbtree *tree, const void *key, struct rbcursor *cursor)
+{
+	return bound(tree, key, cursor, 1);
+}
+
+static int bound(struct rbtree *tree, const void *key, struct rbcursor *cursor, int upper)
+{
+	struct rbnode *curr;
+	struct rbnode *found = NULL;
+	int res;
+
+	if (!tree || !cursor) {
+		log_err("bound: null tree or cursor\n");
+		return -1;
+	}
+
+	for (curr = tree->root; curr; ) {
+		res = tree->cmp_func(key, curr->key);
+		if (res < 0 || (!res && !upper)) {
+			found = curr;
+			curr = curr->left;
+		} else {
+			curr = curr->right;
+		}
+	}
+	cursor->tree = tree;
+	cursor->node = found;
+
+	return found ? 0 : -1;
+}
+
+/* in-order neighbours: amortized O(1) over a full walk */
+static struct rbnode *successor(struct rbnode *curr)
+{
+	struct rbnode *parent;
+
+	if (curr->right) {
+		for (curr = curr->right; curr->left; curr = curr->left)
+			;
+		return curr;
+	}
+	while ((parent = rb_parent(curr)) && curr == parent->right)
+		curr = parent;
+
+	return parent;
+}
+
+static struct rbnode *predecessor(struct rbnode *curr)
+{
+	struct rbnode *parent;
+
+	if (curr->left) {
+		for (curr = curr->left; curr->right; curr = curr->right)
+			;
+		return curr;
+	}
+	while ((parent = rb_parent(curr)) && curr == parent->left)
+		curr = parent;
+
+	return parent;
+}
+
+int rbcursor_next(struct rbcursor *cursor)
+{
+	if (!cursor || !cursor->node)
+		return -1;
+
+	return (cursor->node = successor(cursor->node)) ? 0 : -1;
+}
+
+int rbcursor_prev(struct rbcursor *cursor)
+{
+	if (!cursor || !cursor->node)
+		return -1;
+
+	return (cursor->node = predecessor(cursor->node)) ? 0 : -1;
+}
+
+/* node holding key, or NULL with *parent and *res telling where it would hang */
+static struct rbnode *descend(struct rbtree *tree, const void *key, struct rbnode **parent, int *res)
+{
+	struct rbnode *curr = tree->root;
+
+	*parent = NULL;
+	*res = 0;
+	while (curr) {
+		if (!(*res = tree->cmp_func(key, curr->key)))
+			return curr;
+		*parent = curr;
+		curr = *res < 0 ? curr->left : curr->right;
+	}
+
+	return NULL;
+}
+
+/* hangs a new node in the empty slot left (res < 0) or right of parent */
+static void attach(struct rbtree *tree, struct rbnode *parent, struct rbnode *node, int res)
+{
+	if (!parent) {
+		tree->root = tree->rightmost = node;
+	} else if (res < 0) {
+		parent->left = node;
+	} else {
+		parent->right = node;
+		if (parent == tree->rightmost)
+			tree->rightmost = node;
+	}
+	rb_set_parent(node, parent);
+	insert_cases(tree, node);
+}
+
+/*
+ * rbtree_insert that first tries the slot right after hint->node (or
+ * after the largest entry if the cursor is past the end). A key that
+ * lands there costs one or two comparisons instead of a descent, so
+ * ascending streams insert in amortized O(1) by passing the same cursor
+ * each time; anything else falls back to a full descent. The cursor is
+ * left on the key's entry either way.
+ */
+int rbtree_insert_hint(struct rbtree *tree, struct rbcursor *hint, void *key, void *value)
+{
+	struct rbnode *node = NULL;
+	struct rbnode *parent = NULL;
+	struct rbnode *succ;
+	struct rbnode *prev;
+	int res = 0;
+
+	if (!tree || !hint) {
+		log_err("rbtree_insert_hint: null tree or hint\n");
+		return -1;
+	}
+
+	if ((prev = hint->tree == tree && hint->node ? hint->node : tree->rightmost)) {
+		if ((res = tree->cmp_func(key, prev->key)) > 0) {
+			if (prev == tree->rightmost) {
+				parent = prev;
+			} else if (tree->cmp_func(key, (succ = successor(prev))->key) < 0) {
+				/* between prev and succ: one of them has the free slot */
+				if (!prev->right) {
+					parent = prev;
+				} else {
+					parent = succ;
+					res = -1;
+				}
+			}
+		} else if (!res) {
+			node = prev;
+		}
+	}
+	if (!parent && !node)
+		node = descend(tree, key, &parent, &res);
+
+	if (node) {
+		update(tree, node, key, value, 0);
+	} else {
+		if (!(node = node_new(tree, key, value)))
+			return -1;
+		attach(tree, parent, node, res);
+	}
+	hint->tree = tree;
+	hint->node = node;
+
+	return 0;
+}
+
+#ifdef RBTREE_ORDER_STATS
+static void adjust_sizes(struct rbnode *node, int delta)
+{
+	for (; node; node = rb_parent(node))
+		node->size += delta;
+}
+
+/* number of keys less than key */
+size_t rbtree_rank(struct rbtree *tree, const void *key)
+{
+	struct rbnode *curr;
+	size_t rank = 0;
+	int res;
+
+	if (!tree) {
+		log_err("rbtree_rank: null tree\n");
+		return 0;
+	}
+
+	for (curr = tree->root; curr; ) {
+		if ((res = tree->cmp_func(key, curr->key)) < 0) {
+			curr = curr->left;
+		} else {
+			rank += rb_size(curr->left);
+			if (!res)
+				break;
+			++rank;
+			curr = curr->right;
+		}
+	}
+
+	return rank;
+}
+
+/* the entry with rank keys before it; -1 if there are not that many */
+int rbtree_select(struct rbtree *tree, size_t rank, void **key, void **value)
+{
+	struct rbnode *curr;
+	size_t left;
+
+	if (!tree) {
+		log_err("rbtree_select: null tree\n");
+		return -1;
+	}
+
+	for (curr = tree->root; curr; ) {
+		if (rank < (left = rb_size(curr->left))) {
+			curr = curr->left;
+		} else if (rank == left) {
+			if (key)
+				*key = curr->key;
+			if (value)
+				*value = curr->value;
+			return 0;
+		} else {
+			rank -= left + 1;
+			curr = curr->right;
+		}
+	}
+
+	return -1;
+}
+
+/* number of keys in [lo, hi) */
+size_t rbtree_count_range(struct rbtree *tree, const void *lo, const void *hi)
+{
+	size_t below_lo;
+	size_t below_hi;
+
+	if (!tree) {
+		log_err("rbtree_count_range: null tree\n");
+		return 0;
+	}
+
+	below_lo = rbtree_rank(tree, lo);
+	below_hi = rbtree_rank(tree, hi);
+
+	return below_hi > below_lo ? below_hi - below_lo : 0;
+}
+#endif
+
 void rbtree_clear(struct rbtree *tree)
 {
 
 	if (tree) {
 		struct rbnode *curr;
 
-		if ((curr = tree->root)) {
+		if (tree->slab_nodes && !tree->key_dst_func && !tree->val_dst_func) {
+			/* nothing to release per node: drop whole slabs below */
+			tree->root = NULL;
+		} else if ((curr = tree->root)) {
 			DestroyFunc key_dst_func;
 			DestroyFunc val_dst_func;
 			key_dst_func = tree->key_dst_func;
@@ -687,7 +1543,7 @@ void rbtree_clear(struct rbtree *tree)
 				} else {
 					struct rbnode *parent;
 
-					if ((parent = curr->parent)) {
+					if ((parent = rb_parent(curr))) {
 						if (curr == parent->left)
 							parent->left = NULL;
 						else
@@ -700,13 +1556,18 @@ void rbtree_clear(struct rbtree *tree)
 						key_dst_func(curr->key);
 					if (val_dst_func)
 						val_dst_func(curr->value);
-					node_destroy(curr);
+					node_destroy(tree, curr);
 					curr = parent;
 				}
 			} while (curr);
-		} else {
-			log_err("rbtree_clear: null tree!");
 		}
+
+		if (tree->slab_nodes)
+			arena_free(tree);
+		tree->rightmost = NULL;
+		tree->count = 0;
+	} else {
+		log_err("rbtree_clear: null tree!");
 	}
 }
 
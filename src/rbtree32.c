@@ -0,0 +1,486 @@
+#include "rbtree32.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "logmsg.h"
+
+
+#define NIL		0
+#define INITIAL_CAPACITY	16
+/* color of a slot sitting on the free list */
+#define Free		2
+
+/* tree->nodes may move on insert, so only ever hold indices across one */
+#define N(i)		(tree->nodes[i])
+
+
+static int nodes_reset(struct rbtree32 *);
+static uint32_t node_new(struct rbtree32 *, void *, void *);
+static void node_destroy(struct rbtree32 *, uint32_t);
+static void rotate_left(struct rbtree32 *, uint32_t);
+static void rotate_right(struct rbtree32 *, uint32_t);
+static int insert(struct rbtree32 *, void *, void *, int);
+static void insert_fixup(struct rbtree32 *, uint32_t);
+static uint32_t search(struct rbtree32 *, const void *);
+static void transplant(struct rbtree32 *, uint32_t, uint32_t);
+static void remove_node(struct rbtree32 *, uint32_t);
+static void remove_fixup(struct rbtree32 *, uint32_t);
+static uint32_t minimum(struct rbtree32 *, uint32_t);
+
+
+
+int rbtree32_init(struct rbtree32 *tree, CompareFunc cmp, DestroyFunc key_dst, DestroyFunc val_dst)
+{
+	int ret_val = -1;
+
+	if (tree) {
+		if (cmp) {
+			tree->count = 0;
+			tree->root = NIL;
+			tree->free_head = NIL;
+			tree->cmp_func = cmp;
+			tree->key_dst_func = key_dst;
+			tree->val_dst_func = val_dst;
+			ret_val = nodes_reset(tree);
+		} else {
+			log_err("null compare func\n");
+		}
+	} else {
+		log_err("null tree pointer\n");
+	}
+
+	return ret_val;
+}
+
+/* a fresh array holding only the nil sentinel */
+static int nodes_reset(struct rbtree32 *tree)
+{
+	if (!(tree->nodes = malloc(INITIAL_CAPACITY * sizeof(*tree->nodes)))) {
+		log_err("rbtree32: malloc nodes");
+		tree->capacity = 0;
+		return -1;
+	}
+	tree->capacity = INITIAL_CAPACITY;
+	tree->used = 1;
+	N(NIL).parent = N(NIL).left = N(NIL).right = NIL;
+	N(NIL).color = Black;
+	N(NIL).key = N(NIL).value = NULL;
+
+	return 0;
+}
+
+/* returns NIL if the array cannot grow; a destroyed tree gets a new one */
+static uint32_t node_new(struct rbtree32 *tree, void *key, void *value)
+{
+	struct rb32node *nodes;
+	uint32_t index;
+
+	if (!tree->nodes && nodes_reset(tree))
+		return NIL;
+	if ((index = tree->free_head)) {
+		tree->free_head = N(index).left;
+	} else {
+		if (tree->used == tree->capacity) {
+			if (tree->capacity > UINT32_MAX / 2) {
+				log_err("node_new: index space exhausted\n");
+				return NIL;
+			}
+			if (!(nodes = realloc(tree->nodes, 2 * (size_t)tree->capacity * sizeof(*nodes)))) {
+				log_err("node_new: realloc nodes");
+				return NIL;
+			}
+			tree->nodes = nodes;
+			tree->capacity *= 2;
+		}
+		index = tree->used++;
+	}
+
+	N(index).parent = N(index).left = N(index).right = NIL;
+	N(index).color = Red;
+	N(index).key = key;
+	N(index).value = value;
+	++tree->count;
+
+	return index;
+}
+
+static void node_destroy(struct rbtree32 *tree, uint32_t index)
+{
+	N(index).color = Free;
+	N(index).key = N(index).value = NULL;
+	N(index).left = tree->free_head;
+	tree->free_head = index;
+	--tree->count;
+}
+
+static void rotate_left(struct rbtree32 *tree, uint32_t x)
+{
+	uint32_t y = N(x).right;
+
+	N(x).right = N(y).left;
+	if (N(y).left != NIL)
+		N(N(y).left).parent = x;
+	N(y).parent = N(x).parent;
+	if (N(x).parent == NIL)
+		tree->root = y;
+	else if (x == N(N(x).parent).left)
+		N(N(x).parent).left = y;
+	else
+		N(N(x).parent).right = y;
+	N(y).left = x;
+	N(x).parent = y;
+}
+
+static void rotate_right(struct rbtree32 *tree, uint32_t x)
+{
+	uint32_t y = N(x).left;
+
+	N(x).left = N(y).right;
+	if (N(y).right != NIL)
+		N(N(y).right).parent = x;
+	N(y).parent = N(x).parent;
+	if (N(x).parent == NIL)
+		tree->root = y;
+	else if (x == N(N(x).parent).right)
+		N(N(x).parent).right = y;
+	else
+		N(N(x).parent).left = y;
+	N(y).right = x;
+	N(x).parent = y;
+}
+
+int rbtree32_insert(struct rbtree32 *tree, void *key, void *value)
+{
+	int ret_val = -1;
+
+	if (tree) {
+		ret_val = insert(tree, key, value, 0);
+	} else {
+		log_err("rbtree32_insert: null tree\n");
+	}
+
+	return ret_val;
+}
+
+int rbtree32_replace(struct rbtree32 *tree, void *key, void *value)
+{
+	int ret_val = -1;
+
+	if (tree) {
+		ret_val = insert(tree, key, value, 1);
+	} else {
+		log_err("rbtree32_replace: null tree\n");
+	}
+
+	return ret_val;
+}
+
+static int insert(struct rbtree32 *tree, void *key, void *value, int replace)
+{
+	CompareFunc cmp_func = tree->cmp_func;
+	uint32_t parent = NIL;
+	uint32_t curr = tree->root;
+	uint32_t new;
+	int res = 0;
+
+	while (curr != NIL) {
+		if (!(res = cmp_func(key, N(curr).key))) {
+			if (tree->val_dst_func)
+				tree->val_dst_func(N(curr).value);
+			N(curr).value = value;
+
+			if (replace) {
+				if (tree->key_dst_func)
+					tree->key_dst_func(N(curr).key);
+				N(curr).key = key;
+			} else {
+				if (tree->key_dst_func)
+					tree->key_dst_func(key);
+			}
+			return 0;
+		}
+		parent = curr;
+		curr = res < 0 ? N(curr).left : N(curr).right;
+	}
+
+	if (!(new = node_new(tree, key, value)))
+		return -1;
+
+	N(new).parent = parent;
+	if (parent == NIL)
+		tree->root = new;
+	else if (res < 0)
+		N(parent).left = new;
+	else
+		N(parent).right = new;
+	insert_fixup(tree, new);
+
+	return 0;
+}
+
+static void insert_fixup(struct rbtree32 *tree, uint32_t z)
+{
+	uint32_t uncle;
+
+	while (Red == N(N(z).parent).color) {
+		uint32_t parent = N(z).parent;
+		uint32_t granpa = N(parent).parent;
+
+		if (parent == N(granpa).left) {
+			uncle = N(granpa).right;
+			if (Red == N(uncle).color) {
+				N(parent).color = Black;
+				N(uncle).color = Black;
+				N(granpa).color = Red;
+				z = granpa;
+				continue;
+			}
+			if (z == N(parent).right) {
+				z = parent;
+				rotate_left(tree, z);
+			}
+			N(N(z).parent).color = Black;
+			N(granpa).color = Red;
+			rotate_right(tree, granpa);
+		} else {
+			uncle = N(granpa).left;
+			if (Red == N(uncle).color) {
+				N(parent).color = Black;
+				N(uncle).color = Black;
+				N(granpa).color = Red;
+				z = granpa;
+				continue;
+			}
+			if (z == N(parent).left) {
+				z = parent;
+				rotate_right(tree, z);
+			}
+			N(N(z).parent).color = Black;
+			N(granpa).color = Red;
+			rotate_left(tree, granpa);
+		}
+	}
+	N(tree->root).color = Black;
+}
+
+void *rbtree32_search(struct rbtree32 *tree, const void *key)
+{
+	void *value = NULL;
+	uint32_t found;
+
+	if (tree) {
+		if ((found = search(tree, key)))
+			value = N(found).value;
+	} else {
+		log_err("rbtree32_search: tree is null\n");
+	}
+
+	return value;
+}
+
+static uint32_t search(struct rbtree32 *tree, const void *key)
+{
+	CompareFunc cmp_func = tree->cmp_func;
+	uint32_t curr = tree->root;
+	int res;
+
+	while (curr != NIL && (res = cmp_func(key, N(curr).key)))
+		curr = res < 0 ? N(curr).left : N(curr).right;
+
+	return curr;
+}
+
+int rbtree32_remove(struct rbtree32 *tree, const void *key)
+{
+	int ret_val = -1;
+	uint32_t found;
+
+	if (tree) {
+		ret_val = 0;
+		if ((found = search(tree, key)))
+			remove_node(tree, found);
+	} else {
+		log_err("rbtree32_remove: tree is null\n");
+	}
+
+	return ret_val;
+}
+
+static void transplant(struct rbtree32 *tree, uint32_t u, uint32_t v)
+{
+	if (N(u).parent == NIL)
+		tree->root = v;
+	else if (u == N(N(u).parent).left)
+		N(N(u).parent).left = v;
+	else
+		N(N(u).parent).right = v;
+	/* may write the sentinel's parent; remove_fixup relies on it */
+	N(v).parent = N(u).parent;
+}
+
+static void remove_node(struct rbtree32 *tree, uint32_t z)
+{
+	uint32_t y = z;
+	uint32_t x;
+	uint32_t y_color = N(y).color;
+
+	if (N(z).left == NIL) {
+		x = N(z).right;
+		transplant(tree, z, x);
+	} else if (N(z).right == NIL) {
+		x = N(z).left;
+		transplant(tree, z, x);
+	} else {
+		y = minimum(tree, N(z).right);
+		y_color = N(y).color;
+		x = N(y).right;
+		if (N(y).parent == z) {
+			N(x).parent = y;
+		} else {
+			transplant(tree, y, x);
+			N(y).right = N(z).right;
+			N(N(y).right).parent = y;
+		}
+		transplant(tree, z, y);
+		N(y).left = N(z).left;
+		N(N(y).left).parent = y;
+		N(y).color = N(z).color;
+	}
+
+	if (Black == y_color)
+		remove_fixup(tree, x);
+	N(NIL).parent = NIL;
+
+	if (tree->key_dst_func)
+		tree->key_dst_func(N(z).key);
+	if (tree->val_dst_func)
+		tree->val_dst_func(N(z).value);
+	node_destroy(tree, z);
+}
+
+static void remove_fixup(struct rbtree32 *tree, uint32_t x)
+{
+	uint32_t w;
+
+	while (x != tree->root && Black == N(x).color) {
+		uint32_t parent = N(x).parent;
+
+		if (x == N(parent).left) {
+			w = N(parent).right;
+			if (Red == N(w).color) {
+				N(w).color = Black;
+				N(parent).color = Red;
+				rotate_left(tree, parent);
+				w = N(parent).right;
+			}
+			if (Black == N(N(w).left).color && Black == N(N(w).right).color) {
+				N(w).color = Red;
+				x = parent;
+				continue;
+			}
+			if (Black == N(N(w).right).color) {
+				N(N(w).left).color = Black;
+				N(w).color = Red;
+				rotate_right(tree, w);
+				w = N(parent).right;
+			}
+			N(w).color = N(parent).color;
+			N(parent).color = Black;
+			N(N(w).right).color = Black;
+			rotate_left(tree, parent);
+		} else {
+			w = N(parent).left;
+			if (Red == N(w).color) {
+				N(w).color = Black;
+				N(parent).color = Red;
+				rotate_right(tree, parent);
+				w = N(parent).left;
+			}
+			if (Black == N(N(w).left).color && Black == N(N(w).right).color) {
+				N(w).color = Red;
+				x = parent;
+				continue;
+			}
+			if (Black == N(N(w).left).color) {
+				N(N(w).right).color = Black;
+				N(w).color = Red;
+				rotate_left(tree, w);
+				w = N(parent).left;
+			}
+			N(w).color = N(parent).color;
+			N(parent).color = Black;
+			N(N(w).left).color = Black;
+			rotate_right(tree, parent);
+		}
+		x = tree->root;
+	}
+	N(x).color = Black;
+}
+
+static uint32_t minimum(struct rbtree32 *tree, uint32_t x)
+{
+	while (N(x).left != NIL)
+		x = N(x).left;
+	return x;
+}
+
+void rbtree32_foreach(struct rbtree32 *tree, TraverseFunc trav_func, void *data)
+{
+	uint32_t curr;
+	uint32_t parent;
+
+	if (!tree) {
+		log_err("rbtree32_foreach: null tree\n");
+		return;
+	}
+
+	for (curr = tree->root != NIL ? minimum(tree, tree->root) : NIL; curr != NIL; ) {
+		if (trav_func(N(curr).key, N(curr).value, data))
+			break;
+
+		/* in-order successor */
+		if (N(curr).right != NIL) {
+			curr = minimum(tree, N(curr).right);
+		} else {
+			while ((parent = N(curr).parent) != NIL && curr == N(parent).right)
+				curr = parent;
+			curr = parent;
+		}
+	}
+}
+
+void rbtree32_clear(struct rbtree32 *tree)
+{
+	if (!tree)
+		return;
+
+	/* a linear sweep of the array, no tree walk needed */
+	if (tree->key_dst_func || tree->val_dst_func) {
+		for (uint32_t i = 1; i < tree->used; ++i) {
+			if (Free == N(i).color)
+				continue;
+			if (tree->key_dst_func)
+				tree->key_dst_func(N(i).key);
+			if (tree->val_dst_func)
+				tree->val_dst_func(N(i).value);
+		}
+	}
+
+	tree->used = 1;
+	tree->count = 0;
+	tree->root = NIL;
+	tree->free_head = NIL;
+}
+
+/* the tree stays usable as if just initialised; the next insert reallocates */
+void rbtree32_destroy(struct rbtree32 *tree)
+{
+	if (tree) {
+		rbtree32_clear(tree);
+		free(tree->nodes);
+		tree->nodes = NULL;
+		tree->capacity = 0;
+	}
+}
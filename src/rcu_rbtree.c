@@ -0,0 +1,632 @@
+#include "rcu_rbtree.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lock.h"
+#include "logmsg.h"
+
+
+/*
+ * The update algorithms are the functional red-black insert and delete
+ * (Okasaki's balancing, Kahrs' deletion, in the verified formulation of
+ * Nipkow's "Functional Algorithms, Verified!"). Every rebuilt node is a
+ * fresh copy; the node it replaces is consumed: nodes created by this
+ * very update were never published and go straight back to the spare
+ * pool, published ones go in the update's batch to wait for a grace
+ * period.
+ */
+
+/* upper bound on nodes one update creates per level of the old tree */
+#define NODES_PER_LEVEL	8
+
+#define is_red(n)	((n) && ((n)->stamp & 1))
+#define is_black(n)	((n) && !((n)->stamp & 1))
+#define is_fresh(t, n)	(((n)->stamp >> 1) == (t)->gen)
+
+
+/* what one update retires: replaced nodes plus at most one dropped entry */
+struct rcu_batch {
+	struct epoch_entry entry;
+	DestroyFunc key_dst_func;
+	DestroyFunc val_dst_func;
+	void *key;
+	void *value;
+	size_t count;
+	struct rcu_rbnode *nodes[];
+};
+
+
+static int reserve(struct rcu_rbtree *);
+static struct rcu_rbnode *mk(struct rcu_rbtree *, enum color, struct rcu_rbnode *, void *, void *,
+		struct rcu_rbnode *);
+static void consume(struct rcu_rbtree *, struct rcu_rbnode *);
+static struct rcu_rbnode *paint(struct rcu_rbtree *, enum color, struct rcu_rbnode *);
+static struct rcu_rbnode *bal_left(struct rcu_rbtree *, struct rcu_rbnode *, void *, void *,
+		struct rcu_rbnode *);
+static struct rcu_rbnode *bal_right(struct rcu_rbtree *, struct rcu_rbnode *, void *, void *,
+		struct rcu_rbnode *);
+static struct rcu_rbnode *bal_del_left(struct rcu_rbtree *, struct rcu_rbnode *, void *, void *,
+		struct rcu_rbnode *);
+static struct rcu_rbnode *bal_del_right(struct rcu_rbtree *, struct rcu_rbnode *, void *, void *,
+		struct rcu_rbnode *);
+static struct rcu_rbnode *join(struct rcu_rbtree *, struct rcu_rbnode *, struct rcu_rbnode *);
+static struct rcu_rbnode *ins(struct rcu_rbtree *, struct rcu_rbnode *, void *, void *, int,
+		struct rcu_batch *);
+static struct rcu_rbnode *del(struct rcu_rbtree *, struct rcu_rbnode *, const void *,
+		struct rcu_batch *);
+static struct rcu_rbnode *lookup(struct rcu_rbtree *, struct rcu_rbnode *, const void *);
+static int insert(struct rcu_rbtree *, void *, void *, int);
+static void publish(struct rcu_rbtree *, struct rcu_rbnode *, struct rcu_batch *);
+static void batch_free(struct epoch_entry *);
+static int inorder(struct rcu_rbnode *, TraverseFunc, void *);
+static void tree_free(struct rcu_rbtree *, struct rcu_rbnode *);
+
+
+
+int rcu_rbtree_init(struct rcu_rbtree *tree, CompareFunc cmp, DestroyFunc key_dst, DestroyFunc val_dst)
+{
+	int ret_val = -1;
+
+	if (tree) {
+		if (cmp) {
+			tree->root = NULL;
+			tree->cmp_func = cmp;
+			tree->key_dst_func = key_dst;
+			tree->val_dst_func = val_dst;
+			tree->lock = 0;
+			tree->count = 0;
+			tree->gen = 1;
+			tree->spare = NULL;
+			tree->spare_count = 0;
+			tree->batch = NULL;
+			tree->batch_capacity = 0;
+			ret_val = 0;
+		} else {
+			log_err("null compare func\n");
+		}
+	} else {
+		log_err("null tree pointer\n");
+	}
+
+	return ret_val;
+}
+
+/*
+ * Tops up the spare pool and the retire batch for one update, so that
+ * nothing can fail once it starts building a version. The height is at
+ * most twice the black height, which the leftmost path gives.
+ */
+static int reserve(struct rcu_rbtree *tree)
+{
+	struct rcu_rbnode *node;
+	struct rcu_batch *batch;
+	size_t levels = 2;
+	size_t need;
+
+	for (node = tree->root; node; node = node->left)
+		levels += 2 * is_black(node);
+	need = NODES_PER_LEVEL * levels;
+
+	while (tree->spare_count < need) {
+		if (!(node = malloc(sizeof(*node)))) {
+			log_err("reserve: malloc node");
+			return -1;
+		}
+		node->left = tree->spare;
+		tree->spare = node;
+		++tree->spare_count;
+	}
+	if (!tree->batch || tree->batch_capacity < need) {
+		if (!(batch = realloc(tree->batch, sizeof(*batch) + need * sizeof(batch->nodes[0])))) {
+			log_err("reserve: realloc batch");
+			return -1;
+		}
+		batch->count = 0;
+		tree->batch = batch;
+		tree->batch_capacity = need;
+	}
+
+	return 0;
+}
+
+static struct rcu_rbnode *mk(struct rcu_rbtree *tree, enum color color, struct rcu_rbnode *left,
+		void *key, void *value, struct rcu_rbnode *right)
+{
+	struct rcu_rbnode *node;
+
+	if (!(node = tree->spare)) {
+		/* reserve() sized the pool for the worst case */
+		log_err("mk: spare pool exhausted\n");
+		abort();
+	}
+	tree->spare = node->left;
+	--tree->spare_count;
+
+	node->left = left;
+	node->right = right;
+	node->key = key;
+	node->value = value;
+	node->stamp = tree->gen << 1 | color;
+
+	return node;
+}
+
+/* call only once everything needed from node has been read */
+static void consume(struct rcu_rbtree *tree, struct rcu_rbnode *node)
+{
+	if (is_fresh(tree, node)) {
+		node->left = tree->spare;
+		tree->spare = node;
+		++tree->spare_count;
+	} else if (tree->batch->count < tree->batch_capacity) {
+		tree->batch->nodes[tree->batch->count++] = node;
+	} else {
+		log_err("consume: retire batch exhausted\n");
+		abort();
+	}
+}
+
+static struct rcu_rbnode *paint(struct rcu_rbtree *tree, enum color color, struct rcu_rbnode *node)
+{
+	struct rcu_rbnode *copy;
+
+	if (!node || (enum color)(node->stamp & 1) == color)
+		return node;
+	if (is_fresh(tree, node)) {
+		node->stamp = tree->gen << 1 | color;
+		return node;
+	}
+	copy = mk(tree, color, node->left, node->key, node->value, node->right);
+	consume(tree, node);
+
+	return copy;
+}
+
+/* B l (key, value) r, with a red-red violation in l lifted out */
+static struct rcu_rbnode *bal_left(struct rcu_rbtree *tree, struct rcu_rbnode *l, void *key,
+		void *value, struct rcu_rbnode *r)
+{
+	struct rcu_rbnode *res;
+	struct rcu_rbnode *ll;
+	struct rcu_rbnode *lr;
+
+	if (is_red(l) && is_red(ll = l->left)) {
+		res = mk(tree, Red, mk(tree, Black, ll->left, ll->key, ll->value, ll->right),
+				l->key, l->value, mk(tree, Black, l->right, key, value, r));
+		consume(tree, ll);
+		consume(tree, l);
+	} else if (is_red(l) && is_red(lr = l->right)) {
+		res = mk(tree, Red, mk(tree, Black, l->left, l->key, l->value, lr->left),
+				lr->key, lr->value, mk(tree, Black, lr->right, key, value, r));
+		consume(tree, lr);
+		consume(tree, l);
+	} else {
+		res = mk(tree, Black, l, key, value, r);
+	}
+
+	return res;
+}
+
+static struct rcu_rbnode *bal_right(struct rcu_rbtree *tree, struct rcu_rbnode *l, void *key,
+		void *value, struct rcu_rbnode *r)
+{
+	struct rcu_rbnode *res;
+	struct rcu_rbnode *rl;
+	struct rcu_rbnode *rr;
+
+	if (is_red(r) && is_red(rr = r->right)) {
+		res = mk(tree, Red, mk(tree, Black, l, key, value, r->left),
+				r->key, r->value, mk(tree, Black, rr->left, rr->key, rr->value, rr->right));
+		consume(tree, rr);
+		consume(tree, r);
+	} else if (is_red(r) && is_red(rl = r->left)) {
+		res = mk(tree, Red, mk(tree, Black, l, key, value, rl->left),
+				rl->key, rl->value, mk(tree, Black, rl->right, r->key, r->value, r->right));
+		consume(tree, rl);
+		consume(tree, r);
+	} else {
+		res = mk(tree, Black, l, key, value, r);
+	}
+
+	return res;
+}
+
+/* rebuild after l lost one black level */
+static struct rcu_rbnode *bal_del_left(struct rcu_rbtree *tree, struct rcu_rbnode *l, void *key,
+		void *value, struct rcu_rbnode *r)
+{
+	struct rcu_rbnode *res;
+	struct rcu_rbnode *rl;
+	struct rcu_rbnode *inner;
+
+	if (is_red(l))
+		return mk(tree, Red, paint(tree, Black, l), key, value, r);
+	if (is_black(r))
+		return bal_right(tree, l, key, value, paint(tree, Red, r));
+	if (is_red(r) && is_black(rl = r->left)) {
+		inner = bal_right(tree, rl->right, r->key, r->value, paint(tree, Red, r->right));
+		res = mk(tree, Red, mk(tree, Black, l, key, value, rl->left), rl->key, rl->value, inner);
+		consume(tree, rl);
+		consume(tree, r);
+		return res;
+	}
+
+	return mk(tree, Red, l, key, value, r);
+}
+
+/* rebuild after r lost one black level */
+static struct rcu_rbnode *bal_del_right(struct rcu_rbtree *tree, struct rcu_rbnode *l, void *key,
+		void *value, struct rcu_rbnode *r)
+{
+	struct rcu_rbnode *res;
+	struct rcu_rbnode *lr;
+	struct rcu_rbnode *inner;
+
+	if (is_red(r))
+		return mk(tree, Red, l, key, value, paint(tree, Black, r));
+	if (is_black(l))
+		return bal_left(tree, paint(tree, Red, l), key, value, r);
+	if (is_red(l) && is_black(lr = l->right)) {
+		inner = bal_left(tree, paint(tree, Red, l->left), l->key, l->value, lr->left);
+		res = mk(tree, Red, inner, lr->key, lr->value, mk(tree, Black, lr->right, key, value, r));
+		consume(tree, lr);
+		consume(tree, l);
+		return res;
+	}
+
+	return mk(tree, Red, l, key, value, r);
+}
+
+/* l and r side by side, every key of l below every key of r */
+static struct rcu_rbnode *join(struct rcu_rbtree *tree, struct rcu_rbnode *l, struct rcu_rbnode *r)
+{
+	struct rcu_rbnode *res;
+	struct rcu_rbnode *mid;
+
+	if (!l)
+		return r;
+	if (!r)
+		return l;
+
+	if (is_red(l) && is_red(r)) {
+		mid = join(tree, l->right, r->left);
+		if (is_red(mid)) {
+			res = mk(tree, Red, mk(tree, Red, l->left, l->key, l->value, mid->left),
+					mid->key, mid->value, mk(tree, Red, mid->right, r->key, r->value, r->right));
+			consume(tree, mid);
+		} else {
+			res = mk(tree, Red, l->left, l->key, l->value,
+					mk(tree, Red, mid, r->key, r->value, r->right));
+		}
+		consume(tree, l);
+		consume(tree, r);
+	} else if (is_black(l) && is_black(r)) {
+		mid = join(tree, l->right, r->left);
+		if (is_red(mid)) {
+			res = mk(tree, Red, mk(tree, Black, l->left, l->key, l->value, mid->left),
+					mid->key, mid->value, mk(tree, Black, mid->right, r->key, r->value, r->right));
+			consume(tree, mid);
+		} else {
+			res = bal_del_left(tree, l->left, l->key, l->value,
+					mk(tree, Black, mid, r->key, r->value, r->right));
+		}
+		consume(tree, l);
+		consume(tree, r);
+	} else if (is_red(r)) {
+		res = mk(tree, Red, join(tree, l, r->left), r->key, r->value, r->right);
+		consume(tree, r);
+	} else {
+		res = mk(tree, Red, l->left, l->key, l->value, join(tree, l->right, r));
+		consume(tree, l);
+	}
+
+	return res;
+}
+
+/* node is published, so it is read in full before being consumed */
+static struct rcu_rbnode *ins(struct rcu_rbtree *tree, struct rcu_rbnode *node, void *key,
+		void *value, int replace, struct rcu_batch *dropped)
+{
+	struct rcu_rbnode *res;
+	int cmp;
+
+	if (!node) {
+		++tree->count;
+		return mk(tree, Red, NULL, key, value, NULL);
+	}
+
+	if ((cmp = tree->cmp_func(key, node->key)) < 0) {
+		if (is_black(node))
+			res = bal_left(tree, ins(tree, node->left, key, value, replace, dropped),
+					node->key, node->value, node->right);
+		else
+			res = mk(tree, Red, ins(tree, node->left, key, value, replace, dropped),
+					node->key, node->value, node->right);
+	} else if (cmp > 0) {
+		if (is_black(node))
+			res = bal_right(tree, node->left, node->key, node->value,
+					ins(tree, node->right, key, value, replace, dropped));
+		else
+			res = mk(tree, Red, node->left, node->key, node->value,
+					ins(tree, node->right, key, value, replace, dropped));
+	} else {
+		/* readers may still hold the old value (and key): drop them later */
+		dropped->val_dst_func = tree->val_dst_func;
+		dropped->value = node->value;
+		if (replace) {
+			dropped->key_dst_func = tree->key_dst_func;
+			dropped->key = node->key;
+		} else {
+			if (tree->key_dst_func)
+				tree->key_dst_func(key);
+			key = node->key;
+		}
+		res = mk(tree, (enum color)(node->stamp & 1), node->left, key, value, node->right);
+	}
+	consume(tree, node);
+
+	return res;
+}
+
+/* key must be present */
+static struct rcu_rbnode *del(struct rcu_rbtree *tree, struct rcu_rbnode *node, const void *key,
+		struct rcu_batch *dropped)
+{
+	struct rcu_rbnode *res;
+	int cmp;
+
+	if ((cmp = tree->cmp_func(key, node->key)) < 0) {
+		if (is_black(node->left))
+			res = bal_del_left(tree, del(tree, node->left, key, dropped),
+					node->key, node->value, node->right);
+		else
+			res = mk(tree, Red, del(tree, node->left, key, dropped),
+					node->key, node->value, node->right);
+	} else if (cmp > 0) {
+		if (is_black(node->right))
+			res = bal_del_right(tree, node->left, node->key, node->value,
+					del(tree, node->right, key, dropped));
+		else
+			res = mk(tree, Red, node->left, node->key, node->value,
+					del(tree, node->right, key, dropped));
+	} else {
+		dropped->key_dst_func = tree->key_dst_func;
+		dropped->key = node->key;
+		dropped->val_dst_func = tree->val_dst_func;
+		dropped->value = node->value;
+		--tree->count;
+		res = join(tree, node->left, node->right);
+	}
+	consume(tree, node);
+
+	return res;
+}
+
+static struct rcu_rbnode *lookup(struct rcu_rbtree *tree, struct rcu_rbnode *node, const void *key)
+{
+	int cmp;
+
+	while (node && (cmp = tree->cmp_func(key, node->key)))
+		node = cmp < 0 ? node->left : node->right;
+
+	return node;
+}
+
+int rcu_rbtree_insert(struct rcu_rbtree *tree, void *key, void *value)
+{
+	int ret_val = -1;
+
+	if (tree) {
+		ret_val = insert(tree, key, value, 0);
+	} else {
+		log_err("rcu_rbtree_insert: null tree\n");
+	}
+
+	return ret_val;
+}
+
+int rcu_rbtree_replace(struct rcu_rbtree *tree, void *key, void *value)
+{
+	int ret_val = -1;
+
+	if (tree) {
+		ret_val = insert(tree, key, value, 1);
+	} else {
+		log_err("rcu_rbtree_replace: null tree\n");
+	}
+
+	return ret_val;
+}
+
+static int insert(struct rcu_rbtree *tree, void *key, void *value, int replace)
+{
+	struct rcu_batch dropped = {0};
+	struct rcu_rbnode *root;
+
+	lock(&tree->lock);
+	if (reserve(tree)) {
+		unlock(&tree->lock);
+		return -1;
+	}
+	root = paint(tree, Black, ins(tree, tree->root, key, value, replace, &dropped));
+	publish(tree, root, &dropped);
+	unlock(&tree->lock);
+
+	return 0;
+}
+
+int rcu_rbtree_remove(struct rcu_rbtree *tree, const void *key)
+{
+	struct rcu_batch dropped = {0};
+	struct rcu_rbnode *root;
+
+	if (!tree) {
+		log_err("rcu_rbtree_remove: tree is null\n");
+		return -1;
+	}
+
+	lock(&tree->lock);
+	/* del would rebuild the path even for a missing key */
+	if (!lookup(tree, tree->root, key)) {
+		unlock(&tree->lock);
+		return 0;
+	}
+	if (reserve(tree)) {
+		unlock(&tree->lock);
+		return -1;
+	}
+	root = paint(tree, Black, del(tree, tree->root, key, &dropped));
+	publish(tree, root, &dropped);
+	unlock(&tree->lock);
+
+	return 0;
+}
+
+/*
+ * Makes root the current version and hands the batch reserve() set up,
+ * now holding whatever the old version no longer shares, to the epoch
+ * collector. The next update reserves a new one.
+ */
+static void publish(struct rcu_rbtree *tree, struct rcu_rbnode *root, struct rcu_batch *dropped)
+{
+	struct rcu_batch *batch = tree->batch;
+
+	__atomic_store_n(&tree->root, root, __ATOMIC_RELEASE);
+	/* everything built so far is published now */
+	++tree->gen;
+
+	batch->key_dst_func = dropped->key_dst_func;
+	batch->val_dst_func = dropped->val_dst_func;
+	batch->key = dropped->key;
+	batch->value = dropped->value;
+	tree->batch = NULL;
+	tree->batch_capacity = 0;
+	epoch_retire(&batch->entry, batch_free);
+}
+
+static void batch_free(struct epoch_entry *entry)
+{
+	struct rcu_batch *batch = (struct rcu_batch *)((char *)entry - offsetof(struct rcu_batch, entry));
+
+	for (size_t i = 0; i < batch->count; ++i)
+		free(batch->nodes[i]);
+	if (batch->key_dst_func)
+		batch->key_dst_func(batch->key);
+	if (batch->val_dst_func)
+		batch->val_dst_func(batch->value);
+	free(batch);
+}
+
+void *rcu_rbtree_search(struct rcu_rbtree *tree, const void *key)
+{
+	struct rcu_rbnode *node;
+	void *value = NULL;
+
+	if (!tree) {
+		log_err("rcu_rbtree_search: tree is null\n");
+		return NULL;
+	}
+
+	epoch_enter();
+	if ((node = lookup(tree, __atomic_load_n(&tree->root, __ATOMIC_ACQUIRE), key)))
+		value = node->value;
+	epoch_exit();
+
+	return value;
+}
+
+/* walks one consistent version; later updates are not seen */
+void rcu_rbtree_foreach(struct rcu_rbtree *tree, TraverseFunc trav_func, void *data)
+{
+	if (!tree) {
+		log_err("rcu_rbtree_foreach: null tree\n");
+		return;
+	}
+
+	epoch_enter();
+	inorder(__atomic_load_n(&tree->root, __ATOMIC_ACQUIRE), trav_func, data);
+	epoch_exit();
+}
+
+/* recursion depth is the tree height, at most twice log2(n + 1) */
+static int inorder(struct rcu_rbnode *node, TraverseFunc trav_func, void *data)
+{
+	for (; node; node = node->right) {
+		if (inorder(node->left, trav_func, data) || trav_func(node->key, node->value, data))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* waits for the readers of the old version, so not from a read-side section */
+int rcu_rbtree_clear(struct rcu_rbtree *tree)
+{
+	struct rcu_rbnode *root;
+
+	if (!tree) {
+		log_err("rcu_rbtree_clear: null tree\n");
+		return -1;
+	}
+	if (epoch_in_critical()) {
+		log_err("rcu_rbtree_clear: inside a read-side section\n");
+		return -1;
+	}
+
+	lock(&tree->lock);
+	if ((root = tree->root)) {
+		__atomic_store_n(&tree->root, NULL, __ATOMIC_RELEASE);
+		tree->count = 0;
+		epoch_synchronize();
+		tree_free(tree, root);
+	}
+	unlock(&tree->lock);
+
+	return 0;
+}
+
+static void tree_free(struct rcu_rbtree *tree, struct rcu_rbnode *node)
+{
+	struct rcu_rbnode *right;
+
+	for (; node; node = right) {
+		tree_free(tree, node->left);
+		if (tree->key_dst_func)
+			tree->key_dst_func(node->key);
+		if (tree->val_dst_func)
+			tree->val_dst_func(node->value);
+		right = node->right;
+		free(node);
+	}
+}
+
+/*
+ * No reader may use the tree any more; waits for pending retires, so
+ * like clear it fails from inside a read-side section.
+ */
+int rcu_rbtree_destroy(struct rcu_rbtree *tree)
+{
+	struct rcu_rbnode *node;
+
+	if (!tree) {
+		log_err("rcu_rbtree_destroy: null tree\n");
+		return -1;
+	}
+	if (rcu_rbtree_clear(tree))
+		return -1;
+
+	epoch_barrier();
+	while ((node = tree->spare)) {
+		tree->spare = node->left;
+		free(node);
+	}
+	tree->spare_count = 0;
+	free(tree->batch);
+	tree->batch = NULL;
+	tree->batch_capacity = 0;
+
+	return 0;
+}
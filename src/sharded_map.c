@@ -0,0 +1,258 @@
+#include "sharded_map.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lock.h"
+#include "logmsg.h"
+
+
+/* 2^64 / golden ratio: spreads weak hashes (aligned pointers, small ints) */
+#define FIB_MULT	UINT64_C(0x9e3779b97f4a7c15)
+
+
+static struct shard *shard_of(struct sharded_map *, const void *);
+static void shard_lock(struct shard *);
+static void sift_down(struct rbcursor *, size_t, size_t, CompareFunc);
+
+
+
+int sharded_map_init(struct sharded_map *map, size_t shards, HashFunc hash, CompareFunc cmp,
+		DestroyFunc key_dst, DestroyFunc val_dst)
+{
+	unsigned int bits = 0;
+
+	if (!map) {
+		log_err("null map pointer\n");
+		return -1;
+	}
+	if (!hash || !cmp) {
+		log_err("null hash or compare func\n");
+		return -1;
+	}
+
+	/* round up to a power of two so the top hash bits pick the shard */
+	while (((size_t)1 << bits) < shards)
+		++bits;
+	map->shard_count = (size_t)1 << bits;
+	map->shard_bits = bits;
+	map->hash_func = hash;
+
+	if (!(map->shards = aligned_alloc(CACHE_LINE_SIZE, map->shard_count * sizeof(*map->shards)))) {
+		log_err("sharded_map_init: aligned_alloc");
+		return -1;
+	}
+	for (size_t i = 0; i < map->shard_count; ++i) {
+		map->shards[i].lock = 0;
+		map->shards[i].acquired = 0;
+		map->shards[i].contended = 0;
+		rbtree_init(&map->shards[i].tree, cmp, key_dst, val_dst);
+	}
+
+	return 0;
+}
+
+static struct shard *shard_of(struct sharded_map *map, const void *key)
+{
+	uint64_t hash = (uint64_t)map->hash_func(key) * FIB_MULT;
+
+	/* a shift by 64 is undefined, so one shard is special */
+	return &map->shards[map->shard_bits ? hash >> (64 - map->shard_bits) : 0];
+}
+
+static void shard_lock(struct shard *shard)
+{
+	/* only lock holders write the counters; stats reads them unlocked */
+	if (trylock(&shard->lock)) {
+		lock(&shard->lock);
+		__atomic_store_n(&shard->contended, shard->contended + 1, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&shard->acquired, shard->acquired + 1, __ATOMIC_RELAXED);
+}
+
+int sharded_map_insert(struct sharded_map *map, void *key, void *value)
+{
+	struct shard *shard;
+	int ret_val;
+
+	if (!map) {
+		log_err("sharded_map_insert: null map\n");
+		return -1;
+	}
+
+	shard = shard_of(map, key);
+	shard_lock(shard);
+	ret_val = rbtree_insert(&shard->tree, key, value);
+	unlock(&shard->lock);
+
+	return ret_val;
+}
+
+int sharded_map_replace(struct sharded_map *map, void *key, void *value)
+{
+	struct shard *shard;
+	int ret_val;
+
+	if (!map) {
+		log_err("sharded_map_replace: null map\n");
+		return -1;
+	}
+
+	shard = shard_of(map, key);
+	shard_lock(shard);
+	ret_val = rbtree_replace(&shard->tree, key, value);
+	unlock(&shard->lock);
+
+	return ret_val;
+}
+
+void *sharded_map_search(struct sharded_map *map, const void *key)
+{
+	struct shard *shard;
+	void *value;
+
+	if (!map) {
+		log_err("sharded_map_search: null map\n");
+		return NULL;
+	}
+
+	shard = shard_of(map, key);
+	shard_lock(shard);
+	value = rbtree_search(&shard->tree, key);
+	unlock(&shard->lock);
+
+	return value;
+}
+
+int sharded_map_remove(struct sharded_map *map, const void *key)
+{
+	struct shard *shard;
+	int ret_val;
+
+	if (!map) {
+		log_err("sharded_map_remove: null map\n");
+		return -1;
+	}
+
+	shard = shard_of(map, key);
+	shard_lock(shard);
+	ret_val = rbtree_remove(&shard->tree, key);
+	unlock(&shard->lock);
+
+	return ret_val;
+}
+
+/*
+ * k-way merge: a min-heap holds one cursor per non-empty shard. All
+ * shards stay locked for the walk, so trav_func must not call back into
+ * the map.
+ */
+void sharded_map_foreach(struct sharded_map *map, TraverseFunc trav_func, void *data)
+{
+	struct rbcursor *heap;
+	CompareFunc cmp;
+	size_t n = 0;
+
+	if (!map) {
+		log_err("sharded_map_foreach: null map\n");
+		return;
+	}
+	if (!(heap = malloc(map->shard_count * sizeof(*heap)))) {
+		log_err("sharded_map_foreach: malloc");
+		return;
+	}
+
+	cmp = map->shards[0].tree.cmp_func;
+	for (size_t i = 0; i < map->shard_count; ++i) {
+		shard_lock(&map->shards[i]);
+		if (!rbtree_first(&map->shards[i].tree, &heap[n]))
+			++n;
+	}
+	for (size_t i = n / 2; i-- > 0; )
+		sift_down(heap, n, i, cmp);
+
+	while (n && !trav_func(rbcursor_key(&heap[0]), rbcursor_value(&heap[0]), data)) {
+		if (rbcursor_next(&heap[0]))
+			heap[0] = heap[--n];
+		sift_down(heap, n, 0, cmp);
+	}
+
+	for (size_t i = map->shard_count; i-- > 0; )
+		unlock(&map->shards[i].lock);
+	free(heap);
+}
+
+static void sift_down(struct rbcursor *heap, size_t n, size_t i, CompareFunc cmp)
+{
+	struct rbcursor tmp;
+	size_t child;
+
+	while ((child = 2 * i + 1) < n) {
+		if (child + 1 < n && cmp(rbcursor_key(&heap[child + 1]), rbcursor_key(&heap[child])) < 0)
+			++child;
+		if (cmp(rbcursor_key(&heap[i]), rbcursor_key(&heap[child])) <= 0)
+			break;
+		tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+		i = child;
+	}
+}
+
+/* shards are counted one at a time, so concurrent writers blur the sum */
+size_t sharded_map_count(struct sharded_map *map)
+{
+	size_t count = 0;
+
+	if (map) {
+		for (size_t i = 0; i < map->shard_count; ++i) {
+			shard_lock(&map->shards[i]);
+			count += map->shards[i].tree.count;
+			unlock(&map->shards[i].lock);
+		}
+	} else {
+		log_err("sharded_map_count: null map\n");
+	}
+
+	return count;
+}
+
+void sharded_map_stats(struct sharded_map *map, size_t shard, unsigned long *acquired,
+		unsigned long *contended)
+{
+	if (!map || shard >= map->shard_count) {
+		log_err("sharded_map_stats: bad map or shard\n");
+		return;
+	}
+
+	if (acquired)
+		*acquired = __atomic_load_n(&map->shards[shard].acquired, __ATOMIC_RELAXED);
+	if (contended)
+		*contended = __atomic_load_n(&map->shards[shard].contended, __ATOMIC_RELAXED);
+}
+
+void sharded_map_clear(struct sharded_map *map)
+{
+	if (!map) {
+		log_err("sharded_map_clear: null map\n");
+		return;
+	}
+
+	for (size_t i = 0; i < map->shard_count; ++i) {
+		shard_lock(&map->shards[i]);
+		rbtree_clear(&map->shards[i].tree);
+		unlock(&map->shards[i].lock);
+	}
+}
+
+void sharded_map_destroy(struct sharded_map *map)
+{
+	if (map && map->shards) {
+		for (size_t i = 0; i < map->shard_count; ++i)
+			rbtree_destroy(&map->shards[i].tree);
+		free(map->shards);
+		map->shards = NULL;
+	}
+}
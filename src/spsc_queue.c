@@ -0,0 +1,104 @@
+#include "spsc_queue.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "logmsg.h"
+
+
+
+/*
+ * capacity is rounded up to a power of two so indices wrap with a mask;
+ * above the largest power of two whose slots fit in a size_t it fails
+ * with EINVAL
+ */
+bool spsc_queue_init(DestroyFunc destroy_func, size_t capacity, struct SPSCQueue *queue)
+{
+	bool is_valid = false;
+	size_t size = 1;
+
+	if (capacity > (SIZE_MAX / 2 + 1) / sizeof(*queue->slots)) {
+		errno = EINVAL;
+		log_err("spsc_queue_init: capacity too large");
+	} else if (queue && capacity) {
+		while (size < capacity)
+			size <<= 1;
+
+		if ((queue->slots = malloc(size * sizeof(*queue->slots)))) {
+			queue->head = 0;
+			queue->tail_cache = 0;
+			queue->tail = 0;
+			queue->head_cache = 0;
+			queue->mask = size - 1;
+			queue->destroy_func = destroy_func;
+			is_valid = true;
+		} else {
+			log_err("spsc_queue_init: malloc slots");
+		}
+	} else {
+		log_err("spsc_queue_init: null queue or zero capacity\n");
+	}
+
+	return is_valid;
+}
+
+/* producer only; returns -1 if the ring is full */
+int spsc_enqueue(struct SPSCQueue *queue, void *data)
+{
+	size_t tail;
+
+	tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+	if (tail - queue->head_cache > queue->mask) {
+		queue->head_cache = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+		if (tail - queue->head_cache > queue->mask)
+			return -1;
+	}
+
+	queue->slots[tail & queue->mask] = data;
+	__atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* consumer only */
+bool is_spsc_queue_empty(struct SPSCQueue *queue)
+{
+	return __atomic_load_n(&queue->head, __ATOMIC_RELAXED)
+		== __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+}
+
+/* consumer only; returns -1 if the ring is empty */
+int spsc_dequeue(struct SPSCQueue *queue, void **data)
+{
+	size_t head;
+
+	head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+	if (head == queue->tail_cache) {
+		queue->tail_cache = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+		if (head == queue->tail_cache)
+			return -1;
+	}
+
+	*data = queue->slots[head & queue->mask];
+	__atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+void spsc_queue_destroy(struct SPSCQueue *queue)
+{
+	void *data;
+
+	if (queue) {
+		if (queue->destroy_func) {
+			while (!spsc_dequeue(queue, &data))
+				queue->destroy_func(data);
+		}
+		free(queue->slots);
+		queue->slots = NULL;
+	} else {
+		log_err("can't destroy null spsc queue\n");
+	}
+}
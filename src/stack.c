@@ -11,6 +11,9 @@
 
 
 static void stack_clear(struct Stack *stack);
+static int chunk_push(struct Stack *stack, void *data);
+static void *chunk_pop(struct Stack *stack);
+static void chunks_free(struct Stack *stack);
 
 
 struct Stack *stack_new(DestroyFunc destroy_func)
@@ -22,10 +25,25 @@ struct Stack *stack_new(DestroyFunc destroy_func)
 
 	stack->head = NULL;
 	stack->destroy_func = destroy_func;
+	stack->chunk = NULL;
+	stack->top = 0;
+	stack->chunk_slots = 0;
 error:
 	return stack; 
 }
 
+struct Stack *stack_new_chunked(DestroyFunc destroy_func, size_t chunk_slots)
+{
+	struct Stack *stack = NULL;
+
+	if (!chunk_slots)
+		log_msg("stack_new_chunked: zero chunk size");
+	if ((stack = stack_new(destroy_func)))
+		stack->chunk_slots = chunk_slots;
+error:
+	return stack;
+}
+
 
 int stack_push(struct Stack *stack, void *data)
 {
@@ -33,6 +51,8 @@ int stack_push(struct Stack *stack, void *data)
 
 	if (!stack)
 		log_msg("stack_push: null stack");
+	if (stack->chunk_slots)
+		return chunk_push(stack, data);
 
 	if (!(node = malloc(sizeof(*node))))
 		log_err("stack_push: node allocate failed!");
@@ -46,11 +66,66 @@ error:
 	return -1;
 }
 
+/*
+ * Push items[0] .. items[n-1] in order, so items[n-1] ends up on top.
+ * Either all of them are pushed or, on allocation failure, none.
+ */
+int stack_push_n(struct Stack *stack, void **items, size_t n)
+{
+	struct node *chain = NULL;
+	struct node *bottom = NULL;
+	struct node *node;
+	size_t i;
+
+	if (!stack)
+		log_msg("stack_push_n: null stack");
+	if (!n)
+		return 0;
+	if (!items)
+		log_msg("stack_push_n: null items");
+
+	if (stack->chunk_slots) {
+		for (i = 0; i < n; ++i) {
+			if (chunk_push(stack, items[i])) {
+				while (i--)
+					chunk_pop(stack);
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	for (i = 0; i < n; ++i) {
+		if (!(node = malloc(sizeof(*node)))) {
+			while ((node = chain)) {
+				chain = node->next;
+				free(node);
+			}
+			log_err("stack_push_n: node allocate failed!");
+		}
+		node->data = items[i];
+		node->next = chain;
+		chain = node;
+		if (!bottom)
+			bottom = node;
+	}
+
+	/* splice the private chain on in one step */
+	bottom->next = stack->head;
+	stack->head = chain;
+
+	return 0;
+error:
+	return -1;
+}
+
 int stack_is_empty(struct Stack *stack)
 {
 	if (!stack)
 		log_msg("stack_is_empty: null stack!");
 
+	if (stack->chunk_slots)
+		return !stack->top && (!stack->chunk || !stack->chunk->prev);
 	return !stack->head;
 error:
 	return 1;
@@ -63,6 +138,8 @@ void *stack_pop(struct Stack *stack)
 
 	if (!stack)
 		log_msg("stack_pop: null stack!");
+	if (stack->chunk_slots)
+		return chunk_pop(stack);
 	if (!(node = stack->head))
 		return NULL;
 
@@ -74,6 +151,42 @@ error:
 	return NULL;
 }
 
+/* pop up to n elements into out, top first; returns how many were popped */
+size_t stack_pop_n(struct Stack *stack, void **out, size_t n)
+{
+	struct node *chain;
+	struct node *node;
+	size_t i = 0;
+
+	if (!stack)
+		log_msg("stack_pop_n: null stack!");
+	if (!out)
+		log_msg("stack_pop_n: null out");
+
+	if (stack->chunk_slots) {
+		for (; i < n && !stack_is_empty(stack); ++i)
+			out[i] = chunk_pop(stack);
+		return i;
+	}
+
+	/* detach the first n nodes with a single head update */
+	chain = stack->head;
+	for (node = chain; node && i < n; node = node->next)
+		out[i++] = node->data;
+	stack->head = node;
+
+	while (chain != node) {
+		struct node *next = chain->next;
+
+		free(chain);
+		chain = next;
+	}
+
+	return i;
+error:
+	return 0;
+}
+
 static void stack_clear(struct Stack *stack)
 {
 	if (!stack)
@@ -94,5 +207,64 @@ void stack_destroy(struct Stack* stack)
 		return;
 
 	stack_clear(stack);
+	chunks_free(stack);
 	free(stack);
 }
+
+static int chunk_push(struct Stack *stack, void *data)
+{
+	struct stack_chunk *chunk;
+	size_t size;
+
+	if (!stack->chunk || stack->top == stack->chunk_slots) {
+		/* reuse a block kept from an earlier shrink before allocating */
+		if (!(chunk = stack->chunk ? stack->chunk->next : NULL)) {
+			size = sizeof(*chunk) + stack->chunk_slots * sizeof(chunk->slots[0]);
+			size = (size + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+			if (posix_memalign((void **)&chunk, CACHE_LINE_SIZE, size))
+				log_msg("stack_push: chunk allocate failed!");
+
+			chunk->prev = stack->chunk;
+			chunk->next = NULL;
+			if (stack->chunk)
+				stack->chunk->next = chunk;
+		}
+		stack->chunk = chunk;
+		stack->top = 0;
+	}
+
+	stack->chunk->slots[stack->top++] = data;
+	return 0;
+error:
+	return -1;
+}
+
+static void *chunk_pop(struct Stack *stack)
+{
+	if (!stack->top) {
+		if (!stack->chunk || !stack->chunk->prev)
+			return NULL;
+		stack->chunk = stack->chunk->prev;
+		stack->top = stack->chunk_slots;
+	}
+
+	return stack->chunk->slots[--stack->top];
+}
+
+static void chunks_free(struct Stack *stack)
+{
+	struct stack_chunk *chunk;
+	struct stack_chunk *next;
+
+	if (!(chunk = stack->chunk))
+		return;
+
+	while (chunk->prev)
+		chunk = chunk->prev;
+	for (; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	stack->chunk = NULL;
+	stack->top = 0;
+}
@@ -0,0 +1,155 @@
+#include "wsdeque.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "logmsg.h"
+
+
+static struct wsdeque_array *array_new(long size);
+static struct wsdeque_array *grow(struct WSDeque *, struct wsdeque_array *, long, long);
+
+
+static struct wsdeque_array *array_new(long size)
+{
+	struct wsdeque_array *array;
+
+	if ((array = malloc(sizeof(*array) + size * sizeof(array->slots[0])))) {
+		array->size = size;
+		array->prev = NULL;
+	} else {
+		log_err("wsdeque: malloc array");
+	}
+
+	return array;
+}
+
+/* capacity is rounded up to a power of two */
+bool wsdeque_init(struct WSDeque *deque, size_t capacity)
+{
+	bool is_valid = false;
+	long size = 2;
+
+	if (deque) {
+		while ((size_t)size < capacity)
+			size <<= 1;
+		if ((deque->array = array_new(size))) {
+			deque->top = 0;
+			deque->bottom = 0;
+			is_valid = true;
+		}
+	} else {
+		log_err("wsdeque_init: null deque\n");
+	}
+
+	return is_valid;
+}
+
+/* owner only */
+int wsdeque_push(struct WSDeque *deque, void *data)
+{
+	struct wsdeque_array *array;
+	long bottom;
+	long top;
+
+	bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+	top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+	array = __atomic_load_n(&deque->array, __ATOMIC_RELAXED);
+	if (bottom - top > array->size - 1) {
+		if (!(array = grow(deque, array, top, bottom)))
+			return -1;
+	}
+
+	__atomic_store_n(&array->slots[bottom & (array->size - 1)], data, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+/* owner only; returns NULL if the deque is empty */
+void *wsdeque_pop(struct WSDeque *deque)
+{
+	struct wsdeque_array *array;
+	long bottom;
+	long top;
+	void *data = NULL;
+
+	bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+	array = __atomic_load_n(&deque->array, __ATOMIC_RELAXED);
+	__atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+	if (top <= bottom) {
+		data = __atomic_load_n(&array->slots[bottom & (array->size - 1)], __ATOMIC_RELAXED);
+		if (top == bottom) {
+			/* last element: race the thieves for it */
+			if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1,
+						false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+				data = NULL;
+			__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+		}
+	} else {
+		__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+	}
+
+	return data;
+}
+
+/* any thread; returns NULL if the deque is empty or another thread won */
+void *wsdeque_steal(struct WSDeque *deque)
+{
+	struct wsdeque_array *array;
+	long bottom;
+	long top;
+	void *data;
+
+	top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+	if (top >= bottom)
+		return NULL;
+
+	array = __atomic_load_n(&deque->array, __ATOMIC_ACQUIRE);
+	data = __atomic_load_n(&array->slots[top & (array->size - 1)], __ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1,
+				false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		return NULL;
+
+	return data;
+}
+
+/* not thread safe: no other thread may use the deque any more */
+void wsdeque_destroy(struct WSDeque *deque)
+{
+	struct wsdeque_array *array;
+	struct wsdeque_array *prev;
+
+	if (deque) {
+		for (array = deque->array; array; array = prev) {
+			prev = array->prev;
+			free(array);
+		}
+		deque->array = NULL;
+	} else {
+		log_err("can't destroy null wsdeque\n");
+	}
+}
+
+static struct wsdeque_array *grow(struct WSDeque *deque, struct wsdeque_array *old,
+		long top, long bottom)
+{
+	struct wsdeque_array *array;
+
+	if (!(array = array_new(old->size * 2)))
+		return NULL;
+
+	for (long i = top; i < bottom; ++i)
+		array->slots[i & (array->size - 1)] = old->slots[i & (old->size - 1)];
+	array->prev = old;
+	__atomic_store_n(&deque->array, array, __ATOMIC_RELEASE);
+
+	return array;
+}
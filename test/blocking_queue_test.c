@@ -0,0 +1,86 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "queue.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: blocking_queue_test: " M "\n"); goto error;}
+
+#define CONSUMERS	4
+#define ITEMS		10000
+
+
+struct consumer {
+	pthread_t thread;
+	struct Queue *queue;
+	uintptr_t sum;
+	int err;
+};
+
+static void *consumer_run(void *);
+
+
+int main(const int argc, const char **argv)
+{
+	int ret = 0;
+	struct Queue queue;
+	struct consumer consumers[CONSUMERS];
+	struct timespec timeout = {0, 20 * 1000 * 1000};
+	uintptr_t sum = 0;
+
+	if (!queue_init_blocking(NULL, &queue))
+		return 1;
+
+	/* an empty queue times out */
+	if (dequeue_timed(&queue, &timeout) || errno != ETIMEDOUT)
+		log_msg("dequeue_timed did not time out");
+
+	/* consumers sleep until elements arrive, then close releases them */
+	for (int i = 0; i < CONSUMERS; ++i) {
+		consumers[i].queue = &queue;
+		consumers[i].sum = 0;
+		consumers[i].err = 0;
+		if (pthread_create(&consumers[i].thread, NULL, consumer_run, &consumers[i]))
+			log_msg("pthread_create");
+	}
+	for (uintptr_t i = 1; i <= ITEMS; ++i) {
+		if (enqueue(&queue, (void *)i))
+			log_msg("enqueue");
+	}
+	queue_close(&queue);
+	for (int i = 0; i < CONSUMERS; ++i) {
+		pthread_join(consumers[i].thread, NULL);
+		if (consumers[i].err != EPIPE)
+			log_msg("consumer not released by close");
+		sum += consumers[i].sum;
+	}
+
+	if (sum != (uintptr_t)ITEMS * (ITEMS + 1) / 2)
+		log_msg("element sum mismatch");
+	if (!enqueue(&queue, (void *)1))
+		log_msg("enqueue after close succeeded");
+
+	printf("blocking_queue_test: ok\n");
+out:
+	queue_destroy(&queue);
+	return ret;
+error:
+	ret = 1;
+	goto out;
+}
+
+
+static void *consumer_run(void *arg)
+{
+	struct consumer *consumer = arg;
+	void *data;
+
+	while ((data = dequeue_timed(consumer->queue, NULL)))
+		consumer->sum += (uintptr_t)data;
+	consumer->err = errno;
+
+	return NULL;
+}
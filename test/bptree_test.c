@@ -0,0 +1,147 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bptree.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: bptree_test: " M "\n"); goto error;}
+
+#define KEYS	5000
+#define OPS	100000
+
+
+static int compare(const void *, const void *);
+static int *boxed(int);
+static long check(struct bptree *, struct bpnode *, int, const int *, const int *);
+static int in_order(void *, void *, void *);
+
+
+/* keys and values are heap owned, so a stale separator is a use after free */
+int main(const int argc, const char **argv)
+{
+	static char present[KEYS + 1];
+	struct bptree tree;
+	int last = 0;
+	int *value;
+	size_t expected = 0;
+	int key;
+
+	if (bptree_init(&tree, compare, free, free))
+		return 1;
+
+	srand(1);
+	for (int i = 0; i < OPS; ++i) {
+		key = 1 + rand() % KEYS;
+		switch (rand() % 4) {
+		case 0:
+		case 1:
+			if (bptree_insert(&tree, boxed(key), boxed(key * 2)))
+				log_msg("insert");
+			present[key] = 1;
+			break;
+		case 2:
+			if (bptree_replace(&tree, boxed(key), boxed(key * 2)))
+				log_msg("replace");
+			present[key] = 1;
+			break;
+		default:
+			if (bptree_remove(&tree, &key))
+				log_msg("remove");
+			present[key] = 0;
+		}
+		if (!(i % 1000) && tree.root && check(&tree, tree.root, 1, NULL, NULL) != (long)tree.count)
+			log_msg("b+tree invariant broken");
+	}
+
+	for (key = 1; key <= KEYS; ++key) {
+		value = bptree_search(&tree, &key);
+		if (present[key] ? !value || *value != key * 2 : value != NULL)
+			log_msg("search mismatch");
+		expected += present[key];
+	}
+	if (tree.count != expected)
+		log_msg("count mismatch");
+
+	bptree_foreach(&tree, in_order, &last);
+	if (last < 0)
+		log_msg("foreach order");
+
+	/* drain to empty so merges run all the way up to the root */
+	for (key = 1; key <= KEYS; ++key) {
+		if (bptree_remove(&tree, &key))
+			log_msg("drain");
+	}
+	if (tree.root || tree.first || tree.count)
+		log_msg("not empty after drain");
+
+	bptree_destroy(&tree);
+	printf("bptree_test: ok\n");
+	return 0;
+error:
+	bptree_destroy(&tree);
+	return 1;
+}
+
+
+static int compare(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+static int *boxed(int n)
+{
+	int *box = malloc(sizeof(*box));
+
+	*box = n;
+	return box;
+}
+
+static int in_order(void *key, void *val, void *data)
+{
+	int *last = data;
+
+	if (*(int *)key <= *last || *(int *)val != *(int *)key * 2) {
+		*last = -1;
+		return 1;
+	}
+	*last = *(int *)key;
+	return 0;
+}
+
+/*
+ * Returns the number of entries below node, or -1 on a broken fill
+ * bound, key order or separator. lo and hi bound the subtree's keys.
+ */
+static long check(struct bptree *tree, struct bpnode *node, int is_root, const int *lo, const int *hi)
+{
+	struct bpnode *leaf;
+	long total = 0;
+	long sub;
+
+	if (!is_root && node->count < BPTREE_KEYS / 2)
+		return -1;
+	for (size_t i = 0; i < node->count; ++i) {
+		if ((i && compare(node->keys[i - 1], node->keys[i]) >= 0)
+				|| (lo && compare(node->keys[i], lo) < 0)
+				|| (hi && compare(node->keys[i], hi) >= 0))
+			return -1;
+	}
+	if (node->leaf)
+		return node->count;
+
+	for (size_t i = 0; i <= node->count; ++i) {
+		if (i) {
+			for (leaf = node->children[i]; !leaf->leaf; leaf = leaf->children[0])
+				;
+			if (leaf->keys[0] != node->keys[i - 1])
+				return -1;
+		}
+		sub = check(tree, node->children[i], 0, i ? node->keys[i - 1] : lo,
+				i < node->count ? node->keys[i] : hi);
+		if (sub < 0)
+			return -1;
+		total += sub;
+	}
+
+	return total;
+}
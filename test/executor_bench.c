@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "executor.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: executor_bench: " M "\n"); goto error;}
+
+#define FIB_N		38
+#define FIB_CUTOFF	16
+
+
+struct fib {
+	struct executor *exec;
+	int n;
+	long result;
+};
+
+static void fib_task(void *);
+static long fib_serial(int);
+static double elapsed(const struct timespec *);
+
+
+/* usage: executor_bench [max threads] */
+int main(const int argc, const char **argv)
+{
+	struct executor *exec;
+	struct timespec start;
+	struct task task;
+	struct fib fib;
+	long expected;
+	double base = 0;
+	double secs;
+	int max = argc > 1 ? atoi(argv[1]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (max < 1)
+		max = 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	expected = fib_serial(FIB_N);
+	printf("executor_bench: serial fib(%d) %.3fs\n", FIB_N, elapsed(&start));
+
+	for (int threads = 1; threads <= max; ++threads) {
+		if (!(exec = executor_new(threads)))
+			return 1;
+
+		fib.exec = exec;
+		fib.n = FIB_N;
+		task_init(&task, fib_task, &fib);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		executor_run(exec, &task);
+		secs = elapsed(&start);
+		executor_destroy(exec);
+
+		if (fib.result != expected)
+			log_msg("wrong result");
+		if (threads == 1)
+			base = secs;
+		printf("executor_bench: %2d threads %.3fs speedup %.2f\n", threads, secs, base / secs);
+	}
+
+	return 0;
+error:
+	return 1;
+}
+
+
+static void fib_task(void *arg)
+{
+	struct fib *fib = arg;
+	struct fib left = {fib->exec, fib->n - 1, 0};
+	struct fib right = {fib->exec, fib->n - 2, 0};
+	struct task task;
+
+	if (fib->n < FIB_CUTOFF) {
+		fib->result = fib_serial(fib->n);
+		return;
+	}
+
+	/* fork the left half, compute the right one here, then join */
+	task_init(&task, fib_task, &left);
+	executor_spawn(fib->exec, &task);
+	fib_task(&right);
+	executor_join(fib->exec, &task);
+	fib->result = left.result + right.result;
+}
+
+static long fib_serial(int n)
+{
+	return n < 2 ? n : fib_serial(n - 1) + fib_serial(n - 2);
+}
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
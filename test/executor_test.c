@@ -0,0 +1,127 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "executor.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: executor_test: " M "\n"); goto error;}
+
+#define THREADS		4
+#define FIB_N		24
+#define FIB_CUTOFF	8
+#define JOINERS		4
+#define ROUNDS		2000
+/* an idle pool must not wake up while this passes */
+#define IDLE_NS		(100 * 1000 * 1000)
+#define IDLE_SWITCHES	20
+
+
+struct fib {
+	struct executor *exec;
+	int n;
+	long result;
+};
+
+static void fib_task(void *);
+static long fib_serial(int);
+static void *joiner_run(void *);
+static void count_task(void *);
+
+
+int main(const int argc, const char **argv)
+{
+	struct executor *exec;
+	struct task task;
+	struct fib fib;
+	pthread_t joiners[JOINERS];
+	long counts[JOINERS] = {0};
+	struct timespec pause = {0, IDLE_NS};
+	struct rusage before;
+	struct rusage after;
+
+	if (!(exec = executor_new(THREADS)))
+		return 1;
+
+	/* nested spawn/join through the deques */
+	fib.exec = exec;
+	fib.n = FIB_N;
+	task_init(&task, fib_task, &fib);
+	if (executor_run(exec, &task))
+		log_msg("executor_run");
+	if (fib.result != fib_serial(FIB_N))
+		log_msg("wrong fib result");
+
+	/* outside threads sleep on tasks that live on their stacks */
+	for (int i = 0; i < JOINERS; ++i) {
+		if (pthread_create(&joiners[i], NULL, joiner_run, exec))
+			log_msg("pthread_create");
+	}
+	for (int i = 0; i < JOINERS; ++i) {
+		pthread_join(joiners[i], (void **)&counts[i]);
+		if (counts[i] != ROUNDS)
+			log_msg("task lost or run twice");
+	}
+
+	/* settle, then count context switches: polling workers would add some */
+	nanosleep(&pause, NULL);
+	getrusage(RUSAGE_SELF, &before);
+	nanosleep(&pause, NULL);
+	getrusage(RUSAGE_SELF, &after);
+	if (after.ru_nvcsw - before.ru_nvcsw > IDLE_SWITCHES)
+		log_msg("idle workers keep waking up");
+
+	executor_destroy(exec);
+	printf("executor_test: ok\n");
+	return 0;
+error:
+	executor_destroy(exec);
+	return 1;
+}
+
+
+static void fib_task(void *arg)
+{
+	struct fib *fib = arg;
+	struct fib left = {fib->exec, fib->n - 1, 0};
+	struct fib right = {fib->exec, fib->n - 2, 0};
+	struct task task;
+
+	if (fib->n < FIB_CUTOFF) {
+		fib->result = fib_serial(fib->n);
+		return;
+	}
+
+	task_init(&task, fib_task, &left);
+	executor_spawn(fib->exec, &task);
+	fib_task(&right);
+	executor_join(fib->exec, &task);
+	fib->result = left.result + right.result;
+}
+
+static long fib_serial(int n)
+{
+	return n < 2 ? n : fib_serial(n - 1) + fib_serial(n - 2);
+}
+
+static void *joiner_run(void *arg)
+{
+	struct executor *exec = arg;
+	long count = 0;
+
+	for (int i = 0; i < ROUNDS; ++i) {
+		struct task task;
+
+		task_init(&task, count_task, &count);
+		if (executor_run(exec, &task))
+			break;
+	}
+
+	return (void *)count;
+}
+
+static void count_task(void *arg)
+{
+	++*(long *)arg;
+}
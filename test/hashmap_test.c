@@ -0,0 +1,161 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashmap.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: hashmap_test: " M "\n"); goto error;}
+
+#define KEYS	5000
+#define OPS	200000
+
+
+struct walk {
+	size_t count;
+	int broken;
+};
+
+static int compare(const void *, const void *);
+static char *key_of(int);
+static int *boxed(int);
+static int check_entry(void *, void *, void *);
+static long check(struct hashmap *);
+
+
+/*
+ * String keys through hash_string, heap owned so that a slot shifted
+ * over a live entry or a double destroy shows up under ASan.
+ */
+int main(const int argc, const char **argv)
+{
+	static char present[KEYS + 1];
+	struct hashmap map;
+	struct walk walk = {0, 0};
+	size_t expected = 0;
+	char name[16];
+	int *value;
+	int key;
+
+	if (hashmap_init(&map, hash_string, compare, free, free))
+		return 1;
+
+	srand(1);
+	for (int i = 0; i < OPS; ++i) {
+		key = 1 + rand() % KEYS;
+		switch (rand() % 4) {
+		case 0:
+		case 1:
+			if (hashmap_insert(&map, key_of(key), boxed(key * 2)))
+				log_msg("insert");
+			present[key] = 1;
+			break;
+		case 2:
+			if (hashmap_replace(&map, key_of(key), boxed(key * 2)))
+				log_msg("replace");
+			present[key] = 1;
+			break;
+		default:
+			snprintf(name, sizeof(name), "key%d", key);
+			if (hashmap_remove(&map, name))
+				log_msg("remove");
+			present[key] = 0;
+		}
+		if (!(i % 1000) && check(&map) != (long)map.count)
+			log_msg("robin hood invariant broken");
+	}
+
+	for (key = 1; key <= KEYS; ++key) {
+		snprintf(name, sizeof(name), "key%d", key);
+		value = hashmap_search(&map, name);
+		if (present[key] ? !value || *value != key * 2 : value != NULL)
+			log_msg("search mismatch");
+		expected += present[key];
+	}
+	if (map.count != expected)
+		log_msg("count mismatch");
+
+	hashmap_foreach(&map, check_entry, &walk);
+	if (walk.broken || walk.count != expected)
+		log_msg("foreach");
+
+	/* drain to empty: every removal shifts its run back */
+	for (key = 1; key <= KEYS; ++key) {
+		snprintf(name, sizeof(name), "key%d", key);
+		if (hashmap_remove(&map, name))
+			log_msg("drain");
+	}
+	if (map.count || check(&map))
+		log_msg("not empty after drain");
+
+	for (key = 1; key <= 16; ++key)
+		hashmap_insert(&map, key_of(key), boxed(key * 2));
+	hashmap_destroy(&map);
+	printf("hashmap_test: ok\n");
+	return 0;
+error:
+	hashmap_destroy(&map);
+	return 1;
+}
+
+
+static int compare(const void *a, const void *b)
+{
+	return strcmp(a, b);
+}
+
+static char *key_of(int n)
+{
+	char *key = malloc(16);
+
+	snprintf(key, 16, "key%d", n);
+	return key;
+}
+
+static int *boxed(int n)
+{
+	int *box = malloc(sizeof(*box));
+
+	*box = n;
+	return box;
+}
+
+static int check_entry(void *key, void *val, void *data)
+{
+	struct walk *walk = data;
+
+	if (atoi((char *)key + 3) * 2 != *(int *)val) {
+		walk->broken = 1;
+		return 1;
+	}
+	++walk->count;
+	return 0;
+}
+
+/*
+ * Returns the number of occupied slots, or -1 if an entry is not where
+ * Robin Hood insertion would put it: along any run, each slot's distance
+ * from home exceeds its predecessor's by at most one.
+ */
+static long check(struct hashmap *map)
+{
+	size_t mask = map->capacity - 1;
+	size_t dist;
+	size_t prev;
+	long used = 0;
+
+	for (size_t i = 0; i < map->capacity; ++i) {
+		if (!map->slots[i].hash)
+			continue;
+		++used;
+		dist = (i - (map->slots[i].hash & mask)) & mask;
+		if (dist) {
+			prev = (i - 1) & mask;
+			if (!map->slots[prev].hash
+					|| ((prev - (map->slots[prev].hash & mask)) & mask) + 1 < dist)
+				return -1;
+		}
+	}
+
+	return used;
+}
@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "intrusive.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: intrusive_test: " M "\n"); goto error;}
+
+#define COUNT	16
+
+
+struct item {
+	int value;
+	struct ilink link;
+};
+
+
+int main(const int argc, const char **argv)
+{
+	struct item items[COUNT];
+	struct IStack stack;
+	struct IQueue queue;
+	struct ilink *link;
+
+	istack_init(&stack);
+	iqueue_init(&queue);
+
+	for (int i = 0; i < COUNT; ++i) {
+		items[i].value = i;
+		istack_push(&stack, &items[i].link);
+	}
+	for (int i = COUNT - 1; i >= 0; --i) {
+		if (!(link = istack_pop(&stack)))
+			log_msg("istack_pop empty");
+		if (container_of(link, struct item, link)->value != i)
+			log_msg("istack_pop order");
+		/* a popped element can go straight into another container */
+		ienqueue(&queue, link);
+	}
+	if (!istack_is_empty(&stack) || istack_pop(&stack))
+		log_msg("stack not empty");
+
+	for (int i = COUNT - 1; i >= 0; --i) {
+		if (!(link = idequeue(&queue)))
+			log_msg("idequeue empty");
+		if (container_of(link, struct item, link)->value != i)
+			log_msg("idequeue order");
+	}
+	if (!is_iqueue_empty(&queue) || idequeue(&queue))
+		log_msg("queue not empty");
+
+	printf("intrusive_test: ok\n");
+	return 0;
+error:
+	return 1;
+}
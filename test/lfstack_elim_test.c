@@ -0,0 +1,80 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Drives the elimination exchanger directly, which contention cannot do
+ * reliably (not at all on one CPU). The push waits in its slot long
+ * enough for the popping thread to be scheduled.
+ */
+#define ELIM_SPINS	(1 << 22)
+#include "../src/lfstack.c"
+
+#undef log_msg
+#define log_msg(M)	{fprintf(stderr, "error: lfstack_elim_test: " M "\n"); goto error;}
+
+#define OFFER		((void *)42)
+
+
+static void *popper_run(void *);
+
+static struct LFStack *stack;
+
+
+int main(const int argc, const char **argv)
+{
+	struct lfstack_stats stats;
+	struct node pending;
+	struct node node;
+	pthread_t popper;
+	void *data = NULL;
+
+	if (!(stack = lfstack_new(NULL)))
+		return 1;
+
+	/* a busy slot spreads pushes over more slots */
+	stack->elim[0].offer = &pending;
+	if (elim_push(stack, &node) || stack->elim_range != 2)
+		log_msg("collision did not grow the range");
+	stack->elim[0].offer = NULL;
+
+	/* nobody comes: the offer is withdrawn and the range shrinks */
+	if (elim_push(stack, &node) || stack->elim_range != 1)
+		log_msg("timeout did not shrink the range");
+	if (stack->elim[0].offer || stack->elim[1].offer)
+		log_msg("withdrawn offer left in a slot");
+
+	/* a parked push and a pop meet in the one slot */
+	if (pthread_create(&popper, NULL, popper_run, &data))
+		log_msg("pthread_create");
+	node.data = OFFER;
+	while (!elim_push(stack, &node))
+		;
+	pthread_join(popper, NULL);
+	if (data != OFFER)
+		log_msg("pop did not get the offered data");
+	if (stack->elim[0].offer)
+		log_msg("slot not cleared after the handoff");
+
+	lfstack_get_stats(stack, &stats);
+	if (stats.elim_hits != 2)
+		log_msg("handoff not counted on both sides");
+
+	lfstack_destroy(stack);
+	printf("lfstack_elim_test: ok\n");
+	return 0;
+error:
+	lfstack_destroy(stack);
+	return 1;
+}
+
+
+static void *popper_run(void *arg)
+{
+	while (!elim_pop(stack, arg))
+		sched_yield();
+
+	return NULL;
+}
@@ -0,0 +1,107 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lfstack.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: lfstack_test: " M "\n"); goto error;}
+
+#define THREADS		32
+#define ROUNDS		50000
+#define VALUES		((ROUNDS + 1) * THREADS)
+
+
+struct worker {
+	pthread_t thread;
+	struct LFStack *stack;
+	uintptr_t id;
+	uintptr_t pushed;
+	uintptr_t popped;
+};
+
+static void *worker_run(void *);
+
+/* times each value came out of the stack */
+static unsigned char seen[VALUES];
+
+
+int main(const int argc, const char **argv)
+{
+	int ret = 0;
+	struct LFStack *stack;
+	struct worker workers[THREADS];
+	struct lfstack_stats stats;
+	uintptr_t pushed = 0;
+	uintptr_t popped = 0;
+	void *data;
+
+	if (!(stack = lfstack_new(NULL)))
+		return 1;
+	/* pushes never allocate: an empty pool makes them fail */
+	if (!lfstack_push(stack, (void *)1))
+		log_msg("push without reserve succeeded");
+	if (lfstack_reserve(stack, THREADS))
+		log_msg("lfstack_reserve");
+
+	for (int i = 0; i < THREADS; ++i) {
+		workers[i].stack = stack;
+		workers[i].id = i;
+		workers[i].pushed = 0;
+		workers[i].popped = 0;
+		if (pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]))
+			log_msg("pthread_create");
+	}
+	for (int i = 0; i < THREADS; ++i) {
+		pthread_join(workers[i].thread, NULL);
+		pushed += workers[i].pushed;
+		popped += workers[i].popped;
+	}
+
+	/* every value pushed must be popped exactly once */
+	while ((data = lfstack_pop(stack))) {
+		popped += (uintptr_t)data;
+		++seen[(uintptr_t)data];
+	}
+	if (pushed != popped)
+		log_msg("pushed and popped sums differ");
+	for (uintptr_t value = THREADS; value < VALUES; ++value) {
+		if (seen[value] != 1)
+			log_msg("value lost or duplicated");
+	}
+	if (!lfstack_is_empty(stack))
+		log_msg("stack not empty");
+
+	lfstack_get_stats(stack, &stats);
+	printf("lfstack_test: cas failures %lu, elimination %lu/%lu\n",
+			stats.cas_failures, stats.elim_hits, stats.elim_attempts);
+	printf("lfstack_test: ok\n");
+out:
+	lfstack_destroy(stack);
+	return ret;
+error:
+	ret = 1;
+	goto out;
+}
+
+
+static void *worker_run(void *arg)
+{
+	struct worker *worker = arg;
+	uintptr_t value;
+	void *data;
+
+	/* each thread holds at most one node, so THREADS reserved suffice */
+	for (uintptr_t i = 1; i <= ROUNDS; ++i) {
+		value = i * THREADS + worker->id;
+		if (lfstack_push(worker->stack, (void *)value))
+			abort();
+		worker->pushed += value;
+		if ((data = lfstack_pop(worker->stack))) {
+			worker->popped += (uintptr_t)data;
+			__atomic_fetch_add(&seen[(uintptr_t)data], 1, __ATOMIC_RELAXED);
+		}
+	}
+
+	return NULL;
+}
@@ -0,0 +1,131 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mpmc_queue.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: mpmc_bench: " M "\n"); goto error;}
+
+#define ITEMS		(1 << 21)
+#define CAPACITY	1024
+#define MAX_THREADS	64
+
+
+struct bench {
+	struct MPMCQueue queue;
+	size_t per_producer;
+	size_t total;
+};
+
+/* per consumer and padded, so counting adds no shared line to the timing */
+struct consumer {
+	pthread_t thread;
+	struct bench *bench;
+	size_t consumed;
+	uintptr_t sum;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static void *producer(void *);
+static void *consumer(void *);
+static double elapsed(const struct timespec *);
+
+
+/* usage: mpmc_bench [max threads per side] */
+int main(const int argc, const char **argv)
+{
+	pthread_t producers[MAX_THREADS];
+	struct consumer consumers[MAX_THREADS];
+	size_t consumed;
+	uintptr_t sum;
+	struct timespec start;
+	struct bench bench;
+	int max = argc > 1 ? atoi(argv[1]) : 4;
+	int p;
+	int c;
+
+	if (max < 1 || max > MAX_THREADS)
+		max = 4;
+
+	printf("mpmc_bench: producers consumers Mops/s\n");
+	for (p = 1; p <= max; ++p) {
+		for (c = 1; c <= max; ++c) {
+			if (!mpmc_queue_init(NULL, CAPACITY, &bench.queue))
+				return 1;
+			bench.per_producer = ITEMS / p;
+			bench.total = bench.per_producer * p;
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (int i = 0; i < c; ++i) {
+				consumers[i].bench = &bench;
+				consumers[i].consumed = 0;
+				consumers[i].sum = 0;
+				if (pthread_create(&consumers[i].thread, NULL, consumer, &consumers[i]))
+					log_msg("pthread_create");
+			}
+			for (int i = 0; i < p; ++i) {
+				if (pthread_create(&producers[i], NULL, producer, &bench))
+					log_msg("pthread_create");
+			}
+			for (int i = 0; i < p; ++i)
+				pthread_join(producers[i], NULL);
+			/* values start at 1, so NULL tells one consumer to stop */
+			for (int i = 0; i < c; ++i)
+				mpmc_enqueue(&bench.queue, NULL);
+			consumed = 0;
+			sum = 0;
+			for (int i = 0; i < c; ++i) {
+				pthread_join(consumers[i].thread, NULL);
+				consumed += consumers[i].consumed;
+				sum += consumers[i].sum;
+			}
+
+			if (consumed != bench.total
+					|| sum != (uintptr_t)p * bench.per_producer * (bench.per_producer + 1) / 2)
+				log_msg("sum mismatch");
+			printf("mpmc_bench: %9d %9d %6.2f\n", p, c, bench.total / elapsed(&start) / 1e6);
+			mpmc_queue_destroy(&bench.queue);
+		}
+	}
+
+	return 0;
+error:
+	return 1;
+}
+
+
+static void *producer(void *arg)
+{
+	struct bench *bench = arg;
+
+	for (uintptr_t i = 1; i <= bench->per_producer; ++i)
+		mpmc_enqueue(&bench->queue, (void *)i);
+
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	struct consumer *consumer = arg;
+	size_t consumed = 0;
+	uintptr_t sum = 0;
+	void *data;
+
+	while (!mpmc_dequeue(&consumer->bench->queue, &data) && data) {
+		sum += (uintptr_t)data;
+		++consumed;
+	}
+	consumer->consumed = consumed;
+	consumer->sum = sum;
+
+	return NULL;
+}
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
@@ -0,0 +1,137 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mpmc_queue.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: mpmc_queue_test: " M "\n"); goto error;}
+
+#define CAPACITY	6
+#define SIZE		8
+#define PRODUCERS	4
+#define CONSUMERS	4
+#define ROUNDS		100000
+#define VALUES		((ROUNDS + 1) * PRODUCERS)
+
+
+struct worker {
+	pthread_t thread;
+	uintptr_t id;
+};
+
+static struct MPMCQueue queue;
+/* times each value came out of the queue */
+static unsigned char seen[VALUES];
+static int destroyed;
+
+static void *producer_run(void *);
+static void *consumer_run(void *);
+static int edges(void);
+static void count_destroy(void *);
+
+
+int main(const int argc, const char **argv)
+{
+	struct worker producers[PRODUCERS];
+	struct worker consumers[CONSUMERS];
+
+	if (edges())
+		log_msg("full/empty edges");
+
+	/* every value produced must be consumed exactly once */
+	if (!mpmc_queue_init(NULL, CAPACITY, &queue))
+		return 1;
+	for (int i = 0; i < CONSUMERS; ++i) {
+		consumers[i].id = i;
+		if (pthread_create(&consumers[i].thread, NULL, consumer_run, &consumers[i]))
+			log_msg("pthread_create");
+	}
+	for (int i = 0; i < PRODUCERS; ++i) {
+		producers[i].id = i;
+		if (pthread_create(&producers[i].thread, NULL, producer_run, &producers[i]))
+			log_msg("pthread_create");
+	}
+	for (int i = 0; i < PRODUCERS; ++i)
+		pthread_join(producers[i].thread, NULL);
+	/* values start at PRODUCERS, so NULL tells one consumer to stop */
+	for (int i = 0; i < CONSUMERS; ++i)
+		mpmc_enqueue(&queue, NULL);
+	for (int i = 0; i < CONSUMERS; ++i)
+		pthread_join(consumers[i].thread, NULL);
+	mpmc_queue_destroy(&queue);
+
+	for (uintptr_t value = PRODUCERS; value < VALUES; ++value) {
+		if (seen[value] != 1)
+			log_msg("value lost or duplicated");
+	}
+
+	printf("mpmc_queue_test: ok\n");
+	return 0;
+error:
+	return 1;
+}
+
+
+static void *producer_run(void *arg)
+{
+	struct worker *worker = arg;
+
+	for (uintptr_t i = 1; i <= ROUNDS; ++i)
+		mpmc_enqueue(&queue, (void *)(i * PRODUCERS + worker->id));
+
+	return NULL;
+}
+
+static void *consumer_run(void *arg)
+{
+	void *data;
+
+	while (!mpmc_dequeue(&queue, &data) && data)
+		__atomic_fetch_add(&seen[(uintptr_t)data], 1, __ATOMIC_RELAXED);
+
+	return NULL;
+}
+
+/*
+ * capacity rounds up to SIZE; leftovers go to destroy_func. A capacity
+ * whose power of two would not fit a size_t fails up front.
+ */
+static int edges(void)
+{
+	struct MPMCQueue q;
+	void *data;
+
+	errno = 0;
+	if (mpmc_queue_init(NULL, (SIZE_MAX / 2 + 1) / sizeof(*q.cells) + 1, &q) || errno != EINVAL)
+		return -1;
+	errno = 0;
+	if (mpmc_queue_init(NULL, SIZE_MAX, &q) || errno != EINVAL)
+		return -1;
+	if (!mpmc_queue_init(count_destroy, CAPACITY, &q))
+		return -1;
+	if (!mpmc_try_dequeue(&q, &data))
+		log_msg("dequeue from empty queue succeeded");
+	for (uintptr_t i = 1; i <= SIZE; ++i) {
+		if (mpmc_try_enqueue(&q, (void *)i))
+			log_msg("enqueue below capacity failed");
+	}
+	if (!mpmc_try_enqueue(&q, (void *)(SIZE + 1)))
+		log_msg("enqueue to full queue succeeded");
+	for (uintptr_t i = 1; i <= SIZE / 2; ++i) {
+		if (mpmc_try_dequeue(&q, &data) || data != (void *)i)
+			log_msg("out of order");
+	}
+	mpmc_queue_destroy(&q);
+
+	return destroyed == SIZE / 2 ? 0 : -1;
+error:
+	mpmc_queue_destroy(&q);
+	return -1;
+}
+
+static void count_destroy(void *data)
+{
+	++destroyed;
+}
@@ -0,0 +1,120 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "msqueue.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: msqueue_test: " M "\n"); goto error;}
+
+#define PRODUCERS	4
+#define CONSUMERS	4
+#define ITEMS		100000
+
+
+struct consumer {
+	pthread_t thread;
+	struct MSQueue *queue;
+	uintptr_t sum;
+	size_t count;
+	int out_of_order;
+};
+
+static struct MSQueue queue;
+static size_t consumed;
+
+static void *producer_run(void *);
+static void *consumer_run(void *);
+
+
+int main(const int argc, const char **argv)
+{
+	int ret = 0;
+	pthread_t producers[PRODUCERS];
+	struct consumer consumers[CONSUMERS];
+	uintptr_t sum = 0;
+	size_t count = 0;
+
+	if (!msqueue_init(free, &queue))
+		return 1;
+
+	for (uintptr_t i = 0; i < CONSUMERS; ++i) {
+		consumers[i].queue = &queue;
+		consumers[i].sum = 0;
+		consumers[i].count = 0;
+		consumers[i].out_of_order = 0;
+		if (pthread_create(&consumers[i].thread, NULL, consumer_run, &consumers[i]))
+			log_msg("pthread_create");
+	}
+	for (uintptr_t i = 0; i < PRODUCERS; ++i) {
+		if (pthread_create(&producers[i], NULL, producer_run, (void *)i))
+			log_msg("pthread_create");
+	}
+	for (int i = 0; i < PRODUCERS; ++i)
+		pthread_join(producers[i], NULL);
+	for (int i = 0; i < CONSUMERS; ++i) {
+		pthread_join(consumers[i].thread, NULL);
+		if (consumers[i].out_of_order)
+			log_msg("per-producer order broken");
+		sum += consumers[i].sum;
+		count += consumers[i].count;
+	}
+
+	if (count != PRODUCERS * ITEMS)
+		log_msg("element count mismatch");
+	if (sum != (uintptr_t)PRODUCERS * ITEMS * (ITEMS + 1) / 2)
+		log_msg("element sum mismatch");
+	if (!is_msqueue_empty(&queue) || ms_dequeue(&queue))
+		log_msg("queue not empty");
+
+	/* leave elements behind for destroy_func to release */
+	for (int i = 0; i < 16; ++i)
+		ms_enqueue(&queue, malloc(16));
+
+	printf("msqueue_test: ok\n");
+out:
+	msqueue_destroy(&queue);
+	return ret;
+error:
+	ret = 1;
+	goto out;
+}
+
+
+/* values are (sequence << 8) | producer so consumers can check FIFO order */
+static void *producer_run(void *arg)
+{
+	uintptr_t id = (uintptr_t)arg;
+	uintptr_t *value;
+
+	for (uintptr_t i = 1; i <= ITEMS; ++i) {
+		if (!(value = malloc(sizeof(*value))))
+			abort();
+		*value = (i << 8) | id;
+		while (ms_enqueue(&queue, value))
+			;
+	}
+
+	return NULL;
+}
+
+static void *consumer_run(void *arg)
+{
+	struct consumer *consumer = arg;
+	uintptr_t last[PRODUCERS] = {0,};
+	uintptr_t *value;
+
+	while (__atomic_load_n(&consumed, __ATOMIC_RELAXED) < PRODUCERS * ITEMS) {
+		if (!(value = ms_dequeue(consumer->queue)))
+			continue;
+		if ((*value >> 8) <= last[*value & 0xff])
+			consumer->out_of_order = 1;
+		last[*value & 0xff] = *value >> 8;
+		consumer->sum += *value >> 8;
+		++consumer->count;
+		free(value);
+		__atomic_fetch_add(&consumed, 1, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
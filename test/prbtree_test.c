@@ -0,0 +1,264 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prbtree.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: prbtree_test: " M "\n"); goto error;}
+
+#define KEYS		2000
+#define OPS		100000
+#define SNAPSHOTS	8
+#define SNAP_EVERY	(OPS / SNAPSHOTS)
+
+#define is_red(n)	((n) && (n)->color == Red)
+
+
+struct snapshot {
+	struct prbtree tree;
+	char present[KEYS + 1];
+};
+
+struct walk {
+	int last;
+	size_t count;
+	int broken;
+};
+
+struct report {
+	pthread_t thread;
+	struct prbtree tree;
+	size_t count;
+	int broken;
+};
+
+static int compare(const void *, const void *);
+static int *boxed(int);
+static int in_order(void *, void *, void *);
+static long check(struct prbnode *, const int *, const int *, long *);
+static int matches(struct prbtree *, const char *);
+static int existing(void);
+static void *report_run(void *);
+
+
+/*
+ * Snapshots taken along a random workload must keep exactly the content
+ * they had, with every key and value heap owned so that a node or entry
+ * freed too early shows up under ASan.
+ */
+int main(const int argc, const char **argv)
+{
+	static char present[KEYS + 1];
+	static struct snapshot snaps[SNAPSHOTS];
+	struct report report;
+	struct prbtree tree;
+	long entries;
+	int taken = 0;
+	int key;
+	int i;
+
+	if (existing())
+		return 1;
+	if (prbtree_init(&tree, compare, free, free))
+		return 1;
+
+	srand(1);
+	for (i = 0; i < OPS; ++i) {
+		if (!(i % SNAP_EVERY) && taken < SNAPSHOTS) {
+			if (prbtree_snapshot(&snaps[taken].tree, &tree))
+				log_msg("snapshot");
+			memcpy(snaps[taken++].present, present, sizeof(present));
+		}
+		key = 1 + rand() % KEYS;
+		switch (rand() % 4) {
+		case 0:
+		case 1:
+			if (prbtree_insert(&tree, boxed(key), boxed(key * 2)))
+				log_msg("insert");
+			present[key] = 1;
+			break;
+		case 2:
+			if (prbtree_replace(&tree, boxed(key), boxed(key * 2)))
+				log_msg("replace");
+			present[key] = 1;
+			break;
+		default:
+			if (prbtree_remove(&tree, &key))
+				log_msg("remove");
+			present[key] = 0;
+		}
+		if (!(i % 1000) && (check(tree.root, NULL, NULL, &entries) < 0
+				|| entries != (long)tree.count || is_red(tree.root)))
+			log_msg("red-black invariant broken");
+	}
+
+	if (!matches(&tree, present))
+		log_msg("current version mismatch");
+	for (i = 0; i < taken; ++i) {
+		if (check(snaps[i].tree.root, NULL, NULL, &entries) < 0
+				|| entries != (long)snaps[i].tree.count)
+			log_msg("snapshot invariant broken");
+		if (!matches(&snaps[i].tree, snaps[i].present))
+			log_msg("snapshot changed");
+	}
+
+	/* a snapshot walked and dropped by another thread while this one writes */
+	if (prbtree_snapshot(&report.tree, &tree))
+		log_msg("snapshot");
+	report.count = tree.count;
+	if (pthread_create(&report.thread, NULL, report_run, &report))
+		log_msg("pthread_create");
+	for (key = 1; key <= KEYS; ++key) {
+		if (prbtree_remove(&tree, &key))
+			log_msg("drain");
+	}
+	pthread_join(report.thread, NULL);
+	if (report.broken)
+		log_msg("report walked a changing version");
+	if (tree.root || tree.count)
+		log_msg("not empty after drain");
+
+	/* old snapshots are released in a different order than taken */
+	for (i = 0; i < taken; i += 2)
+		prbtree_destroy(&snaps[i].tree);
+	for (i = 1; i < taken; i += 2) {
+		if (!matches(&snaps[i].tree, snaps[i].present))
+			log_msg("snapshot changed after release");
+		prbtree_destroy(&snaps[i].tree);
+	}
+
+	for (key = 1; key <= 16; ++key)
+		prbtree_insert(&tree, boxed(key), boxed(key * 2));
+	prbtree_destroy(&tree);
+	printf("prbtree_test: ok\n");
+	return 0;
+error:
+	prbtree_destroy(&tree);
+	return 1;
+}
+
+
+static int compare(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+static int *boxed(int n)
+{
+	int *box = malloc(sizeof(*box));
+
+	*box = n;
+	return box;
+}
+
+static int in_order(void *key, void *val, void *data)
+{
+	struct walk *walk = data;
+
+	if (*(int *)key <= walk->last || *(int *)val != *(int *)key * 2) {
+		walk->broken = 1;
+		return 1;
+	}
+	walk->last = *(int *)key;
+	++walk->count;
+	return 0;
+}
+
+/* returns the black height below node, or -1; counts entries into *entries */
+static long check(struct prbnode *node, const int *lo, const int *hi, long *entries)
+{
+	long left, right, left_entries, right_entries;
+
+	*entries = 0;
+	if (!node)
+		return 1;
+	if ((lo && compare(node->key, lo) <= 0) || (hi && compare(node->key, hi) >= 0))
+		return -1;
+	if (is_red(node) && (is_red(node->left) || is_red(node->right)))
+		return -1;
+	left = check(node->left, lo, node->key, &left_entries);
+	right = check(node->right, node->key, hi, &right_entries);
+	if (left < 0 || left != right)
+		return -1;
+	*entries = left_entries + right_entries + 1;
+
+	return left + !is_red(node);
+}
+
+static int matches(struct prbtree *tree, const char *present)
+{
+	struct walk walk = {0, 0, 0};
+	size_t expected = 0;
+	int *value;
+
+	for (int key = 1; key <= KEYS; ++key) {
+		value = prbtree_search(tree, &key);
+		if (present[key] ? !value || *value != key * 2 : value != NULL)
+			return 0;
+		expected += present[key];
+	}
+	prbtree_foreach(tree, in_order, &walk);
+
+	return !walk.broken && walk.count == expected && tree->count == expected;
+}
+
+/*
+ * An existing key behaves as in rbtree: insert keeps the tree's key and
+ * takes the value, replace swaps both. A snapshot keeps the old pair.
+ */
+static int existing(void)
+{
+	struct prbtree tree;
+	struct prbtree snap;
+	int *first = boxed(7);
+	int *last = boxed(7);
+	int probe = 7;
+	int *value;
+
+	if (prbtree_init(&tree, compare, free, free))
+		return -1;
+	if (prbtree_insert(&tree, first, boxed(1)) || prbtree_snapshot(&snap, &tree))
+		log_msg("insert");
+
+	if (prbtree_insert(&tree, boxed(7), boxed(2)))
+		log_msg("insert existing");
+	value = prbtree_search(&tree, &probe);
+	if (tree.root->key != first || !value || *value != 2)
+		log_msg("insert did not keep the key");
+
+	if (prbtree_replace(&tree, last, boxed(3)))
+		log_msg("replace");
+	value = prbtree_search(&tree, &probe);
+	if (tree.root->key != last || !value || *value != 3 || tree.count != 1)
+		log_msg("replace did not swap the key");
+
+	value = prbtree_search(&snap, &probe);
+	if (snap.root->key != first || !value || *value != 1)
+		log_msg("snapshot lost its entry");
+	prbtree_destroy(&snap);
+	prbtree_destroy(&tree);
+
+	return 0;
+error:
+	return -1;
+}
+
+static void *report_run(void *arg)
+{
+	struct report *report = arg;
+	struct walk walk;
+
+	for (int round = 0; round < 50; ++round) {
+		walk.last = 0;
+		walk.count = 0;
+		walk.broken = 0;
+		prbtree_foreach(&report->tree, in_order, &walk);
+		if (walk.broken || walk.count != report->count)
+			report->broken = 1;
+	}
+	prbtree_destroy(&report->tree);
+
+	return NULL;
+}
@@ -6,12 +6,18 @@
 #include "queue.h"
 
 #define log_err(M)	{perror("error: tester: " M); goto error;}
+#define log_msg(M)	{fprintf(stderr, "error: tester: " M "\n"); goto error;}
+
+#define BATCH	64
 
 
 int main(const int argc, const char **argv)
 {
 	int ret = 0;
 	char line[LINE_MAX];
+	void *items[BATCH];
+	void *out[BATCH];
+	size_t count;
 	struct Queue queue = {NULL,};
 	FILE *conf_file = fopen("test.ini", "r");
 	
@@ -46,6 +52,22 @@ int main(const int argc, const char **argv)
 		data = NULL;
 	}
 
+	/* bulk enqueue/dequeue keeps FIFO order across batches */
+	for (size_t i = 0; i < BATCH; ++i)
+		items[i] = (void *)(i + 1);
+	if (enqueue_n(&queue, items, BATCH/2) || enqueue_n(&queue, items + BATCH/2, BATCH/2))
+		log_msg("enqueue_n");
+	if (BATCH/4 != dequeue_n(&queue, out, BATCH/4))
+		log_msg("dequeue_n");
+	if (BATCH - BATCH/4 != (count = dequeue_n(&queue, out + BATCH/4, BATCH)))
+		log_msg("dequeue_n rest");
+	for (size_t i = 0; i < BATCH; ++i) {
+		if (out[i] != items[i])
+			log_msg("dequeue_n order");
+	}
+	if (!is_queue_empty(&queue))
+		log_msg("queue not empty");
+	fprintf(stderr, "dequeue_n: %zu in order\n", BATCH/4 + count);
 
 out:
 	if (conf_file)
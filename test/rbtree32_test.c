@@ -0,0 +1,126 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rbtree32.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: rbtree32_test: " M "\n"); goto error;}
+
+#define KEYS	2000
+#define OPS	20000
+
+
+static int compare(const void *, const void *);
+static int black_height(struct rbtree32 *, uint32_t);
+static int count_in_order(void *, void *, void *);
+
+
+int main(const int argc, const char **argv)
+{
+	static char present[KEYS + 1];
+	struct rbtree32 tree;
+	struct rbtree32 copy;
+	uintptr_t key;
+	uintptr_t last = 0;
+	size_t expected = 0;
+
+	if (rbtree32_init(&tree, compare, NULL, NULL))
+		return 1;
+
+	srand(1);
+	for (int i = 0; i < OPS; ++i) {
+		key = 1 + rand() % KEYS;
+		if (rand() % 3) {
+			if (rbtree32_insert(&tree, (void *)key, (void *)(key * 2)))
+				log_msg("insert");
+			present[key] = 1;
+		} else {
+			if (rbtree32_remove(&tree, (void *)key))
+				log_msg("remove");
+			present[key] = 0;
+		}
+		if (!(i % 1000) && (Red == tree.nodes[tree.root].color || black_height(&tree, tree.root) < 0))
+			log_msg("red-black invariant broken");
+	}
+
+	for (key = 1; key <= KEYS; ++key) {
+		void *value = rbtree32_search(&tree, (void *)key);
+
+		if (present[key] ? value != (void *)(key * 2) : value != NULL)
+			log_msg("search mismatch");
+		expected += present[key];
+	}
+	if (tree.count != expected)
+		log_msg("count mismatch");
+
+	/* the node array is position independent: a byte copy is a tree */
+	copy = tree;
+	if (!(copy.nodes = malloc(tree.capacity * sizeof(*tree.nodes))))
+		log_msg("malloc");
+	memcpy(copy.nodes, tree.nodes, tree.used * sizeof(*tree.nodes));
+	rbtree32_destroy(&tree);
+	rbtree32_foreach(&copy, count_in_order, &last);
+	if (last == (uintptr_t)-1)
+		log_msg("foreach order");
+	for (key = 1; key <= KEYS; ++key) {
+		if (present[key] != (NULL != rbtree32_search(&copy, (void *)key)))
+			log_msg("copy search mismatch");
+	}
+	rbtree32_destroy(&copy);
+
+	/* a destroyed tree is empty and takes inserts again */
+	if (rbtree32_search(&tree, (void *)1) || rbtree32_remove(&tree, (void *)1))
+		log_msg("destroyed tree not empty");
+	for (key = 1; key <= KEYS; ++key) {
+		if (rbtree32_insert(&tree, (void *)key, (void *)key))
+			log_msg("insert after destroy");
+	}
+	if (tree.count != KEYS || rbtree32_search(&tree, (void *)KEYS) != (void *)KEYS)
+		log_msg("tree after destroy");
+	rbtree32_destroy(&tree);
+
+	printf("rbtree32_test: ok\n");
+	return 0;
+error:
+	return 1;
+}
+
+
+static int compare(const void *a, const void *b)
+{
+	return ((uintptr_t)a > (uintptr_t)b) - ((uintptr_t)a < (uintptr_t)b);
+}
+
+static int count_in_order(void *key, void *val, void *data)
+{
+	uintptr_t *last = data;
+
+	if ((uintptr_t)key <= *last) {
+		*last = (uintptr_t)-1;
+		return 1;
+	}
+	*last = (uintptr_t)key;
+	return 0;
+}
+
+static int black_height(struct rbtree32 *tree, uint32_t node)
+{
+	struct rb32node *n = &tree->nodes[node];
+	int left;
+	int right;
+
+	if (!node)
+		return 1;
+	if (n->left && (tree->nodes[n->left].parent != node || Red == (n->color & tree->nodes[n->left].color)))
+		return -1;
+	if (n->right && (tree->nodes[n->right].parent != node || Red == (n->color & tree->nodes[n->right].color)))
+		return -1;
+
+	left = black_height(tree, n->left);
+	right = black_height(tree, n->right);
+	if (left < 0 || left != right)
+		return -1;
+
+	return left + (Black == n->color);
+}
@@ -0,0 +1,158 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rbtree.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: rbtree_alloc_test: " M "\n"); goto error;}
+
+/*
+ * Linked with -Wl,--wrap=malloc: every malloc in the library goes
+ * through __wrap_malloc, which fails the fail_at'th call from now on.
+ */
+void *__real_malloc(size_t);
+void *__wrap_malloc(size_t);
+
+#define KEYS		100
+#define SMALL		6
+#define LARGE		200
+#define SLAB_NODES	8
+
+
+static int compare(const void *, const void *);
+static void count_destroy(void *);
+static int fill(struct rbtree *, int);
+static int unchanged(struct rbtree *);
+static int batch(int arena, size_t n);
+
+static long fail_at;
+static long destroyed;
+
+
+int main(const int argc, const char **argv)
+{
+	for (int arena = 0; arena <= 1; ++arena) {
+		/* small batches go in node by node, large ones rebuild */
+		if (batch(arena, SMALL))
+			log_msg("small batch");
+		if (batch(arena, LARGE))
+			log_msg("large batch");
+	}
+
+	printf("rbtree_alloc_test: ok\n");
+	return 0;
+error:
+	return 1;
+}
+
+
+void *__wrap_malloc(size_t size)
+{
+	if (fail_at && !--fail_at)
+		return NULL;
+	return __real_malloc(size);
+}
+
+/*
+ * Fails each allocation of rbtree_insert_many in turn. Until it goes
+ * through, the tree must be untouched and no destructor may have run;
+ * then the batch must be in with rbtree_insert semantics.
+ */
+static int batch(int arena, size_t n)
+{
+	struct rbtree tree;
+	void *keys[LARGE];
+	void *vals[LARGE];
+	long expected;
+	size_t count;
+	int ret;
+
+	if (fill(&tree, arena))
+		return -1;
+	/* every key twice, half of them up to KEYS and so in the tree already */
+	for (size_t i = 0; i < n; ++i) {
+		keys[i] = (void *)(uintptr_t)(KEYS - n / 2 + 2 + 2 * (i / 2));
+		vals[i] = (void *)(uintptr_t)(1000 + i);
+	}
+
+	for (long attempt = 1; ; ++attempt) {
+		destroyed = 0;
+		fail_at = attempt;
+		ret = rbtree_insert_many(&tree, keys, vals, n);
+		fail_at = 0;
+		if (!ret)
+			break;
+		if (destroyed)
+			log_msg("destructor ran before a failure");
+		if (unchanged(&tree))
+			log_msg("tree changed by a failed batch");
+	}
+
+	/*
+	 * Each pair's second value wins; the first value and second key go,
+	 * and so do the tree's value and the batch key where the key was in.
+	 */
+	expected = 0;
+	count = KEYS;
+	for (size_t i = 0; i < n; i += 2) {
+		if (rbtree_search(&tree, keys[i]) != vals[i + 1])
+			log_msg("batch value missing");
+		if ((uintptr_t)keys[i] <= KEYS) {
+			expected += 4;
+		} else {
+			expected += 2;
+			++count;
+		}
+	}
+	if (destroyed != expected)
+		log_msg("destructor calls after batch");
+	if (tree.count != count)
+		log_msg("count after batch");
+	rbtree_destroy(&tree);
+
+	return 0;
+error:
+	rbtree_destroy(&tree);
+	return -1;
+}
+
+/* odd keys 1..KEYS-1 and even keys 2..KEYS, values equal to keys */
+static int fill(struct rbtree *tree, int arena)
+{
+	int ret;
+
+	if (arena)
+		ret = rbtree_init_arena(tree, compare, count_destroy, count_destroy, SLAB_NODES);
+	else
+		ret = rbtree_init(tree, compare, count_destroy, count_destroy);
+	if (ret)
+		return -1;
+	for (uintptr_t key = 1; key <= KEYS; ++key) {
+		if (rbtree_insert(tree, (void *)key, (void *)key))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int unchanged(struct rbtree *tree)
+{
+	if (tree->count != KEYS)
+		return -1;
+	for (uintptr_t key = 1; key <= KEYS; ++key) {
+		if (rbtree_search(tree, (void *)key) != (void *)key)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int compare(const void *a, const void *b)
+{
+	return (uintptr_t)a < (uintptr_t)b ? -1 : (uintptr_t)a > (uintptr_t)b;
+}
+
+static void count_destroy(void *data)
+{
+	++destroyed;
+}
@@ -0,0 +1,351 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "bptree.h"
+#include "hashmap.h"
+#include "rbtree.h"
+#include "rbtree32.h"
+#include "rbtree_gen.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: rbtree_bench: " M "\n"); goto error;}
+
+#define DEFAULT_ENTRIES	10000000
+#define LOOKUPS		2000000
+/* keys per rbtree_search_batch call, like one request's worth */
+#define BATCH		256
+
+
+/* one map implementation under test, keyed by integers 1..n */
+struct impl {
+	const char *name;
+	size_t node_size;
+	void *(*create)(void);
+	int (*insert)(void *, uintptr_t);
+	void *(*search)(void *, uintptr_t);
+	void (*destroy)(void *);
+	/* optional */
+	int (*search_batch)(void *, const void **, void **, size_t);
+};
+
+static int compare(const void *, const void *);
+static uintptr_t *shuffled(size_t);
+static double elapsed(const struct timespec *);
+static int run(const struct impl *, const uintptr_t *, size_t);
+
+static inline int compare_int(uintptr_t a, uintptr_t b)
+{
+	return (a > b) - (a < b);
+}
+
+RBTREE_GENERATE(inttree, uintptr_t, uintptr_t, compare_int)
+
+static void *rbtree_create(void);
+static int rbtree_put(void *, uintptr_t);
+static void *rbtree_get(void *, uintptr_t);
+static int rbtree_get_batch(void *, const void **, void **, size_t);
+static void rbtree_free(void *);
+static void *rbtree32_create(void);
+static int rbtree32_put(void *, uintptr_t);
+static void *rbtree32_get(void *, uintptr_t);
+static void rbtree32_free(void *);
+static void *inttree_create(void);
+static int inttree_put(void *, uintptr_t);
+static void *inttree_get(void *, uintptr_t);
+static void inttree_free(void *);
+static void *bptree_create(void);
+static int bptree_put(void *, uintptr_t);
+static void *bptree_get(void *, uintptr_t);
+static void bptree_free(void *);
+static size_t hash_int(const void *);
+static void *hashmap_create(void);
+static int hashmap_put(void *, uintptr_t);
+static void *hashmap_get(void *, uintptr_t);
+static void hashmap_free(void *);
+
+
+static const struct impl impls[] = {
+	{"rbtree", sizeof(struct rbnode), rbtree_create, rbtree_put, rbtree_get, rbtree_free,
+			rbtree_get_batch},
+	{"rbtree32", sizeof(struct rb32node), rbtree32_create, rbtree32_put, rbtree32_get, rbtree32_free},
+	{"rbtree_gen", sizeof(struct inttree_node), inttree_create, inttree_put, inttree_get, inttree_free},
+	/* per entry: leaves run about 2/3 full under random inserts */
+	{"bptree", 3 * sizeof(struct bpnode) / (2 * BPTREE_KEYS), bptree_create, bptree_put, bptree_get, bptree_free},
+	/* per entry: slots run between 7/16 and 7/8 full */
+	{"hashmap", 3 * sizeof(struct hmslot) / 2, hashmap_create, hashmap_put, hashmap_get, hashmap_free},
+};
+
+
+/*
+ * usage: rbtree_bench [entries [implementation ...]]
+ * max rss is a high-water mark for the whole process, so it only belongs
+ * to one implementation when that one is named, e.g. rbtree_bench 10000000 rbtree
+ */
+int main(const int argc, const char **argv)
+{
+	uintptr_t *keys;
+	size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_ENTRIES;
+
+	if (!n || !(keys = shuffled(n)))
+		return 1;
+
+	for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); ++i) {
+		int selected = argc <= 2;
+
+		for (int j = 2; j < argc; ++j)
+			selected |= !strcmp(argv[j], impls[i].name);
+		if (selected && run(&impls[i], keys, n))
+			log_msg("run failed");
+	}
+
+	free(keys);
+	return 0;
+error:
+	free(keys);
+	return 1;
+}
+
+
+static int run(const struct impl *impl, const uintptr_t *keys, size_t n)
+{
+	static const void *lookups[LOOKUPS];
+	static void *results[BATCH];
+	struct timespec start;
+	struct rusage usage;
+	uintptr_t found = 0;
+	uintptr_t batch_found = 0;
+	double insert_secs;
+	double search_secs;
+	double batch_secs;
+	void *map;
+
+	if (!(map = impl->create()))
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < n; ++i) {
+		if (impl->insert(map, keys[i]))
+			return -1;
+	}
+	insert_secs = elapsed(&start);
+	getrusage(RUSAGE_SELF, &usage);
+
+	/* random point lookups, all hits */
+	srand(2);
+	for (size_t i = 0; i < LOOKUPS; ++i)
+		lookups[i] = (const void *)(1 + (uintptr_t)rand() % n);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < LOOKUPS; ++i)
+		found += (uintptr_t)impl->search(map, (uintptr_t)lookups[i]);
+	search_secs = elapsed(&start);
+
+	printf("rbtree_bench: %-10s %zu entries, node %3zu B, nodes %7.1f MiB, max rss %7.1f MiB, "
+			"insert %7.1f ns/op, search %7.1f ns/op\n",
+			impl->name, n, impl->node_size, n * impl->node_size / 1048576.0,
+			usage.ru_maxrss / 1024.0, insert_secs * 1e9 / n, search_secs * 1e9 / LOOKUPS);
+
+	/* the same lookups, BATCH keys per call */
+	if (impl->search_batch) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (size_t i = 0; i < LOOKUPS; i += BATCH) {
+			size_t m = LOOKUPS - i < BATCH ? LOOKUPS - i : BATCH;
+
+			if (impl->search_batch(map, lookups + i, results, m))
+				return -1;
+			for (size_t j = 0; j < m; ++j)
+				batch_found += (uintptr_t)results[j];
+		}
+		batch_secs = elapsed(&start);
+		printf("rbtree_bench: %-10s batches of %d, search %7.1f ns/op (%.2fx)\n",
+				impl->name, BATCH, batch_secs * 1e9 / LOOKUPS, search_secs / batch_secs);
+		if (batch_found != found)
+			return -1;
+	}
+
+	impl->destroy(map);
+	return found ? 0 : -1;
+}
+
+static int compare(const void *a, const void *b)
+{
+	return ((uintptr_t)a > (uintptr_t)b) - ((uintptr_t)a < (uintptr_t)b);
+}
+
+/* 1..n in random order */
+static uintptr_t *shuffled(size_t n)
+{
+	uintptr_t *keys;
+	uintptr_t tmp;
+	size_t j;
+
+	if (!(keys = malloc(n * sizeof(*keys))))
+		return NULL;
+	for (size_t i = 0; i < n; ++i)
+		keys[i] = i + 1;
+
+	srand(1);
+	for (size_t i = n - 1; i > 0; --i) {
+		j = ((size_t)rand() * RAND_MAX + rand()) % (i + 1);
+		tmp = keys[i];
+		keys[i] = keys[j];
+		keys[j] = tmp;
+	}
+
+	return keys;
+}
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void *rbtree_create(void)
+{
+	struct rbtree *tree;
+
+	if ((tree = malloc(sizeof(*tree))) && rbtree_init_arena(tree, compare, NULL, NULL, 4096)) {
+		free(tree);
+		tree = NULL;
+	}
+	return tree;
+}
+
+static int rbtree_put(void *map, uintptr_t key)
+{
+	return rbtree_insert(map, (void *)key, (void *)key);
+}
+
+static void *rbtree_get(void *map, uintptr_t key)
+{
+	return rbtree_search(map, (void *)key);
+}
+
+static int rbtree_get_batch(void *map, const void **keys, void **out, size_t n)
+{
+	return rbtree_search_batch(map, keys, out, n);
+}
+
+static void rbtree_free(void *map)
+{
+	rbtree_destroy(map);
+	free(map);
+}
+
+static void *rbtree32_create(void)
+{
+	struct rbtree32 *tree;
+
+	if ((tree = malloc(sizeof(*tree))) && rbtree32_init(tree, compare, NULL, NULL)) {
+		free(tree);
+		tree = NULL;
+	}
+	return tree;
+}
+
+static int rbtree32_put(void *map, uintptr_t key)
+{
+	return rbtree32_insert(map, (void *)key, (void *)key);
+}
+
+static void *rbtree32_get(void *map, uintptr_t key)
+{
+	return rbtree32_search(map, (void *)key);
+}
+
+static void rbtree32_free(void *map)
+{
+	rbtree32_destroy(map);
+	free(map);
+}
+
+static void *inttree_create(void)
+{
+	struct inttree *tree;
+
+	if ((tree = malloc(sizeof(*tree))))
+		inttree_init(tree);
+	return tree;
+}
+
+static int inttree_put(void *map, uintptr_t key)
+{
+	return inttree_insert(map, key, key);
+}
+
+static void *inttree_get(void *map, uintptr_t key)
+{
+	uintptr_t *value = inttree_search(map, key);
+
+	return value ? (void *)*value : NULL;
+}
+
+static void inttree_free(void *map)
+{
+	inttree_clear(map);
+	free(map);
+}
+
+static void *bptree_create(void)
+{
+	struct bptree *tree;
+
+	if ((tree = malloc(sizeof(*tree))) && bptree_init(tree, compare, NULL, NULL)) {
+		free(tree);
+		tree = NULL;
+	}
+	return tree;
+}
+
+static int bptree_put(void *map, uintptr_t key)
+{
+	return bptree_insert(map, (void *)key, (void *)key);
+}
+
+static void *bptree_get(void *map, uintptr_t key)
+{
+	return bptree_search(map, (void *)key);
+}
+
+static void bptree_free(void *map)
+{
+	bptree_destroy(map);
+	free(map);
+}
+
+static size_t hash_int(const void *key)
+{
+	return (uintptr_t)key;
+}
+
+static void *hashmap_create(void)
+{
+	struct hashmap *map;
+
+	if ((map = malloc(sizeof(*map))) && hashmap_init(map, hash_int, compare, NULL, NULL)) {
+		free(map);
+		map = NULL;
+	}
+	return map;
+}
+
+static int hashmap_put(void *map, uintptr_t key)
+{
+	return hashmap_insert(map, (void *)key, (void *)key);
+}
+
+static void *hashmap_get(void *map, uintptr_t key)
+{
+	return hashmap_search(map, (void *)key);
+}
+
+static void hashmap_free(void *map)
+{
+	hashmap_destroy(map);
+	free(map);
+}
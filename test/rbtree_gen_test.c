@@ -0,0 +1,103 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rbtree_gen.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: rbtree_gen_test: " M "\n"); goto error;}
+
+#define KEYS	2000
+#define OPS	20000
+
+
+static inline int compare(int a, int b)
+{
+	return (a > b) - (a < b);
+}
+
+RBTREE_GENERATE(itree, int, long, compare)
+
+static int black_height(struct itree_node *);
+static int count_in_order(int *, long *, void *);
+
+
+int main(const int argc, const char **argv)
+{
+	static char present[KEYS + 1];
+	struct itree tree;
+	long *value;
+	int last = 0;
+	int key;
+
+	itree_init(&tree);
+
+	srand(1);
+	for (int i = 0; i < OPS; ++i) {
+		key = 1 + rand() % KEYS;
+		if (rand() % 3) {
+			if (itree_insert(&tree, key, key * 2L))
+				log_msg("insert");
+			present[key] = 1;
+		} else {
+			if (itree_remove(&tree, key) != (present[key] ? 0 : -1))
+				log_msg("remove");
+			present[key] = 0;
+		}
+		if (!(i % 1000) && tree.root && (Red == tree.root->color || tree.root->parent
+				|| black_height(tree.root) < 0))
+			log_msg("red-black invariant broken");
+	}
+
+	for (key = 1; key <= KEYS; ++key) {
+		value = itree_search(&tree, key);
+		if (present[key] ? !value || *value != key * 2L : value != NULL)
+			log_msg("search mismatch");
+	}
+
+	itree_foreach(&tree, count_in_order, &last);
+	if (last < 0)
+		log_msg("foreach order");
+
+	itree_clear(&tree);
+	if (tree.root || itree_search(&tree, 1))
+		log_msg("clear");
+
+	printf("rbtree_gen_test: ok\n");
+	return 0;
+error:
+	itree_clear(&tree);
+	return 1;
+}
+
+
+static int count_in_order(int *key, long *val, void *data)
+{
+	int *last = data;
+
+	if (*key <= *last || *val != *key * 2L) {
+		*last = -1;
+		return 1;
+	}
+	*last = *key;
+	return 0;
+}
+
+static int black_height(struct itree_node *node)
+{
+	int left;
+	int right;
+
+	if (!node)
+		return 1;
+	if (node->left && (node->left->parent != node || Red == (node->color & node->left->color)))
+		return -1;
+	if (node->right && (node->right->parent != node || Red == (node->color & node->right->color)))
+		return -1;
+
+	left = black_height(node->left);
+	right = black_height(node->right);
+	if (left < 0 || left != right)
+		return -1;
+
+	return left + (Black == node->color);
+}
@@ -0,0 +1,123 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rbtree.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: rbtree_stats_test: " M "\n"); goto error;}
+
+#define KEYS	2000
+#define OPS	20000
+
+#ifndef RBTREE_ORDER_STATS
+#error "build with -DRBTREE_ORDER_STATS"
+#endif
+
+
+static int compare(const void *, const void *);
+static long sizes_ok(struct rbnode *);
+
+
+int main(const int argc, const char **argv)
+{
+	static char present[KEYS + 2];
+	struct rbtree tree;
+	uintptr_t key;
+	void *found;
+	size_t below = 0;
+	size_t total;
+
+	if (rbtree_init(&tree, compare, NULL, NULL))
+		return 1;
+
+	srand(1);
+	for (int i = 0; i < OPS; ++i) {
+		key = 1 + rand() % KEYS;
+		if (rand() % 3) {
+			if (rbtree_insert(&tree, (void *)key, (void *)(key * 2)))
+				log_msg("insert");
+			present[key] = 1;
+		} else {
+			if (rbtree_remove(&tree, (void *)key))
+				log_msg("remove");
+			present[key] = 0;
+		}
+		if (!(i % 500) && sizes_ok(tree.root) < 0)
+			log_msg("subtree size out of date");
+	}
+
+	for (key = 1; key <= KEYS + 1; ++key) {
+		if (rbtree_rank(&tree, (void *)key) != below)
+			log_msg("rank");
+		if (present[key]) {
+			void *value;
+
+			if (rbtree_select(&tree, below, &found, &value) || found != (void *)key
+					|| value != (void *)(key * 2))
+				log_msg("select");
+			++below;
+		}
+	}
+	total = below;
+	if (!rbtree_select(&tree, total, &found, NULL))
+		log_msg("select past the end");
+
+	if (rbtree_count_range(&tree, (void *)1, (void *)(KEYS + 1)) != total)
+		log_msg("count whole range");
+	if (rbtree_count_range(&tree, (void *)(KEYS / 2), (void *)(KEYS / 4)))
+		log_msg("count empty range");
+	below = 0;
+	for (key = KEYS / 4; key < KEYS / 2; ++key)
+		below += present[key];
+	if (rbtree_count_range(&tree, (void *)(KEYS / 4), (void *)(KEYS / 2)) != below)
+		log_msg("count range");
+
+	rbtree_destroy(&tree);
+
+	/* bulk built trees come with their sizes filled in */
+	{
+		void *keys[KEYS];
+
+		for (key = 0; key < KEYS; ++key)
+			keys[key] = (void *)(2 * key + 1);
+		if (rbtree_init(&tree, compare, NULL, NULL) || rbtree_build_sorted(&tree, keys, NULL, KEYS))
+			log_msg("build");
+		if (sizes_ok(tree.root) != KEYS)
+			log_msg("build sizes");
+		for (key = 0; key < KEYS; ++key)
+			keys[key] = (void *)(2 * key);
+		if (rbtree_insert_many(&tree, keys, NULL, KEYS) || sizes_ok(tree.root) != 2 * KEYS)
+			log_msg("insert_many sizes");
+		if (rbtree_rank(&tree, (void *)(uintptr_t)KEYS) != KEYS)
+			log_msg("rank after rebuild");
+		rbtree_destroy(&tree);
+	}
+
+	printf("rbtree_stats_test: ok\n");
+	return 0;
+error:
+	rbtree_destroy(&tree);
+	return 1;
+}
+
+
+static int compare(const void *a, const void *b)
+{
+	return ((uintptr_t)a > (uintptr_t)b) - ((uintptr_t)a < (uintptr_t)b);
+}
+
+/* size of the subtree, or -1 if any node's size disagrees with its children */
+static long sizes_ok(struct rbnode *node)
+{
+	long left;
+	long right;
+
+	if (!node)
+		return 0;
+	if ((left = sizes_ok(node->left)) < 0 || (right = sizes_ok(node->right)) < 0)
+		return -1;
+	if (node->size != (size_t)(left + right + 1))
+		return -1;
+
+	return left + right + 1;
+}
@@ -0,0 +1,425 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rbtree.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: rbtree_test: " M "\n"); goto error;}
+
+#define KEYS	2000
+#define OPS	20000
+
+
+static int compare(const void *, const void *);
+static int check(struct rbtree *);
+static int black_height(struct rbtree *, struct rbnode *);
+static int random_ops(struct rbtree *);
+static int cursors(struct rbtree *, const char *);
+static int bulk(void);
+static int hinted(void);
+static int slots(void);
+static int batch(void);
+static int counting_compare(const void *, const void *);
+static int boxed_compare(const void *, const void *);
+
+static long comparisons;
+
+
+int main(const int argc, const char **argv)
+{
+	struct rbtree tree;
+
+	if (rbtree_init(&tree, compare, NULL, NULL))
+		return 1;
+	if (random_ops(&tree))
+		log_msg("malloc nodes");
+	rbtree_destroy(&tree);
+
+	if (rbtree_init_arena(&tree, compare, NULL, NULL, 64))
+		return 1;
+	if (random_ops(&tree))
+		log_msg("arena nodes");
+	rbtree_destroy(&tree);
+	if (tree.root || tree.slabs)
+		log_msg("arena not released");
+
+	/* destructors force the per-node walk, slabs must still go */
+	if (rbtree_init_arena(&tree, compare, free, NULL, 7))
+		return 1;
+	for (uintptr_t i = 1; i <= KEYS; ++i) {
+		uintptr_t *key = malloc(sizeof(*key));
+
+		*key = i;
+		rbtree_insert(&tree, key, NULL);
+	}
+	rbtree_destroy(&tree);
+
+	if (bulk())
+		log_msg("bulk build");
+	if (hinted())
+		log_msg("hinted insert");
+	if (slots())
+		log_msg("value slots");
+	if (batch())
+		log_msg("batch search");
+
+	printf("rbtree_test: ok\n");
+	return 0;
+error:
+	return 1;
+}
+
+
+/* keys are small integers stored in the pointer itself */
+static int compare(const void *a, const void *b)
+{
+	return ((uintptr_t)a > (uintptr_t)b) - ((uintptr_t)a < (uintptr_t)b);
+}
+
+/* random inserts and removes mirrored in a presence table */
+static int random_ops(struct rbtree *tree)
+{
+	static char present[KEYS + 1];
+	uintptr_t key;
+
+	srand(1);
+	for (int i = 0; i <= KEYS; ++i)
+		present[i] = 0;
+
+	for (int i = 0; i < OPS; ++i) {
+		key = 1 + rand() % KEYS;
+		if (rand() % 3) {
+			if (rbtree_insert(tree, (void *)key, (void *)(key * 2)))
+				return -1;
+			present[key] = 1;
+		} else {
+			if (rbtree_remove(tree, (void *)key))
+				return -1;
+			present[key] = 0;
+		}
+		if (!(i % 1000) && check(tree))
+			return -1;
+	}
+
+	for (key = 1; key <= KEYS; ++key) {
+		void *value = rbtree_search(tree, (void *)key);
+
+		if (present[key] ? value != (void *)(key * 2) : value != NULL)
+			return -1;
+	}
+
+	return check(tree) || cursors(tree, present) ? -1 : 0;
+}
+
+/* sorted builds of every small size, then batches merged into live trees */
+static int bulk(void)
+{
+	static void *keys[KEYS + 1];
+	static char present[KEYS + 1];
+	struct rbtree tree;
+	uintptr_t key;
+	size_t n;
+
+	for (n = 0; n <= 300; ++n) {
+		for (uintptr_t i = 0; i < n; ++i)
+			keys[i] = (void *)(i + 1);
+		if (rbtree_init(&tree, compare, NULL, NULL) || rbtree_build_sorted(&tree, keys, keys, n))
+			return -1;
+		if (tree.count != n || check(&tree))
+			return -1;
+		for (key = 1; key <= n + 1; ++key) {
+			if (rbtree_search(&tree, (void *)key) != (key <= n ? (void *)key : NULL))
+				return -1;
+		}
+		rbtree_destroy(&tree);
+	}
+
+	/* duplicates and unsorted input are refused */
+	keys[0] = keys[1] = (void *)1;
+	if (rbtree_init(&tree, compare, NULL, NULL) || !rbtree_build_sorted(&tree, keys, NULL, 2))
+		return -1;
+
+	/* a few batches go in one by one, the big ones rebuild the tree */
+	srand(3);
+	for (int i = 0; i <= KEYS; ++i)
+		present[i] = 0;
+	for (n = 1; n <= KEYS; n *= 3) {
+		void *vals[KEYS];
+
+		for (size_t i = 0; i < n; ++i) {
+			key = 1 + rand() % KEYS;
+			keys[i] = (void *)key;
+			vals[i] = (void *)(key * 2);
+			present[key] = 1;
+		}
+		if (rbtree_insert_many(&tree, keys, vals, n) || check(&tree) || cursors(&tree, present))
+			return -1;
+		/* the arena keeps serving plain inserts and removes afterwards */
+		key = 1 + rand() % KEYS;
+		if (rbtree_insert(&tree, (void *)key, (void *)(key * 2)))
+			return -1;
+		present[key] = 1;
+		key = 1 + rand() % KEYS;
+		if (rbtree_remove(&tree, (void *)key))
+			return -1;
+		present[key] = 0;
+		if (check(&tree) || cursors(&tree, present))
+			return -1;
+	}
+	n = 0;
+	for (key = 1; key <= KEYS; ++key)
+		n += present[key];
+	if (tree.count != n)
+		return -1;
+	rbtree_destroy(&tree);
+
+	return 0;
+}
+
+/* counters bumped in place; a miss costs exactly the comparisons of a search */
+static int slots(void)
+{
+	static uintptr_t counts[KEYS + 1];
+	struct rbtree tree;
+	uintptr_t *box;
+	uintptr_t key;
+	void **slot;
+	long searched;
+	int inserted;
+
+	if (rbtree_init(&tree, counting_compare, NULL, NULL))
+		return -1;
+	srand(5);
+	for (int i = 0; i < OPS; ++i) {
+		key = 1 + rand() % KEYS;
+		comparisons = 0;
+		rbtree_search(&tree, (void *)key);
+		searched = comparisons;
+
+		comparisons = 0;
+		if (!(slot = rbtree_get_or_insert(&tree, (void *)key, (void *)0, &inserted)))
+			return -1;
+		if (comparisons != searched || inserted != !counts[key])
+			return -1;
+		*slot = (void *)((uintptr_t)*slot + 1);
+		++counts[key];
+	}
+	for (key = 1; key <= KEYS; ++key) {
+		if ((uintptr_t)rbtree_search(&tree, (void *)key) != counts[key])
+			return -1;
+	}
+	if (check(&tree))
+		return -1;
+	rbtree_destroy(&tree);
+
+	/* upsert replaces like rbtree_insert: old value and new key are freed */
+	if (rbtree_init(&tree, boxed_compare, free, free))
+		return -1;
+	for (int round = 0; round < 3; ++round) {
+		for (key = 1; key <= 100; ++key) {
+			box = malloc(sizeof(*box));
+			*box = key;
+			if (!(slot = rbtree_upsert(&tree, box, malloc(sizeof(uintptr_t)))))
+				return -1;
+			*(uintptr_t *)*slot = round;
+		}
+	}
+	key = 50;
+	box = rbtree_search(&tree, &key);
+	if (tree.count != 100 || !box || *box != 2)
+		return -1;
+	rbtree_destroy(&tree);
+
+	return 0;
+}
+
+/* batched results must match one search per key, hits and misses mixed */
+static int batch(void)
+{
+	static const void *keys[3 * KEYS + 5];
+	static void *out[3 * KEYS + 5];
+	struct rbtree tree;
+	size_t n = sizeof(keys) / sizeof(keys[0]);
+
+	if (rbtree_init(&tree, compare, NULL, NULL))
+		return -1;
+	for (size_t i = 0; i < n; ++i)
+		keys[i] = (const void *)(uintptr_t)(1 + rand() % (2 * KEYS));
+
+	/* empty tree: everything misses */
+	if (rbtree_search_batch(&tree, keys, out, n))
+		return -1;
+	for (size_t i = 0; i < n; ++i) {
+		if (out[i])
+			return -1;
+	}
+
+	for (uintptr_t key = 2; key <= 2 * KEYS; key += 2)
+		rbtree_insert(&tree, (void *)key, (void *)(key * 3));
+	/* n is not a multiple of the group size, so the last group is short */
+	if (rbtree_search_batch(&tree, keys, out, n))
+		return -1;
+	for (size_t i = 0; i < n; ++i) {
+		if (out[i] != rbtree_search(&tree, keys[i]))
+			return -1;
+	}
+	rbtree_destroy(&tree);
+
+	return 0;
+}
+
+static int counting_compare(const void *a, const void *b)
+{
+	++comparisons;
+	return compare(a, b);
+}
+
+/* heap-owned keys holding the integer */
+static int boxed_compare(const void *a, const void *b)
+{
+	return compare((void *)*(const uintptr_t *)a, (void *)*(const uintptr_t *)b);
+}
+
+/* ascending appends, descending runs and hints pointing anywhere */
+static int hinted(void)
+{
+	static char present[KEYS + 1];
+	struct rbcursor hint = {NULL, NULL};
+	struct rbtree tree;
+	size_t count = 0;
+	uintptr_t key;
+
+	if (rbtree_init(&tree, compare, NULL, NULL))
+		return -1;
+
+	for (key = 2; key <= KEYS; key += 2) {
+		if (rbtree_insert_hint(&tree, &hint, (void *)key, (void *)(key * 2))
+				|| (uintptr_t)rbcursor_key(&hint) != key)
+			return -1;
+		present[key] = 1;
+	}
+	if (check(&tree) || cursors(&tree, present))
+		return -1;
+
+	/* fill the odd gaps from the top down, hinting at the previous even key */
+	for (uintptr_t odd = KEYS / 2; odd > 0; --odd) {
+		key = 2 * odd - 1;
+		rbtree_lower_bound(&tree, (void *)(key - 1), &hint);
+		if (rbtree_insert_hint(&tree, &hint, (void *)key, (void *)(key * 2)))
+			return -1;
+		present[key] = 1;
+	}
+	if (check(&tree) || cursors(&tree, present))
+		return -1;
+
+	srand(4);
+	for (int i = 0; i < OPS; ++i) {
+		key = 1 + rand() % KEYS;
+		if (rand() % 2) {
+			if (rbtree_insert_hint(&tree, &hint, (void *)key, (void *)(key * 2)))
+				return -1;
+			present[key] = 1;
+		} else {
+			if (rbtree_remove(&tree, (void *)key))
+				return -1;
+			present[key] = 0;
+			/* removal invalidates cursors */
+			rbtree_lower_bound(&tree, (void *)(1 + (uintptr_t)rand() % KEYS), &hint);
+		}
+	}
+	if (check(&tree) || cursors(&tree, present))
+		return -1;
+	for (key = 1; key <= KEYS; ++key)
+		count += present[key];
+	if (tree.count != count)
+		return -1;
+	rbtree_destroy(&tree);
+
+	return 0;
+}
+
+/* full walks both ways and every lower/upper bound against the table */
+static int cursors(struct rbtree *tree, const char *present)
+{
+	struct rbcursor cursor;
+	uintptr_t expect;
+	int ret;
+
+	expect = 0;
+	for (ret = rbtree_first(tree, &cursor); !ret; ret = rbcursor_next(&cursor)) {
+		while (!present[++expect])
+			;
+		if ((uintptr_t)rbcursor_key(&cursor) != expect
+				|| (uintptr_t)rbcursor_value(&cursor) != expect * 2)
+			return -1;
+	}
+	while (++expect <= KEYS) {
+		if (present[expect])
+			return -1;
+	}
+
+	expect = KEYS + 1;
+	for (ret = rbtree_last(tree, &cursor); !ret; ret = rbcursor_prev(&cursor)) {
+		while (!present[--expect])
+			;
+		if ((uintptr_t)rbcursor_key(&cursor) != expect)
+			return -1;
+	}
+	while (--expect >= 1) {
+		if (present[expect])
+			return -1;
+	}
+
+	for (uintptr_t key = 0; key <= KEYS + 1; ++key) {
+		for (expect = key; expect <= KEYS && !present[expect]; ++expect)
+			;
+		ret = rbtree_lower_bound(tree, (void *)key, &cursor);
+		if (expect > KEYS ? !ret : ret || (uintptr_t)rbcursor_key(&cursor) != expect)
+			return -1;
+
+		for (expect = key + 1; expect <= KEYS && !present[expect]; ++expect)
+			;
+		ret = rbtree_upper_bound(tree, (void *)key, &cursor);
+		if (expect > KEYS ? !ret : ret || (uintptr_t)rbcursor_key(&cursor) != expect)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int check(struct rbtree *tree)
+{
+	struct rbnode *max = tree->root;
+
+	while (max && max->right)
+		max = max->right;
+	if (tree->rightmost != max)
+		return -1;
+	if (tree->root && (rb_parent(tree->root) || Red == rb_color(tree->root)))
+		return -1;
+	return black_height(tree, tree->root) < 0 ? -1 : 0;
+}
+
+/* -1 on any red-black or ordering violation */
+static int black_height(struct rbtree *tree, struct rbnode *node)
+{
+	int left;
+	int right;
+
+	if (!node)
+		return 1;
+	if (node->left && (rb_parent(node->left) != node || compare(node->left->key, node->key) >= 0))
+		return -1;
+	if (node->right && (rb_parent(node->right) != node || compare(node->right->key, node->key) <= 0))
+		return -1;
+	if (Red == rb_color(node) && ((node->left && Red == rb_color(node->left))
+				|| (node->right && Red == rb_color(node->right))))
+		return -1;
+
+	left = black_height(tree, node->left);
+	right = black_height(tree, node->right);
+	if (left < 0 || left != right)
+		return -1;
+
+	return left + (Black == rb_color(node));
+}
@@ -0,0 +1,219 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rcu_rbtree.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: rcu_rbtree_test: " M "\n"); goto error;}
+
+#define READERS	3
+#define KEYS	2000
+#define OPS	100000
+
+#define is_red(n)	((n) && ((n)->stamp & 1))
+
+
+struct reader {
+	pthread_t thread;
+	unsigned int seed;
+	size_t hits;
+	size_t walks;
+	int broken;
+};
+
+struct walk {
+	int last;
+	int broken;
+};
+
+static struct rcu_rbtree tree;
+static int done;
+
+static void *reader_run(void *);
+static int compare(const void *, const void *);
+static int *boxed(int);
+static int in_order(void *, void *, void *);
+static long check(struct rcu_rbnode *, const int *, const int *, long *);
+
+
+/*
+ * Keys and values are heap owned and dereferenced by the readers while
+ * the writer replaces and removes them, so early reclamation shows up
+ * as a wrong value (or under ASan as a use after free).
+ */
+int main(const int argc, const char **argv)
+{
+	static char present[KEYS + 1];
+	struct reader readers[READERS];
+	struct walk walk = {0, 0};
+	long entries;
+	size_t expected = 0;
+	int *value;
+	int key;
+	int i;
+
+	if (rcu_rbtree_init(&tree, compare, free, free))
+		return 1;
+
+	for (i = 0; i < READERS; ++i) {
+		readers[i].seed = i + 1;
+		readers[i].hits = 0;
+		readers[i].walks = 0;
+		readers[i].broken = 0;
+		if (pthread_create(&readers[i].thread, NULL, reader_run, &readers[i]))
+			log_msg("pthread_create");
+	}
+
+	srand(1);
+	for (i = 0; i < OPS; ++i) {
+		key = 1 + rand() % KEYS;
+		switch (rand() % 4) {
+		case 0:
+		case 1:
+			if (rcu_rbtree_insert(&tree, boxed(key), boxed(key * 2)))
+				log_msg("insert");
+			present[key] = 1;
+			break;
+		case 2:
+			if (rcu_rbtree_replace(&tree, boxed(key), boxed(key * 2)))
+				log_msg("replace");
+			present[key] = 1;
+			break;
+		default:
+			if (rcu_rbtree_remove(&tree, &key))
+				log_msg("remove");
+			present[key] = 0;
+		}
+		if (!(i % 1000) && (check(tree.root, NULL, NULL, &entries) < 0
+				|| entries != (long)tree.count || is_red(tree.root)))
+			log_msg("red-black invariant broken");
+	}
+
+	__atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < READERS; ++i) {
+		pthread_join(readers[i].thread, NULL);
+		if (readers[i].broken)
+			log_msg("reader saw a bad value or order");
+	}
+
+	for (key = 1; key <= KEYS; ++key) {
+		value = rcu_rbtree_search(&tree, &key);
+		if (present[key] ? !value || *value != key * 2 : value != NULL)
+			log_msg("search mismatch");
+		expected += present[key];
+	}
+	if (tree.count != expected)
+		log_msg("count mismatch");
+
+	rcu_rbtree_foreach(&tree, in_order, &walk);
+	if (walk.broken)
+		log_msg("foreach order");
+
+	for (key = 1; key <= KEYS; ++key) {
+		if (rcu_rbtree_remove(&tree, &key))
+			log_msg("drain");
+	}
+	if (tree.root || tree.count)
+		log_msg("not empty after drain");
+
+	/* leave entries behind for destroy to release */
+	for (key = 1; key <= 16; ++key)
+		rcu_rbtree_insert(&tree, boxed(key), boxed(key * 2));
+
+	/* clear and destroy would wait on this very reader: refused, no change */
+	rcu_rbtree_read_lock();
+	if (!rcu_rbtree_clear(&tree) || !rcu_rbtree_destroy(&tree))
+		log_msg("clear inside a read-side section");
+	key = 16;
+	value = rcu_rbtree_search(&tree, &key);
+	rcu_rbtree_read_unlock();
+	if (tree.count != 16 || !value || *value != 32)
+		log_msg("tree changed by a refused clear");
+
+	if (rcu_rbtree_destroy(&tree))
+		log_msg("destroy");
+	printf("rcu_rbtree_test: ok\n");
+	return 0;
+error:
+	/* readers may still be running: leave the tree to the exit */
+	__atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+
+static void *reader_run(void *arg)
+{
+	struct reader *reader = arg;
+	struct walk walk;
+	size_t rounds = 0;
+	int *value;
+	int key;
+
+	while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+		key = 1 + rand_r(&reader->seed) % KEYS;
+		rcu_rbtree_read_lock();
+		if ((value = rcu_rbtree_search(&tree, &key))) {
+			if (*value != key * 2)
+				reader->broken = 1;
+			++reader->hits;
+		}
+		rcu_rbtree_read_unlock();
+
+		if (!(++rounds % 256)) {
+			walk.last = 0;
+			walk.broken = 0;
+			rcu_rbtree_foreach(&tree, in_order, &walk);
+			reader->broken |= walk.broken;
+			++reader->walks;
+		}
+	}
+
+	return NULL;
+}
+
+static int compare(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+static int *boxed(int n)
+{
+	int *box = malloc(sizeof(*box));
+
+	*box = n;
+	return box;
+}
+
+static int in_order(void *key, void *val, void *data)
+{
+	struct walk *walk = data;
+
+	if (*(int *)key <= walk->last || *(int *)val != *(int *)key * 2) {
+		walk->broken = 1;
+		return 1;
+	}
+	walk->last = *(int *)key;
+	return 0;
+}
+
+/* returns the black height below node, or -1; counts entries into *entries */
+static long check(struct rcu_rbnode *node, const int *lo, const int *hi, long *entries)
+{
+	long left, right, left_entries, right_entries;
+
+	*entries = 0;
+	if (!node)
+		return 1;
+	if ((lo && compare(node->key, lo) <= 0) || (hi && compare(node->key, hi) >= 0))
+		return -1;
+	if (is_red(node) && (is_red(node->left) || is_red(node->right)))
+		return -1;
+	left = check(node->left, lo, node->key, &left_entries);
+	right = check(node->right, node->key, hi, &right_entries);
+	if (left < 0 || left != right)
+		return -1;
+	*entries = left_entries + right_entries + 1;
+
+	return left + !is_red(node);
+}
@@ -0,0 +1,115 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "sharded_map.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: sharded_map_bench: " M "\n"); goto error;}
+
+#define ITEMS		(1 << 20)
+#define MAX_THREADS	64
+
+
+struct bench {
+	struct sharded_map map;
+	size_t per_thread;
+};
+
+struct worker {
+	pthread_t thread;
+	struct bench *bench;
+	uintptr_t id;
+};
+
+static void *writer(void *);
+static size_t hash(const void *);
+static int compare(const void *, const void *);
+static double elapsed(const struct timespec *);
+
+
+/*
+ * usage: sharded_map_bench [max threads] [shards]
+ * One shard is the single-lock rbtree baseline.
+ */
+int main(const int argc, const char **argv)
+{
+	struct worker workers[MAX_THREADS];
+	struct timespec start;
+	struct bench bench;
+	unsigned long acquired, contended, total_acquired, total_contended;
+	int max = argc > 1 ? atoi(argv[1]) : 4;
+	size_t shards = argc > 2 ? strtoul(argv[2], NULL, 0) : 64;
+	size_t counts[2] = {1, shards};
+
+	if (max < 1 || max > MAX_THREADS)
+		max = 4;
+
+	printf("sharded_map_bench: shards threads Mops/s contended%%\n");
+	for (int s = 0; s < 2; ++s) {
+		for (int t = 1; t <= max; ++t) {
+			if (sharded_map_init(&bench.map, counts[s], hash, compare, NULL, NULL))
+				return 1;
+			bench.per_thread = ITEMS / t;
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (int i = 0; i < t; ++i) {
+				workers[i].bench = &bench;
+				workers[i].id = i;
+				if (pthread_create(&workers[i].thread, NULL, writer, &workers[i]))
+					log_msg("pthread_create");
+			}
+			for (int i = 0; i < t; ++i)
+				pthread_join(workers[i].thread, NULL);
+			if (sharded_map_count(&bench.map) != bench.per_thread * t)
+				log_msg("count mismatch");
+
+			total_acquired = total_contended = 0;
+			for (size_t i = 0; i < bench.map.shard_count; ++i) {
+				sharded_map_stats(&bench.map, i, &acquired, &contended);
+				total_acquired += acquired;
+				total_contended += contended;
+			}
+			printf("sharded_map_bench: %6zu %7d %6.2f %10.2f\n", bench.map.shard_count, t,
+					bench.per_thread * t / elapsed(&start) / 1e6,
+					100.0 * total_contended / total_acquired);
+			sharded_map_destroy(&bench.map);
+		}
+	}
+
+	return 0;
+error:
+	return 1;
+}
+
+
+/* keys are tagged integers, never dereferenced */
+static void *writer(void *arg)
+{
+	struct worker *worker = arg;
+	struct bench *bench = worker->bench;
+
+	for (uintptr_t i = 0; i < bench->per_thread; ++i)
+		sharded_map_insert(&bench->map, (void *)(i * MAX_THREADS + worker->id), NULL);
+
+	return NULL;
+}
+
+static size_t hash(const void *key)
+{
+	return (uintptr_t)key;
+}
+
+static int compare(const void *a, const void *b)
+{
+	return (uintptr_t)a < (uintptr_t)b ? -1 : (uintptr_t)a > (uintptr_t)b;
+}
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
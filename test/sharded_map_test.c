@@ -0,0 +1,143 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sharded_map.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: sharded_map_test: " M "\n"); goto error;}
+
+#define THREADS		4
+#define SHARDS		13
+#define PER_THREAD	20000
+
+
+struct walk {
+	int last;
+	size_t count;
+	int broken;
+};
+
+static struct sharded_map map;
+
+static void *writer_run(void *);
+static size_t hash(const void *);
+static int compare(const void *, const void *);
+static int *boxed(int);
+static int in_order(void *, void *, void *);
+
+
+/*
+ * Each writer owns the keys congruent to its index, inserts them all
+ * and removes every third, so the final content is known exactly.
+ */
+int main(const int argc, const char **argv)
+{
+	pthread_t writers[THREADS];
+	struct walk walk = {0, 0, 0};
+	unsigned long acquired;
+	unsigned long total = 0;
+	size_t expected = 0;
+	int *value;
+	int key;
+
+	if (sharded_map_init(&map, SHARDS, hash, compare, free, free))
+		return 1;
+	if (map.shard_count != 16)
+		log_msg("shard count not rounded up");
+
+	for (uintptr_t i = 0; i < THREADS; ++i) {
+		if (pthread_create(&writers[i], NULL, writer_run, (void *)i))
+			log_msg("pthread_create");
+	}
+	for (int i = 0; i < THREADS; ++i)
+		pthread_join(writers[i], NULL);
+
+	for (key = 1; key <= THREADS * PER_THREAD; ++key) {
+		value = sharded_map_search(&map, &key);
+		if (key % 3 ? !value || *value != key * 2 : value != NULL)
+			log_msg("search mismatch");
+		expected += !!(key % 3);
+	}
+	if (sharded_map_count(&map) != expected)
+		log_msg("count mismatch");
+
+	sharded_map_foreach(&map, in_order, &walk);
+	if (walk.broken || walk.count != expected)
+		log_msg("foreach not in key order");
+
+	for (size_t i = 0; i < map.shard_count; ++i) {
+		sharded_map_stats(&map, i, &acquired, NULL);
+		if (!acquired)
+			log_msg("a shard was never used");
+		total += acquired;
+	}
+	/* inserts, replaces, removes, searches, count and foreach */
+	if (total != (unsigned long)THREADS * PER_THREAD * 2 + THREADS * PER_THREAD / 3
+			+ THREADS * PER_THREAD + 2 * map.shard_count)
+		log_msg("acquisition count mismatch");
+
+	sharded_map_clear(&map);
+	if (sharded_map_count(&map))
+		log_msg("not empty after clear");
+
+	for (key = 1; key <= 16; ++key)
+		sharded_map_insert(&map, boxed(key), boxed(key * 2));
+	sharded_map_destroy(&map);
+	printf("sharded_map_test: ok\n");
+	return 0;
+error:
+	sharded_map_destroy(&map);
+	return 1;
+}
+
+
+static void *writer_run(void *arg)
+{
+	int id = (uintptr_t)arg;
+	int key;
+
+	for (int i = 0; i < PER_THREAD; ++i) {
+		key = i * THREADS + id + 1;
+		sharded_map_insert(&map, boxed(key), boxed(-key));
+		sharded_map_replace(&map, boxed(key), boxed(key * 2));
+	}
+	for (int i = 0; i < PER_THREAD; ++i) {
+		key = i * THREADS + id + 1;
+		if (!(key % 3))
+			sharded_map_remove(&map, &key);
+	}
+
+	return NULL;
+}
+
+static size_t hash(const void *key)
+{
+	return *(const int *)key;
+}
+
+static int compare(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+static int *boxed(int n)
+{
+	int *box = malloc(sizeof(*box));
+
+	*box = n;
+	return box;
+}
+
+static int in_order(void *key, void *val, void *data)
+{
+	struct walk *walk = data;
+
+	if (*(int *)key <= walk->last || *(int *)val != *(int *)key * 2) {
+		walk->broken = 1;
+		return 1;
+	}
+	walk->last = *(int *)key;
+	++walk->count;
+	return 0;
+}
@@ -0,0 +1,124 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "queue.h"
+#include "spsc_queue.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: spsc_bench: " M "\n"); goto error;}
+
+#define ITEMS		(1 << 22)
+#define CAPACITY	1024
+
+
+struct locked_queue {
+	struct Queue queue;
+	pthread_mutex_t mutex;
+};
+
+static void *spsc_producer(void *);
+static void *locked_producer(void *);
+static double elapsed(const struct timespec *);
+
+
+int main(const int argc, const char **argv)
+{
+	pthread_t thread;
+	struct timespec start;
+	struct SPSCQueue spsc;
+	struct locked_queue locked;
+	uintptr_t sum;
+	uintptr_t expected = (uintptr_t)ITEMS * (ITEMS + 1) / 2;
+	void *data;
+	double secs;
+
+	/* one producer thread, the main thread consumes */
+	if (!spsc_queue_init(NULL, CAPACITY, &spsc))
+		return 1;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (pthread_create(&thread, NULL, spsc_producer, &spsc))
+		log_msg("pthread_create");
+	for (uintptr_t i = sum = 0; i < ITEMS; ) {
+		if (spsc_dequeue(&spsc, &data)) {
+			sched_yield();
+			continue;
+		}
+		sum += (uintptr_t)data;
+		++i;
+	}
+	pthread_join(thread, NULL);
+	secs = elapsed(&start);
+	if (sum != expected)
+		log_msg("spsc sum mismatch");
+	printf("spsc_bench: spsc ring:      %8.2f Mops/s\n", ITEMS / secs / 1e6);
+	spsc_queue_destroy(&spsc);
+
+	/* the same handoff through a linked Queue behind a mutex */
+	if (!queue_init(NULL, &locked.queue))
+		return 1;
+	pthread_mutex_init(&locked.mutex, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (pthread_create(&thread, NULL, locked_producer, &locked))
+		log_msg("pthread_create");
+	for (uintptr_t i = sum = 0; i < ITEMS; ) {
+		pthread_mutex_lock(&locked.mutex);
+		data = dequeue(&locked.queue);
+		pthread_mutex_unlock(&locked.mutex);
+		if (!data) {
+			sched_yield();
+			continue;
+		}
+		sum += (uintptr_t)data;
+		++i;
+	}
+	pthread_join(thread, NULL);
+	secs = elapsed(&start);
+	if (sum != expected)
+		log_msg("queue sum mismatch");
+	printf("spsc_bench: locked Queue:   %8.2f Mops/s\n", ITEMS / secs / 1e6);
+	queue_destroy(&locked.queue);
+	pthread_mutex_destroy(&locked.mutex);
+
+	return 0;
+error:
+	return 1;
+}
+
+
+static void *spsc_producer(void *arg)
+{
+	struct SPSCQueue *queue = arg;
+
+	for (uintptr_t i = 1; i <= ITEMS; ) {
+		if (spsc_enqueue(queue, (void *)i))
+			sched_yield();
+		else
+			++i;
+	}
+
+	return NULL;
+}
+
+static void *locked_producer(void *arg)
+{
+	struct locked_queue *locked = arg;
+
+	for (uintptr_t i = 1; i <= ITEMS; ++i) {
+		pthread_mutex_lock(&locked->mutex);
+		enqueue(&locked->queue, (void *)i);
+		pthread_mutex_unlock(&locked->mutex);
+	}
+
+	return NULL;
+}
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
@@ -0,0 +1,155 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "spsc_queue.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: spsc_queue_test: " M "\n"); goto error;}
+
+#define CAPACITY	5
+#define SIZE		8
+#define ITEMS		1000000
+
+
+static struct SPSCQueue ring;
+
+static void *producer_run(void *);
+static int edges(void);
+static int wraparound(void);
+
+
+int main(const int argc, const char **argv)
+{
+	pthread_t producer;
+	uintptr_t expected = 1;
+	void *data;
+
+	if (edges())
+		log_msg("full/empty edges");
+	if (wraparound())
+		log_msg("index wraparound");
+
+	/* FIFO across threads through a ring much smaller than the stream */
+	if (!spsc_queue_init(NULL, CAPACITY, &ring))
+		return 1;
+	if (pthread_create(&producer, NULL, producer_run, NULL))
+		log_msg("pthread_create");
+	while (expected <= ITEMS) {
+		if (spsc_dequeue(&ring, &data)) {
+			sched_yield();
+			continue;
+		}
+		if ((uintptr_t)data != expected++) {
+			pthread_join(producer, NULL);
+			log_msg("out of order");
+		}
+	}
+	pthread_join(producer, NULL);
+	if (!is_spsc_queue_empty(&ring))
+		log_msg("not empty at the end");
+	spsc_queue_destroy(&ring);
+
+	/* elements left behind go to destroy_func */
+	if (!spsc_queue_init(free, CAPACITY, &ring))
+		return 1;
+	for (int i = 0; i < 3; ++i)
+		spsc_enqueue(&ring, malloc(16));
+	spsc_queue_destroy(&ring);
+
+	printf("spsc_queue_test: ok\n");
+	return 0;
+error:
+	return 1;
+}
+
+
+static void *producer_run(void *arg)
+{
+	for (uintptr_t i = 1; i <= ITEMS; ++i) {
+		while (spsc_enqueue(&ring, (void *)i))
+			sched_yield();
+	}
+
+	return NULL;
+}
+
+/*
+ * capacity rounds up to SIZE; one more than that must be refused. A
+ * capacity whose power of two would not fit a size_t fails up front.
+ */
+static int edges(void)
+{
+	struct SPSCQueue queue;
+	void *data;
+	int ret = -1;
+
+	errno = 0;
+	if (spsc_queue_init(NULL, (SIZE_MAX / 2 + 1) / sizeof(*queue.slots) + 1, &queue)
+			|| errno != EINVAL)
+		return -1;
+	errno = 0;
+	if (spsc_queue_init(NULL, SIZE_MAX, &queue) || errno != EINVAL)
+		return -1;
+	if (!spsc_queue_init(NULL, CAPACITY, &queue))
+		return -1;
+	if (!is_spsc_queue_empty(&queue) || !spsc_dequeue(&queue, &data))
+		goto out;
+	for (uintptr_t i = 1; i <= SIZE; ++i) {
+		if (spsc_enqueue(&queue, (void *)i))
+			goto out;
+	}
+	if (!spsc_enqueue(&queue, (void *)99))
+		goto out;
+	for (uintptr_t i = 1; i <= SIZE; ++i) {
+		if (spsc_dequeue(&queue, &data) || (uintptr_t)data != i)
+			goto out;
+	}
+	if (!is_spsc_queue_empty(&queue) || !spsc_dequeue(&queue, &data))
+		goto out;
+	ret = 0;
+out:
+	spsc_queue_destroy(&queue);
+	return ret;
+}
+
+/*
+ * Start the free-running indices just below SIZE_MAX so both the slot
+ * index and the counters themselves wrap during the run.
+ */
+static int wraparound(void)
+{
+	struct SPSCQueue queue;
+	uintptr_t next_in = 1;
+	uintptr_t next_out = 1;
+	void *data;
+	int ret = -1;
+
+	if (!spsc_queue_init(NULL, CAPACITY, &queue))
+		return -1;
+	queue.head = queue.tail = queue.head_cache = queue.tail_cache = SIZE_MAX - 3;
+
+	for (int round = 0; round < 100; ++round) {
+		/* fill to the brim, then drain part of it */
+		while (!spsc_enqueue(&queue, (void *)next_in))
+			++next_in;
+		if (next_in - next_out != SIZE)
+			goto out;
+		for (int i = 0; i < 1 + round % SIZE; ++i) {
+			if (spsc_dequeue(&queue, &data) || (uintptr_t)data != next_out++)
+				goto out;
+		}
+	}
+	while (!spsc_dequeue(&queue, &data)) {
+		if ((uintptr_t)data != next_out++)
+			goto out;
+	}
+	if (next_out != next_in || queue.head >= SIZE_MAX - 3)
+		goto out;
+	ret = 0;
+out:
+	spsc_queue_destroy(&queue);
+	return ret;
+}
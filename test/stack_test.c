@@ -0,0 +1,96 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "stack.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: stack_test: " M "\n"); goto error;}
+
+#define COUNT	1000
+
+
+static int push_pop(struct Stack *);
+static int push_pop_n(struct Stack *);
+
+
+int main(const int argc, const char **argv)
+{
+	int ret = 0;
+	struct Stack *stack = NULL;
+
+	if (!(stack = stack_new(NULL)))
+		log_msg("stack_new");
+	if (push_pop(stack))
+		log_msg("linked stack");
+	if (push_pop_n(stack))
+		log_msg("linked stack bulk");
+	stack_destroy(stack);
+
+	/* odd chunk size so pushes and pops straddle block boundaries */
+	if (!(stack = stack_new_chunked(NULL, 7)))
+		log_msg("stack_new_chunked");
+	if (push_pop(stack))
+		log_msg("chunked stack");
+	if (push_pop(stack))
+		log_msg("chunked stack reuse");
+	if (push_pop_n(stack))
+		log_msg("chunked stack bulk");
+
+	/* leave elements behind for destroy_func to release */
+	stack_destroy(stack);
+	if (!(stack = stack_new_chunked(free, 16)))
+		log_msg("stack_new_chunked");
+	for (int i = 0; i < COUNT; ++i)
+		stack_push(stack, malloc(16));
+
+	printf("stack_test: ok\n");
+out:
+	stack_destroy(stack);
+	return ret;
+error:
+	ret = 1;
+	goto out;
+}
+
+
+static int push_pop(struct Stack *stack)
+{
+	for (uintptr_t i = 1; i <= COUNT; ++i) {
+		if (stack_push(stack, (void *)i))
+			return -1;
+	}
+	for (uintptr_t i = COUNT; i > COUNT/2; --i) {
+		if ((uintptr_t)stack_pop(stack) != i)
+			return -1;
+	}
+	for (uintptr_t i = COUNT/2 + 1; i <= COUNT; ++i)
+		stack_push(stack, (void *)i);
+	for (uintptr_t i = COUNT; i >= 1; --i) {
+		if ((uintptr_t)stack_pop(stack) != i)
+			return -1;
+	}
+
+	return stack_is_empty(stack) && !stack_pop(stack) ? 0 : -1;
+}
+
+static int push_pop_n(struct Stack *stack)
+{
+	void *items[COUNT];
+	void *out[COUNT];
+	size_t popped;
+
+	for (uintptr_t i = 0; i < COUNT; ++i)
+		items[i] = (void *)(i + 1);
+	if (stack_push_n(stack, items, COUNT/2) || stack_push_n(stack, items + COUNT/2, COUNT/2))
+		return -1;
+
+	/* ask for more than is there: top comes out first */
+	if ((popped = stack_pop_n(stack, out, COUNT + 1)) != COUNT)
+		return -1;
+	for (size_t i = 0; i < popped; ++i) {
+		if (out[i] != items[COUNT - 1 - i])
+			return -1;
+	}
+
+	return stack_is_empty(stack) ? 0 : -1;
+}
@@ -0,0 +1,114 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "wsdeque.h"
+
+#define log_msg(M)	{fprintf(stderr, "error: wsdeque_test: " M "\n"); goto error;}
+
+#define THIEVES		3
+#define ITEMS		400000
+#define BURST		64
+#define GROW_ITEMS	1000
+
+
+static struct WSDeque deque;
+/* times each value came out of the deque, by owner or thief */
+static unsigned char seen[ITEMS + 1];
+static int stop;
+
+static void *thief_run(void *);
+static int growth(void);
+
+
+int main(const int argc, const char **argv)
+{
+	pthread_t thieves[THIEVES];
+	uintptr_t next = 1;
+	void *data;
+
+	if (growth())
+		log_msg("growth");
+
+	/* a two slot array: the owner grows it while thieves are stealing */
+	if (!wsdeque_init(&deque, 2))
+		return 1;
+	for (int i = 0; i < THIEVES; ++i) {
+		if (pthread_create(&thieves[i], NULL, thief_run, NULL))
+			log_msg("pthread_create");
+	}
+	while (next <= ITEMS) {
+		for (int i = 0; i < BURST && next <= ITEMS; ++i) {
+			if (wsdeque_push(&deque, (void *)next++))
+				log_msg("push");
+		}
+		/* pop half back, racing the thieves for the last ones */
+		for (int i = 0; i < BURST / 2; ++i) {
+			if ((data = wsdeque_pop(&deque)))
+				++seen[(uintptr_t)data];
+		}
+	}
+	while ((data = wsdeque_pop(&deque)))
+		++seen[(uintptr_t)data];
+	__atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+	for (int i = 0; i < THIEVES; ++i)
+		pthread_join(thieves[i], NULL);
+	wsdeque_destroy(&deque);
+
+	for (uintptr_t value = 1; value <= ITEMS; ++value) {
+		if (seen[value] != 1)
+			log_msg("value lost or duplicated");
+	}
+
+	printf("wsdeque_test: ok\n");
+	return 0;
+error:
+	return 1;
+}
+
+
+static void *thief_run(void *arg)
+{
+	void *data;
+
+	while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE)) {
+		if ((data = wsdeque_steal(&deque)))
+			__atomic_fetch_add(&seen[(uintptr_t)data], 1, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+/* single threaded: the array doubles and keeps order at both ends */
+static int growth(void)
+{
+	struct WSDeque d;
+	uintptr_t expected;
+
+	if (!wsdeque_init(&d, 2))
+		return -1;
+	for (uintptr_t i = 1; i <= GROW_ITEMS; ++i) {
+		if (wsdeque_push(&d, (void *)i))
+			log_msg("push");
+	}
+	if (d.array->size < GROW_ITEMS || !d.array->prev)
+		log_msg("array did not grow");
+	/* thieves take the oldest, the owner the newest */
+	for (expected = 1; expected <= GROW_ITEMS / 2; ++expected) {
+		if (wsdeque_steal(&d) != (void *)expected)
+			log_msg("steal out of order");
+	}
+	for (expected = GROW_ITEMS; expected > GROW_ITEMS / 2; --expected) {
+		if (wsdeque_pop(&d) != (void *)expected)
+			log_msg("pop out of order");
+	}
+	if (wsdeque_pop(&d) || wsdeque_steal(&d))
+		log_msg("deque not empty");
+	wsdeque_destroy(&d);
+
+	return 0;
+error:
+	wsdeque_destroy(&d);
+	return -1;
+}